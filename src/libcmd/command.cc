@@ -123,20 +123,27 @@ ref<Store> EvalCommand::getEvalStore()
     return ref<Store>(evalStore);
 }
 
+ref<EvalState> EvalCommand::makeEvalState()
+{
+    auto state = ref<EvalState>(
+        #if HAVE_BOEHMGC
+        std::allocate_shared<EvalState>(
+            traceable_allocator<EvalState>(),
+        #else
+        std::make_shared<EvalState>(
+        #endif
+            lookupPath, getEvalStore(), fetchSettings, evalSettings, getStore())
+        );
+
+    state->repair = repair;
+
+    return state;
+}
+
 ref<EvalState> EvalCommand::getEvalState()
 {
     if (!evalState) {
-        evalState =
-            #if HAVE_BOEHMGC
-            std::allocate_shared<EvalState>(
-                traceable_allocator<EvalState>(),
-            #else
-            std::make_shared<EvalState>(
-            #endif
-                lookupPath, getEvalStore(), fetchSettings, evalSettings, getStore())
-            ;
-
-        evalState->repair = repair;
+        evalState = makeEvalState();
 
         if (startReplOnEvalErrors) {
             evalState->debugRepl = &AbstractNixRepl::runSimple;
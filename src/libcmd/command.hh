@@ -87,6 +87,12 @@ struct EvalCommand : virtual StoreCommand, MixEvalArgs
 
     ref<EvalState> getEvalState();
 
+    /**
+     * Create a new evaluator with the same settings as the one
+     * returned by `getEvalState()`, e.g. for another thread.
+     */
+    ref<EvalState> makeEvalState();
+
 private:
     std::shared_ptr<Store> evalStore;
 
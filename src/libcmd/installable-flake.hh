@@ -82,8 +82,14 @@ static inline FlakeRef defaultNixpkgsFlakeRef()
     return FlakeRef::fromAttrs(fetchSettings, {{"type","indirect"}, {"id", "nixpkgs"}});
 }
 
+/**
+ * Open the evaluation cache of a flake. If `readOnly` is set, new
+ * results are not written to the cache, so that several evaluators can
+ * share it.
+ */
 ref<eval_cache::EvalCache> openEvalCache(
     EvalState & state,
-    std::shared_ptr<flake::LockedFlake> lockedFlake);
+    std::shared_ptr<flake::LockedFlake> lockedFlake,
+    bool readOnly = false);
 
 }
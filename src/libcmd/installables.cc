@@ -447,7 +447,8 @@ static StorePath getDeriver(
 
 ref<eval_cache::EvalCache> openEvalCache(
     EvalState & state,
-    std::shared_ptr<flake::LockedFlake> lockedFlake)
+    std::shared_ptr<flake::LockedFlake> lockedFlake,
+    bool readOnly)
 {
     auto fingerprint = evalSettings.useEvalCache && evalSettings.pureEval
         ? lockedFlake->getFingerprint(state.store)
@@ -473,7 +474,7 @@ ref<eval_cache::EvalCache> openEvalCache(
     if (fingerprint) {
         auto search = state.evalCaches.find(fingerprint.value());
         if (search == state.evalCaches.end()) {
-            search = state.evalCaches.emplace(fingerprint.value(), make_ref<nix::eval_cache::EvalCache>(fingerprint, state, rootLoader)).first;
+            search = state.evalCaches.emplace(fingerprint.value(), make_ref<nix::eval_cache::EvalCache>(fingerprint, state, rootLoader, readOnly)).first;
         }
         return search->second;
     } else {
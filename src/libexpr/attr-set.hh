@@ -72,6 +72,17 @@ public:
         attrs[size_++] = attr;
     }
 
+    /**
+     * Append the attributes in `[first, last)`, e.g. a run of
+     * attributes from another set.
+     */
+    void push_back(const_iterator first, const_iterator last)
+    {
+        assert(first <= last && last - first <= capacity_ - size_);
+        std::copy(first, last, &attrs[size_]);
+        size_ += last - first;
+    }
+
     const_iterator find(Symbol name) const
     {
         Attr key(name, 0);
@@ -161,6 +172,11 @@ public:
         bindings->push_back(attr);
     }
 
+    void insert(Bindings::const_iterator first, Bindings::const_iterator last)
+    {
+        bindings->push_back(first, last);
+    }
+
     Value & alloc(Symbol name, PosIdx pos = noPos);
 
     Value & alloc(std::string_view name, PosIdx pos = noPos);
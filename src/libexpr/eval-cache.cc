@@ -7,8 +7,13 @@
 // Need specialization involving `SymbolStr` just in this one module.
 #include "strings-inline.hh"
 
+#include <condition_variable>
+#include <thread>
+
 namespace nix::eval_cache {
 
+Stats stats;
+
 CachedEvalError::CachedEvalError(ref<AttrCursor> cursor, Symbol attr)
     : EvalError(cursor->root->state, "cached failure of attribute '%s'", cursor->getAttrPathStr(attr))
     , cursor(cursor), attr(attr)
@@ -45,57 +50,145 @@ struct AttrDb
 
     const StoreDirConfig & cfg;
 
+    /**
+     * A row of the `Attributes` table. The `value` column holds a
+     * string for strings and lists of strings, an integer for
+     * Booleans and integers, and is null otherwise.
+     */
+    struct Row
+    {
+        AttrId rowId = 0;
+        AttrType type;
+        std::string value;
+        int64_t intValue = 0;
+        std::optional<std::string> context;
+    };
+
+    /**
+     * The rows with a given parent, sorted by name like the primary
+     * key of the `Attributes` table.
+     */
+    typedef std::map<std::string, Row, std::less<>> Children;
+
     struct State
     {
         SQLite db;
         SQLiteStmt insertAttribute;
-        SQLiteStmt insertAttributeWithContext;
-        SQLiteStmt queryAttribute;
-        SQLiteStmt queryAttributes;
+        SQLiteStmt queryChildren;
         std::unique_ptr<SQLiteTxn> txn;
     };
 
     std::unique_ptr<Sync<State>> _state;
 
+    /**
+     * The children of the attributes looked up or written so far. All
+     * children of an attribute are fetched in a single query the
+     * first time one of them is needed, so that navigating the cache
+     * doesn't need a query per attribute. Writes are applied here
+     * immediately, so this is always consistent with the database plus
+     * the rows that haven't been written yet.
+     */
+    Sync<std::unordered_map<AttrId, Children>> _children;
+
+    /**
+     * Rows are written to the database in batches by a background
+     * thread, so that evaluation doesn't wait for SQLite.
+     */
+    struct PendingRow
+    {
+        AttrId parent;
+        std::string name;
+        Row row;
+    };
+
+    struct Queue
+    {
+        std::vector<PendingRow> rows;
+        bool writing = false;
+        bool quit = false;
+    };
+
+    Sync<Queue> _queue;
+
+    /**
+     * Signalled when rows are added to the queue, and when the writer
+     * thread has finished a batch.
+     */
+    std::condition_variable queueChanged;
+
+    /**
+     * The maximum number of rows waiting to be written. Evaluation
+     * blocks when the writer thread falls this far behind.
+     */
+    static constexpr size_t maxQueued = 16384;
+
+    /**
+     * Row IDs are assigned here rather than by SQLite, so that
+     * inserting a row doesn't have to wait for the write.
+     */
+    std::atomic<AttrId> nextRowId;
+
+    std::thread writerThread;
+
+    /**
+     * Whether new rows are kept in memory only. Read-only databases
+     * don't hold a transaction, so they can be used alongside a
+     * writable one, e.g. by parallel evaluator threads.
+     */
+    const bool readOnly;
+
     SymbolTable & symbols;
 
     AttrDb(
         const StoreDirConfig & cfg,
-        const Hash & fingerprint,
+        const Path & dbPath,
+        bool readOnly,
         SymbolTable & symbols)
         : cfg(cfg)
         , _state(std::make_unique<Sync<State>>())
+        , readOnly(readOnly)
         , symbols(symbols)
     {
         auto state(_state->lock());
 
-        Path cacheDir = getCacheDir() + "/nix/eval-cache-v5";
-        createDirs(cacheDir);
-
-        Path dbPath = cacheDir + "/" + fingerprint.to_string(HashFormat::Base16, false) + ".sqlite";
-
-        state->db = SQLite(dbPath);
+        state->db = SQLite(dbPath, readOnly ? SQLiteOpenMode::NoCreate : SQLiteOpenMode::Normal);
         state->db.isCache();
-        state->db.exec(schema);
 
-        state->insertAttribute.create(state->db,
-            "insert or replace into Attributes(parent, name, type, value) values (?, ?, ?, ?)");
+        state->queryChildren.create(state->db,
+            "select rowid, name, type, value, context from Attributes where parent = ?");
 
-        state->insertAttributeWithContext.create(state->db,
-            "insert or replace into Attributes(parent, name, type, value, context) values (?, ?, ?, ?, ?)");
+        if (!readOnly) {
+            state->db.exec(schema);
 
-        state->queryAttribute.create(state->db,
-            "select rowid, type, value, context from Attributes where parent = ? and name = ?");
+            state->insertAttribute.create(state->db,
+                "insert or replace into Attributes(rowid, parent, name, type, value, context) values (?, ?, ?, ?, ?, ?)");
 
-        state->queryAttributes.create(state->db,
-            "select name from Attributes where parent = ?");
+            state->txn = std::make_unique<SQLiteTxn>(state->db);
+        }
+
+        /* Also look at the parents, so that a new row never adopts
+           the orphaned children of a replaced one. */
+        SQLiteStmt queryMaxRowId(state->db,
+            "select max(coalesce(max(rowid), 0), coalesce(max(parent), 0)) from Attributes");
+        auto queryMaxRowId_(queryMaxRowId.use());
+        nextRowId = queryMaxRowId_.next() ? queryMaxRowId_.getInt(0) + 1 : 1;
 
-        state->txn = std::make_unique<SQLiteTxn>(state->db);
+        if (!readOnly)
+            writerThread = std::thread([this]() { writerThreadMain(); });
     }
 
     ~AttrDb()
     {
+        if (readOnly) return;
+
         try {
+            {
+                auto queue(_queue.lock());
+                queue->quit = true;
+            }
+            queueChanged.notify_all();
+            writerThread.join();
+
             auto state(_state->lock());
             if (!failed && state->txn->active)
                 state->txn->commit();
@@ -105,45 +198,152 @@ struct AttrDb
         }
     }
 
-    template<typename F>
-    AttrId doSQLite(F && fun)
+    void writerThreadMain()
     {
-        if (failed) return 0;
-        try {
-            return fun();
-        } catch (SQLiteError &) {
-            ignoreException();
-            failed = true;
-            return 0;
+        while (true) {
+            std::vector<PendingRow> rows;
+
+            {
+                auto queue(_queue.lock());
+                while (queue->rows.empty() && !queue->quit)
+                    queue.wait(queueChanged);
+                if (queue->rows.empty()) return;
+                std::swap(rows, queue->rows);
+                queue->writing = true;
+            }
+            queueChanged.notify_all();
+
+            if (!failed) {
+                auto before = std::chrono::steady_clock::now();
+
+                try {
+                    auto state(_state->lock());
+                    for (auto & [parent, name, row] : rows) {
+                        auto use(state->insertAttribute.use());
+                        use(row.rowId)(parent)(name)(row.type);
+                        if (hasIntValue(row.type))
+                            use(row.intValue);
+                        else if (hasStringValue(row.type))
+                            use(row.value);
+                        else
+                            use(0, false);
+                        if (row.context)
+                            use(*row.context);
+                        else
+                            use(0, false);
+                        use.exec();
+                    }
+                } catch (SQLiteError &) {
+                    ignoreException();
+                    failed = true;
+                }
+
+                stats.inserts += rows.size();
+                stats.insertTime += std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - before).count();
+            }
+
+            {
+                auto queue(_queue.lock());
+                queue->writing = false;
+            }
+            queueChanged.notify_all();
         }
     }
 
-    AttrId setAttrs(
-        AttrKey key,
-        const std::vector<Symbol> & attrs)
+    /**
+     * Wait until all queued rows have been written.
+     */
+    void flush()
+    {
+        auto queue(_queue.lock());
+        while (!queue->rows.empty() || queue->writing)
+            queue.wait(queueChanged);
+    }
+
+    static bool hasIntValue(AttrType type)
     {
-        return doSQLite([&]()
+        return type == AttrType::Bool || type == AttrType::Int;
+    }
+
+    static bool hasStringValue(AttrType type)
+    {
+        return type == AttrType::String || type == AttrType::ListOfStrings;
+    }
+
+    Children & getChildren(std::unordered_map<AttrId, Children> & index, AttrId parent)
+    {
+        auto i = index.find(parent);
+        if (i != index.end()) return i->second;
+
+        Children children;
+
+        /* The database must include the rows that are still queued. */
+        flush();
+
         {
             auto state(_state->lock());
+            auto query(state->queryChildren.use()(parent));
+            while (query.next()) {
+                Row row {
+                    .rowId = (AttrId) query.getInt(0),
+                    .type = (AttrType) query.getInt(2),
+                };
+                if (hasIntValue(row.type))
+                    row.intValue = query.getInt(3);
+                else if (hasStringValue(row.type))
+                    row.value = query.getStr(3);
+                if (!query.isNull(4))
+                    row.context = query.getStr(4);
+                children.insert_or_assign(query.getStr(1), std::move(row));
+            }
+        }
 
-            state->insertAttribute.use()
-                (key.first)
-                (symbols[key.second])
-                (AttrType::FullAttrs)
-                (0, false).exec();
+        return index.emplace(parent, std::move(children)).first->second;
+    }
 
-            AttrId rowId = state->db.getLastInsertedRowId();
-            assert(rowId);
+    AttrId insert(AttrKey key, Row && row)
+    {
+        if (failed) return 0;
 
+        auto rowId = row.rowId = nextRowId++;
+
+        auto name = symbols[key.second];
+
+        {
+            auto index(_children.lock());
+            /* A new row doesn't have any children yet. */
+            index->emplace(row.rowId, Children());
+            auto i = index->find(key.first);
+            if (i != index->end())
+                i->second.insert_or_assign(std::string(name), row);
+        }
+
+        if (readOnly) return rowId;
+
+        {
+            auto queue(_queue.lock());
+            while (queue->rows.size() >= maxQueued)
+                queue.wait(queueChanged);
+            queue->rows.push_back({key.first, std::string(name), std::move(row)});
+            if (queue->rows.size() == 1)
+                queueChanged.notify_all();
+        }
+
+        return rowId;
+    }
+
+    AttrId setAttrs(
+        AttrKey key,
+        const std::vector<Symbol> & attrs)
+    {
+        auto rowId = insert(key, {.type = AttrType::FullAttrs});
+
+        if (rowId)
             for (auto & attr : attrs)
-                state->insertAttribute.use()
-                    (rowId)
-                    (symbols[attr])
-                    (AttrType::Placeholder)
-                    (0, false).exec();
+                insert({rowId, attr}, {.type = AttrType::Placeholder});
 
-            return rowId;
-        });
+        return rowId;
     }
 
     AttrId setString(
@@ -151,186 +351,94 @@ struct AttrDb
         std::string_view s,
         const char * * context = nullptr)
     {
-        return doSQLite([&]()
-        {
-            auto state(_state->lock());
+        Row row{.type = AttrType::String, .value = std::string(s)};
 
-            if (context) {
-                std::string ctx;
-                for (const char * * p = context; *p; ++p) {
-                    if (p != context) ctx.push_back(' ');
-                    ctx.append(*p);
-                }
-                state->insertAttributeWithContext.use()
-                    (key.first)
-                    (symbols[key.second])
-                    (AttrType::String)
-                    (s)
-                    (ctx).exec();
-            } else {
-                state->insertAttribute.use()
-                    (key.first)
-                    (symbols[key.second])
-                    (AttrType::String)
-                (s).exec();
+        if (context) {
+            std::string ctx;
+            for (const char * * p = context; *p; ++p) {
+                if (p != context) ctx.push_back(' ');
+                ctx.append(*p);
             }
+            row.context = std::move(ctx);
+        }
 
-            return state->db.getLastInsertedRowId();
-        });
+        return insert(key, std::move(row));
     }
 
     AttrId setBool(
         AttrKey key,
         bool b)
     {
-        return doSQLite([&]()
-        {
-            auto state(_state->lock());
-
-            state->insertAttribute.use()
-                (key.first)
-                (symbols[key.second])
-                (AttrType::Bool)
-                (b ? 1 : 0).exec();
-
-            return state->db.getLastInsertedRowId();
-        });
+        return insert(key, {.type = AttrType::Bool, .intValue = b ? 1 : 0});
     }
 
     AttrId setInt(
         AttrKey key,
         int n)
     {
-        return doSQLite([&]()
-        {
-            auto state(_state->lock());
-
-            state->insertAttribute.use()
-                (key.first)
-                (symbols[key.second])
-                (AttrType::Int)
-                (n).exec();
-
-            return state->db.getLastInsertedRowId();
-        });
+        return insert(key, {.type = AttrType::Int, .intValue = n});
     }
 
     AttrId setListOfStrings(
         AttrKey key,
         const std::vector<std::string> & l)
     {
-        return doSQLite([&]()
-        {
-            auto state(_state->lock());
-
-            state->insertAttribute.use()
-                (key.first)
-                (symbols[key.second])
-                (AttrType::ListOfStrings)
-                (dropEmptyInitThenConcatStringsSep("\t", l)).exec();
-
-            return state->db.getLastInsertedRowId();
-        });
+        return insert(key, {.type = AttrType::ListOfStrings, .value = dropEmptyInitThenConcatStringsSep("\t", l)});
     }
 
     AttrId setPlaceholder(AttrKey key)
     {
-        return doSQLite([&]()
-        {
-            auto state(_state->lock());
-
-            state->insertAttribute.use()
-                (key.first)
-                (symbols[key.second])
-                (AttrType::Placeholder)
-                (0, false).exec();
-
-            return state->db.getLastInsertedRowId();
-        });
+        return insert(key, {.type = AttrType::Placeholder});
     }
 
     AttrId setMissing(AttrKey key)
     {
-        return doSQLite([&]()
-        {
-            auto state(_state->lock());
-
-            state->insertAttribute.use()
-                (key.first)
-                (symbols[key.second])
-                (AttrType::Missing)
-                (0, false).exec();
-
-            return state->db.getLastInsertedRowId();
-        });
+        return insert(key, {.type = AttrType::Missing});
     }
 
     AttrId setMisc(AttrKey key)
     {
-        return doSQLite([&]()
-        {
-            auto state(_state->lock());
-
-            state->insertAttribute.use()
-                (key.first)
-                (symbols[key.second])
-                (AttrType::Misc)
-                (0, false).exec();
-
-            return state->db.getLastInsertedRowId();
-        });
+        return insert(key, {.type = AttrType::Misc});
     }
 
     AttrId setFailed(AttrKey key)
     {
-        return doSQLite([&]()
-        {
-            auto state(_state->lock());
-
-            state->insertAttribute.use()
-                (key.first)
-                (symbols[key.second])
-                (AttrType::Failed)
-                (0, false).exec();
-
-            return state->db.getLastInsertedRowId();
-        });
+        return insert(key, {.type = AttrType::Failed});
     }
 
     std::optional<std::pair<AttrId, AttrValue>> getAttr(AttrKey key)
     {
-        auto state(_state->lock());
+        auto index(_children.lock());
 
-        auto queryAttribute(state->queryAttribute.use()(key.first)(symbols[key.second]));
-        if (!queryAttribute.next()) return {};
+        auto & children = getChildren(*index, key.first);
+        auto i = children.find(std::string_view(symbols[key.second]));
+        if (i == children.end()) return {};
 
-        auto rowId = (AttrId) queryAttribute.getInt(0);
-        auto type = (AttrType) queryAttribute.getInt(1);
+        auto & row = i->second;
+        auto rowId = row.rowId;
 
-        switch (type) {
+        switch (row.type) {
             case AttrType::Placeholder:
                 return {{rowId, placeholder_t()}};
             case AttrType::FullAttrs: {
-                // FIXME: expensive, should separate this out.
                 std::vector<Symbol> attrs;
-                auto queryAttributes(state->queryAttributes.use()(rowId));
-                while (queryAttributes.next())
-                    attrs.emplace_back(symbols.create(queryAttributes.getStr(0)));
+                for (auto & [name, _] : getChildren(*index, rowId))
+                    attrs.emplace_back(symbols.create(name));
                 return {{rowId, attrs}};
             }
             case AttrType::String: {
                 NixStringContext context;
-                if (!queryAttribute.isNull(3))
-                    for (auto & s : tokenizeString<std::vector<std::string>>(queryAttribute.getStr(3), ";"))
+                if (row.context)
+                    for (auto & s : tokenizeString<std::vector<std::string>>(*row.context, ";"))
                         context.insert(NixStringContextElem::parse(s));
-                return {{rowId, string_t{queryAttribute.getStr(2), context}}};
+                return {{rowId, string_t{row.value, context}}};
             }
             case AttrType::Bool:
-                return {{rowId, queryAttribute.getInt(2) != 0}};
+                return {{rowId, row.intValue != 0}};
             case AttrType::Int:
-                return {{rowId, int_t{NixInt{queryAttribute.getInt(2)}}}};
+                return {{rowId, int_t{NixInt{row.intValue}}}};
             case AttrType::ListOfStrings:
-                return {{rowId, tokenizeString<std::vector<std::string>>(queryAttribute.getStr(2), "\t")}};
+                return {{rowId, tokenizeString<std::vector<std::string>>(row.value, "\t")}};
             case AttrType::Missing:
                 return {{rowId, missing_t()}};
             case AttrType::Misc:
@@ -346,10 +454,19 @@ struct AttrDb
 static std::shared_ptr<AttrDb> makeAttrDb(
     const StoreDirConfig & cfg,
     const Hash & fingerprint,
+    bool readOnly,
     SymbolTable & symbols)
 {
     try {
-        return std::make_shared<AttrDb>(cfg, fingerprint, symbols);
+        Path cacheDir = getCacheDir() + "/nix/eval-cache-v5";
+        Path dbPath = cacheDir + "/" + fingerprint.to_string(HashFormat::Base16, false) + ".sqlite";
+
+        if (readOnly) {
+            if (!pathExists(dbPath)) return nullptr;
+        } else
+            createDirs(cacheDir);
+
+        return std::make_shared<AttrDb>(cfg, dbPath, readOnly, symbols);
     } catch (SQLiteError &) {
         ignoreException();
         return nullptr;
@@ -359,8 +476,9 @@ static std::shared_ptr<AttrDb> makeAttrDb(
 EvalCache::EvalCache(
     std::optional<std::reference_wrapper<const Hash>> useCache,
     EvalState & state,
-    RootLoader rootLoader)
-    : db(useCache ? makeAttrDb(*state.store, *useCache, state.symbols) : nullptr)
+    RootLoader rootLoader,
+    bool readOnly)
+    : db(useCache ? makeAttrDb(*state.store, *useCache, readOnly, state.symbols) : nullptr)
     , state(state)
     , rootLoader(rootLoader)
 {
@@ -449,6 +567,8 @@ Value & AttrCursor::forceValue()
 {
     debug("evaluating uncached attribute '%s'", getAttrPathStr());
 
+    if (root->db) stats.misses++;
+
     auto & v = getValue();
 
     try {
@@ -499,6 +619,7 @@ std::shared_ptr<AttrCursor> AttrCursor::maybeGetAttr(Symbol name)
 
         if (cachedValue) {
             if (auto attrs = std::get_if<std::vector<Symbol>>(&cachedValue->second)) {
+                stats.hits++;
                 for (auto & attr : *attrs)
                     if (attr == name)
                         return std::make_shared<AttrCursor>(root, std::make_pair(shared_from_this(), attr));
@@ -506,6 +627,7 @@ std::shared_ptr<AttrCursor> AttrCursor::maybeGetAttr(Symbol name)
             } else if (std::get_if<placeholder_t>(&cachedValue->second)) {
                 auto attr = root->db->getAttr({cachedValue->first, name});
                 if (attr) {
+                    stats.hits++;
                     if (std::get_if<missing_t>(&attr->second))
                         return nullptr;
                     else if (std::get_if<failed_t>(&attr->second))
@@ -590,6 +712,7 @@ std::string AttrCursor::getString()
         if (cachedValue && !std::get_if<placeholder_t>(&cachedValue->second)) {
             if (auto s = std::get_if<string_t>(&cachedValue->second)) {
                 debug("using cached string attribute '%s'", getAttrPathStr());
+                stats.hits++;
                 return s->first;
             } else
                 root->state.error<TypeError>("'%s' is not a string", getAttrPathStr()).debugThrow();
@@ -631,6 +754,7 @@ string_t AttrCursor::getStringWithContext()
                 }
                 if (valid) {
                     debug("using cached string attribute '%s'", getAttrPathStr());
+                    stats.hits++;
                     return *s;
                 }
             } else
@@ -659,6 +783,7 @@ bool AttrCursor::getBool()
         if (cachedValue && !std::get_if<placeholder_t>(&cachedValue->second)) {
             if (auto b = std::get_if<bool>(&cachedValue->second)) {
                 debug("using cached Boolean attribute '%s'", getAttrPathStr());
+                stats.hits++;
                 return *b;
             } else
                 root->state.error<TypeError>("'%s' is not a Boolean", getAttrPathStr()).debugThrow();
@@ -681,6 +806,7 @@ NixInt AttrCursor::getInt()
         if (cachedValue && !std::get_if<placeholder_t>(&cachedValue->second)) {
             if (auto i = std::get_if<int_t>(&cachedValue->second)) {
                 debug("using cached integer attribute '%s'", getAttrPathStr());
+                stats.hits++;
                 return i->x;
             } else
                 root->state.error<TypeError>("'%s' is not an integer", getAttrPathStr()).debugThrow();
@@ -703,6 +829,7 @@ std::vector<std::string> AttrCursor::getListOfStrings()
         if (cachedValue && !std::get_if<placeholder_t>(&cachedValue->second)) {
             if (auto l = std::get_if<std::vector<std::string>>(&cachedValue->second)) {
                 debug("using cached list of strings attribute '%s'", getAttrPathStr());
+                stats.hits++;
                 return *l;
             } else
                 root->state.error<TypeError>("'%s' is not a list of strings", getAttrPathStr()).debugThrow();
@@ -711,6 +838,8 @@ std::vector<std::string> AttrCursor::getListOfStrings()
 
     debug("evaluating uncached attribute '%s'", getAttrPathStr());
 
+    if (root->db) stats.misses++;
+
     auto & v = getValue();
     root->state.forceValue(v, noPos);
 
@@ -736,6 +865,7 @@ std::vector<Symbol> AttrCursor::getAttrs()
         if (cachedValue && !std::get_if<placeholder_t>(&cachedValue->second)) {
             if (auto attrs = std::get_if<std::vector<Symbol>>(&cachedValue->second)) {
                 debug("using cached attrset attribute '%s'", getAttrPathStr());
+                stats.hits++;
                 return *attrs;
             } else
                 root->state.error<TypeError>("'%s' is not an attribute set", getAttrPathStr()).debugThrow();
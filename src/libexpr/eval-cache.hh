@@ -5,6 +5,7 @@
 #include "hash.hh"
 #include "eval.hh"
 
+#include <atomic>
 #include <functional>
 #include <variant>
 
@@ -13,6 +14,35 @@ namespace nix::eval_cache {
 struct AttrDb;
 class AttrCursor;
 
+/**
+ * Counters describing the use of the evaluation cache, reported by
+ * `NIX_SHOW_STATS`.
+ */
+struct Stats
+{
+    /**
+     * Lookups answered from the cache.
+     */
+    std::atomic<uint64_t> hits{0};
+
+    /**
+     * Lookups that required evaluation.
+     */
+    std::atomic<uint64_t> misses{0};
+
+    /**
+     * Rows written to the cache.
+     */
+    std::atomic<uint64_t> inserts{0};
+
+    /**
+     * Time spent writing rows, in microseconds.
+     */
+    std::atomic<uint64_t> insertTime{0};
+};
+
+extern Stats stats;
+
 struct CachedEvalError : EvalError
 {
     const ref<AttrCursor> cursor;
@@ -43,10 +73,15 @@ class EvalCache : public std::enable_shared_from_this<EvalCache>
 
 public:
 
+    /**
+     * @param readOnly Don't write to the cache. This allows several
+     * evaluators to share it, e.g. in different threads.
+     */
     EvalCache(
         std::optional<std::reference_wrapper<const Hash>> useCache,
         EvalState & state,
-        RootLoader rootLoader);
+        RootLoader rootLoader,
+        bool readOnly = false);
 
     ref<AttrCursor> getRoot();
 };
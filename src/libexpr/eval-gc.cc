@@ -50,6 +50,15 @@ static inline void initGCReal()
 
     GC_INIT();
 
+    /* Allow other threads to evaluate (see `GCThreadRegistration`). */
+    GC_allow_register_threads();
+
+    /* On 64-bit platforms, `Value` stores its type in the alignment
+       bits of a pointer (see `ValueStorage`), so such tagged pointers
+       must also be recognised. */
+    for (size_t i = 1; i < 8; ++i)
+        GC_register_displacement(i);
+
     GC_set_oom_fn(oomHandler);
 
     /* Set the initial heap size to something fairly big (25% of
@@ -114,4 +123,25 @@ void assertGCInitialized()
     assert(gcInitialised);
 }
 
+GCThreadRegistration::GCThreadRegistration()
+{
+    assertGCInitialized();
+#if HAVE_BOEHMGC
+    struct GC_stack_base sb;
+    if (GC_get_stack_base(&sb) != GC_SUCCESS)
+        throw Error("cannot get the stack base of the current thread");
+    /* This fails with GC_DUPLICATE if the thread is already
+       registered, e.g. if it's the main thread. */
+    registered = GC_register_my_thread(&sb) == GC_SUCCESS;
+#endif
+}
+
+GCThreadRegistration::~GCThreadRegistration()
+{
+#if HAVE_BOEHMGC
+    if (registered)
+        GC_unregister_my_thread();
+#endif
+}
+
 } // namespace nix
@@ -15,6 +15,22 @@ void initGC();
  */
 void assertGCInitialized();
 
+/**
+ * Register the calling thread with the Boehm GC, if applicable, for
+ * the lifetime of this object. Threads other than the main thread
+ * must do this before they evaluate anything, because the collector
+ * has to scan their stacks.
+ */
+struct GCThreadRegistration
+{
+    GCThreadRegistration();
+    GCThreadRegistration(const GCThreadRegistration &) = delete;
+    ~GCThreadRegistration();
+
+private:
+    [[maybe_unused]] bool registered = false;
+};
+
 #ifdef HAVE_BOEHMGC
 /**
  * The number of GC cycles since initGC().
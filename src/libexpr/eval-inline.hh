@@ -25,6 +25,26 @@ inline void * allocBytes(size_t n)
 }
 
 
+/**
+ * Allocate memory for a string of `size` bytes (including the
+ * terminating NUL) that will not contain any pointers.
+ *
+ * Note: unlike `allocBytes()`, the memory is not zeroed.
+ */
+[[gnu::always_inline]]
+inline char * allocString(size_t size)
+{
+    char * t;
+#if HAVE_BOEHMGC
+    t = (char *) GC_MALLOC_ATOMIC(size);
+#else
+    t = (char *) malloc(size);
+#endif
+    if (!t) throw std::bad_alloc();
+    return t;
+}
+
+
 [[gnu::always_inline]]
 Value * EvalState::allocValue()
 {
@@ -86,8 +106,8 @@ Env & EvalState::allocEnv(size_t size)
 void EvalState::forceValue(Value & v, const PosIdx pos)
 {
     if (v.isThunk()) {
-        Env * env = v.payload.thunk.env;
-        Expr * expr = v.payload.thunk.expr;
+        Env * env = v.thunk().env;
+        Expr * expr = v.thunk().expr;
         try {
             v.mkBlackhole();
             //checkInterrupt();
@@ -99,7 +119,7 @@ void EvalState::forceValue(Value & v, const PosIdx pos)
         }
     }
     else if (v.isApp())
-        callFunction(*v.payload.app.left, *v.payload.app.right, v, pos);
+        callFunction(*v.app().left, *v.app().right, v, pos);
 }
 
 
@@ -0,0 +1,83 @@
+#include "eval-profiler.hh"
+#include "eval.hh"
+#include "util.hh"
+#include "sync.hh"
+
+#include <fstream>
+
+namespace nix {
+
+EvalProfiler::EvalProfiler(EvalState & state, std::string path, unsigned int frequency)
+    : state(state)
+    , path(std::move(path))
+    , interval(std::chrono::duration_cast<Clock::duration>(std::chrono::seconds(1)) / std::max(frequency, 1u))
+    , nextSample(Clock::now() + interval)
+{
+}
+
+/**
+ * The samples of all profilers that have written to each file. Commands
+ * such as `nix search` evaluate in several threads, each with its own
+ * `EvalState` and profiler; this way they add up to a single profile
+ * rather than overwrite each other's.
+ */
+static Sync<std::map<std::string, std::map<std::string, uint64_t>>> & profiles =
+    *new Sync<std::map<std::string, std::map<std::string, uint64_t>>>;
+
+EvalProfiler::~EvalProfiler()
+{
+    try {
+        auto profiles_(profiles.lock());
+        auto & lines = (*profiles_)[path];
+        collect(lines);
+        std::ofstream str(path);
+        if (!str)
+            throw SysError("opening evaluation profile '%s'", path);
+        for (auto & [line, count] : lines)
+            str << line << ' ' << count << '\n';
+        if (!str)
+            throw Error("writing evaluation profile '%s'", path);
+    } catch (...) {
+        ignoreException();
+    }
+}
+
+void EvalProfiler::sample(Clock::time_point now)
+{
+    /* Charge every interval that elapsed since the last sample to the
+       current stack. */
+    auto n = (now - nextSample) / interval + 1;
+    samples[stack] += n;
+    nextSample += n * interval;
+}
+
+std::string EvalProfiler::showFrame(const Frame & frame) const
+{
+    std::string s;
+    if (frame.lambda)
+        s = frame.lambda->showNamePos(state);
+    else if (frame.primOp)
+        s = fmt("«primop %s»", frame.primOp->name);
+    /* ';' separates frames, so it must not appear within one. */
+    for (auto & c : s)
+        if (c == ';') c = ',';
+    return s;
+}
+
+void EvalProfiler::collect(std::map<std::string, uint64_t> & lines) const
+{
+    std::map<Frame, std::string> names;
+
+    for (auto & [frames, count] : samples) {
+        std::string line = "«top-level»";
+        for (auto & frame : frames) {
+            auto [i, inserted] = names.try_emplace(frame);
+            if (inserted) i->second = showFrame(frame);
+            line += ';';
+            line += i->second;
+        }
+        lines[line] += count;
+    }
+}
+
+}
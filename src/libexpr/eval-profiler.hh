@@ -0,0 +1,114 @@
+#pragma once
+///@file
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace nix {
+
+class EvalState;
+struct ExprLambda;
+struct PrimOp;
+
+/**
+ * A sampling profiler for Nix-level function calls.
+ *
+ * The profiler keeps a shadow stack of the lambdas and primops that
+ * are being called. Samples are taken at call boundaries: whenever a
+ * sampling interval has elapsed since the last sample, the time is
+ * charged to the current stack. This avoids signals or threads, and
+ * costs one clock read per call while profiling.
+ *
+ * On destruction, the samples are written to a file in the "collapsed
+ * stack" format understood by `flamegraph.pl` and similar tools,
+ * together with those of other profilers in this process that wrote
+ * to the same file.
+ */
+class EvalProfiler
+{
+public:
+
+    struct Frame
+    {
+        const ExprLambda * lambda = nullptr;
+        const PrimOp * primOp = nullptr;
+
+        auto operator <=>(const Frame &) const = default;
+    };
+
+    /**
+     * RAII helper that pushes a frame onto the shadow stack.
+     */
+    struct Call
+    {
+        EvalProfiler * profiler;
+
+        Call(EvalProfiler * profiler, Frame frame)
+            : profiler(profiler)
+        {
+            if (profiler) profiler->enter(frame);
+        }
+
+        ~Call()
+        {
+            if (profiler) profiler->leave();
+        }
+
+        Call(const Call &) = delete;
+        Call & operator =(const Call &) = delete;
+    };
+
+    EvalProfiler(EvalState & state, std::string path, unsigned int frequency);
+
+    ~EvalProfiler();
+
+    void enter(Frame frame)
+    {
+        maybeSample();
+        stack.push_back(frame);
+    }
+
+    void leave()
+    {
+        maybeSample();
+        stack.pop_back();
+    }
+
+    /**
+     * Add the samples to `lines`, which maps stacks in collapsed stack
+     * format to their number of samples.
+     */
+    void collect(std::map<std::string, uint64_t> & lines) const;
+
+private:
+
+    using Clock = std::chrono::steady_clock;
+
+    EvalState & state;
+
+    std::string path;
+
+    Clock::duration interval;
+
+    Clock::time_point nextSample;
+
+    std::vector<Frame> stack;
+
+    std::map<std::vector<Frame>, uint64_t> samples;
+
+    void maybeSample()
+    {
+        auto now = Clock::now();
+        if (now >= nextSample) [[unlikely]]
+            sample(now);
+    }
+
+    void sample(Clock::time_point now);
+
+    std::string showFrame(const Frame & frame) const;
+};
+
+}
@@ -184,6 +184,32 @@ struct EvalSettings : Config
           `flamegraph.pl`.
         )"};
 
+    OptionalPathSetting evalProfileFile{this, std::nullopt, "eval-profile-file",
+        R"(
+          If set, the Nix evaluator will periodically sample the stack of
+          Nix function calls being evaluated, and write the samples to this
+          file when evaluation is done.
+
+          The file uses the "collapsed stack" format, with one stack of
+          semicolon-separated frames followed by its number of samples per
+          line:
+
+              «top-level»;'f' at /nix/store/.../example.nix:3:7;«primop map» 14
+
+          It can be turned into a flame graph using tools such as
+          [`flamegraph.pl`](https://github.com/brendangregg/FlameGraph) or
+          [speedscope](https://www.speedscope.app/).
+
+          Unlike [`trace-function-calls`](#conf-trace-function-calls), this
+          is cheap enough to use on large evaluations.
+        )"};
+
+    Setting<unsigned int> evalProfilerFrequency{this, 99, "eval-profiler-frequency",
+        R"(
+          The number of samples per second taken by the evaluation profiler
+          enabled by [`eval-profile-file`](#conf-eval-profile-file).
+        )"};
+
     Setting<bool> useEvalCache{this, true, "eval-cache",
         R"(
             Whether to use the flake evaluation cache.
@@ -191,6 +217,27 @@ struct EvalSettings : Config
             Intermediate results are not cached.
         )"};
 
+    Setting<bool> parseCache{this, false, "parse-cache",
+        R"(
+            If set to true, Nix stores the syntax trees of the Nix files it parses in a cache in `~/.cache/nix`, and loads them from there rather than parsing files again that haven't changed.
+            This speeds up evaluations that import many files, such as those of Nixpkgs, when they are run repeatedly.
+            The cache may be deleted at any time.
+        )"};
+
+    Setting<unsigned int> evalJobs{this, 1, "eval-jobs",
+        R"(
+            The number of threads used by commands that can evaluate independent attributes in parallel, such as [`nix search`](@docroot@/command-ref/new-cli/nix3-search.md) and [`nix flake check`](@docroot@/command-ref/new-cli/nix3-flake-check.md).
+            Each thread has its own evaluator, and only reads from the flake evaluation cache.
+            The value `0` means the number of CPUs.
+        )"};
+
+    Setting<bool> prefetchImports{this, false, "prefetch-imports",
+        R"(
+            If set to true, Nix parses the files referred to by path literals (such as `./foo.nix`) in the background as soon as the file containing them has been parsed, on the assumption that they will be imported later.
+            Parse errors in these files are only reported if and when they are actually imported.
+            This speeds up the evaluation of expressions that are spread over many files, such as Nixpkgs or NixOS configurations.
+        )"};
+
     Setting<bool> ignoreExceptionsDuringTry{this, false, "ignore-try",
         R"(
           If set to true, ignore exceptions inside 'tryEval' calls when evaluating nix expressions in
@@ -201,7 +248,24 @@ struct EvalSettings : Config
         "Whether `builtins.traceVerbose` should trace its first argument when evaluated."};
 
     Setting<unsigned int> maxCallDepth{this, 10000, "max-call-depth",
-        "The maximum function call depth to allow before erroring."};
+        R"(
+          The maximum function call depth to allow before erroring.
+
+          Function calls in tail position, such as the recursive call in
+          `f = n: if n == 0 then 0 else f (n - 1)`, replace the current
+          call and don't count towards this limit. See
+          [`max-tail-calls`](#conf-max-tail-calls).
+        )"};
+
+    Setting<unsigned int> maxTailCalls{this, 1000000, "max-tail-calls",
+        R"(
+          The maximum number of function calls in tail position that may
+          replace a single function call before erroring.
+
+          Tail calls don't use up the stack of the Nix process, so
+          infinite tail recursion such as `(x: x x) (x: x x)` would
+          otherwise never terminate.
+        )"};
 
     Setting<bool> builtinsTraceDebugger{this, false, "debugger-on-trace",
         R"(
@@ -20,9 +20,15 @@
 #include "url.hh"
 #include "fetch-to-store.hh"
 #include "tarball.hh"
+#include "std-hash.hh"
 #include "parser-tab.hh"
+#include "eval-cache.hh"
+#include "thread-pool.hh"
+#include "parse-cache.hh"
 
 #include <algorithm>
+#include <bit>
+#include <chrono>
 #include <iostream>
 #include <sstream>
 #include <cstring>
@@ -31,6 +37,8 @@
 #include <sys/time.h>
 #include <fstream>
 #include <functional>
+#include <unordered_map>
+#include <array>
 
 #include <nlohmann/json.hpp>
 #include <boost/container/small_vector.hpp>
@@ -55,19 +63,6 @@ using json = nlohmann::json;
 
 namespace nix {
 
-static char * allocString(size_t size)
-{
-    char * t;
-#if HAVE_BOEHMGC
-    t = (char *) GC_MALLOC_ATOMIC(size);
-#else
-    t = (char *) malloc(size);
-#endif
-    if (!t) throw std::bad_alloc();
-    return t;
-}
-
-
 static char * dupString(const char * s)
 {
     char * t;
@@ -127,7 +122,7 @@ void Value::print(EvalState & state, std::ostream & str, PrintOptions options)
 const Value * getPrimOp(const Value &v) {
     const Value * primOp = &v;
     while (primOp->isPrimOpApp()) {
-        primOp = primOp->payload.primOpApp.left;
+        primOp = primOp->primOpApp().left;
     }
     assert(primOp->isPrimOp());
     return primOp;
@@ -158,12 +153,12 @@ std::string showType(const Value & v)
     // Allow selecting a subset of enum values
     #pragma GCC diagnostic push
     #pragma GCC diagnostic ignored "-Wswitch-enum"
-    switch (v.internalType) {
-        case tString: return v.payload.string.context ? "a string with context" : "a string";
+    switch (v.getInternalType()) {
+        case tString: return v.context() ? "a string with context" : "a string";
         case tPrimOp:
-            return fmt("the built-in function '%s'", std::string(v.payload.primOp->name));
+            return fmt("the built-in function '%s'", std::string(v.primOp()->name));
         case tPrimOpApp:
-            return fmt("the partially applied built-in function '%s'", std::string(getPrimOp(v)->payload.primOp->name));
+            return fmt("the partially applied built-in function '%s'", std::string(getPrimOp(v)->primOp()->name));
         case tExternal: return v.external()->showType();
         case tThunk: return v.isBlackhole() ? "a black hole" : "a thunk";
         case tApp: return "a function application";
@@ -178,10 +173,10 @@ PosIdx Value::determinePos(const PosIdx pos) const
     // Allow selecting a subset of enum values
     #pragma GCC diagnostic push
     #pragma GCC diagnostic ignored "-Wswitch-enum"
-    switch (internalType) {
+    switch (getInternalType()) {
         case tAttrs: return attrs()->pos;
-        case tLambda: return payload.lambda.fun->pos;
-        case tApp: return payload.app.left->determinePos(pos);
+        case tLambda: return lambda().fun->pos;
+        case tApp: return app().left->determinePos(pos);
         default: return pos;
     }
     #pragma GCC diagnostic pop
@@ -189,14 +184,15 @@ PosIdx Value::determinePos(const PosIdx pos) const
 
 bool Value::isTrivial() const
 {
+    auto internalType = getInternalType();
     return
         internalType != tApp
         && internalType != tPrimOpApp
         && (internalType != tThunk
-            || (dynamic_cast<ExprAttrs *>(payload.thunk.expr)
-                && ((ExprAttrs *) payload.thunk.expr)->dynamicAttrs.empty())
-            || dynamic_cast<ExprLambda *>(payload.thunk.expr)
-            || dynamic_cast<ExprList *>(payload.thunk.expr));
+            || (dynamic_cast<ExprAttrs *>(thunk().expr)
+                && ((ExprAttrs *) thunk().expr)->dynamicAttrs.empty())
+            || dynamic_cast<ExprLambda *>(thunk().expr)
+            || dynamic_cast<ExprList *>(thunk().expr));
 }
 
 
@@ -318,6 +314,9 @@ EvalState::EvalState(
 
     countCalls = getEnv("NIX_COUNT_CALLS").value_or("0") != "0";
 
+    if (auto & profileFile = settings.evalProfileFile.get())
+        profiler = std::make_unique<EvalProfiler>(*this, *profileFile, settings.evalProfilerFrequency);
+
     assertGCInitialized();
 
     static_assert(sizeof(Env) <= 16, "environment must be <= 16 bytes");
@@ -364,6 +363,40 @@ EvalState::EvalState(
 
 EvalState::~EvalState()
 {
+    /* Wait for any background parses, since they refer to this
+       object. Don't reset `prefetchPool`, because they may still
+       access it. */
+    if (prefetchPool)
+        prefetchPool->shutdown();
+}
+
+
+void EnvStack::grow()
+{
+    auto next = top ? chunk + 1 : chunk;
+    if (next == chunks.size()) {
+#if HAVE_BOEHMGC
+        auto p = (char *) GC_MALLOC_UNCOLLECTABLE(chunkSize);
+#else
+        auto p = (char *) malloc(chunkSize);
+#endif
+        if (!p) throw std::bad_alloc();
+        chunks.push_back(p);
+    }
+    chunk = next;
+    top = chunks[chunk];
+    end = top + chunkSize;
+}
+
+
+EnvStack::~EnvStack()
+{
+    for (auto p : chunks)
+#if HAVE_BOEHMGC
+        GC_FREE(p);
+#else
+        free(p);
+#endif
 }
 
 
@@ -480,7 +513,7 @@ void EvalState::addConstant(const std::string & name, Value * v, Constant info)
         /* Install value the base environment. */
         staticBaseEnv->vars.emplace_back(symbols.create(name), baseEnvDispl);
         baseEnv.values[baseEnvDispl++] = v;
-        baseEnv.values[0]->payload.attrs->push_back(Attr(symbols.create(name2), v));
+        const_cast<Bindings *>(baseEnv.values[0]->attrs())->push_back(Attr(symbols.create(name2), v));
     }
 }
 
@@ -502,9 +535,9 @@ std::ostream & operator<<(std::ostream & output, const PrimOp & primOp)
 
 const PrimOp * Value::primOpAppPrimOp() const
 {
-    Value * left = payload.primOpApp.left;
+    Value * left = primOpApp().left;
     while (left && !left->isPrimOp()) {
-        left = left->payload.primOpApp.left;
+        left = left->primOpApp().left;
     }
 
     if (!left)
@@ -516,7 +549,7 @@ const PrimOp * Value::primOpAppPrimOp() const
 void Value::mkPrimOp(PrimOp * p)
 {
     p->check();
-    finishValue(tPrimOp, { .primOp = p });
+    setPrimOp(p);
 }
 
 
@@ -544,7 +577,7 @@ Value * EvalState::addPrimOp(PrimOp && primOp)
     v->mkPrimOp(new PrimOp(primOp));
     staticBaseEnv->vars.emplace_back(envName, baseEnvDispl);
     baseEnv.values[baseEnvDispl++] = v;
-    baseEnv.values[0]->payload.attrs->push_back(Attr(symbols.create(primOp.name), v));
+    const_cast<Bindings *>(baseEnv.values[0]->attrs())->push_back(Attr(symbols.create(primOp.name), v));
     return v;
 }
 
@@ -569,7 +602,7 @@ std::optional<EvalState::Doc> EvalState::getDoc(Value & v)
             };
     }
     if (v.isLambda()) {
-        auto exprLambda = v.payload.lambda.fun;
+        auto exprLambda = v.lambda().fun;
 
         std::stringstream s(std::ios_base::out);
         std::string name;
@@ -849,18 +882,84 @@ void Value::mkString(std::string_view s)
 }
 
 
+namespace {
+
+/**
+ * A bounded table of recently encoded string contexts, so that strings
+ * with the same context usually share a single array. This lets
+ * `ExprConcatStrings` compare contexts by pointer. Sharing is only an
+ * optimisation: equal contexts may still be encoded in different
+ * arrays, e.g. after their shard has been cleared. The arrays are
+ * allocated on the garbage-collected heap, and the table only keeps
+ * them alive until they are evicted. It is sharded so that evaluator
+ * threads rarely contend for it.
+ */
+struct ContextTable
+{
+    static constexpr size_t nrShards = 16;
+    static constexpr size_t maxShardSize = 4096;
+
+    /**
+     * Maps the hash of the elements of a context to its
+     * NULL-terminated encoding.
+     */
+#if HAVE_BOEHMGC
+    typedef std::unordered_multimap<size_t, const char * *, std::hash<size_t>, std::equal_to<size_t>,
+        traceable_allocator<std::pair<const size_t, const char * *>>> Shard;
+#else
+    typedef std::unordered_multimap<size_t, const char * *> Shard;
+#endif
+
+    std::array<Sync<Shard>, nrShards> shards;
+};
+
+}
+
+static ContextTable & contextTable = *new ContextTable;
+
+static bool contextEquals(const char * * ctx, const std::vector<std::string> & elems)
+{
+    for (auto & e : elems) {
+        if (!*ctx || e != *ctx) return false;
+        ++ctx;
+    }
+    return !*ctx;
+}
+
 static const char * * encodeContext(const NixStringContext & context)
 {
-    if (!context.empty()) {
-        size_t n = 0;
-        auto ctx = (const char * *)
-            allocBytes((context.size() + 1) * sizeof(char *));
-        for (auto & i : context)
-            ctx[n++] = dupString(i.to_string().c_str());
-        ctx[n] = 0;
-        return ctx;
-    } else
-        return nullptr;
+    if (context.empty()) return nullptr;
+
+    std::vector<std::string> elems;
+    elems.reserve(context.size());
+    size_t hash = 0;
+    for (auto & i : context) {
+        elems.push_back(i.to_string());
+        hash_combine(hash, elems.back());
+    }
+
+    auto shard(contextTable.shards[hash % ContextTable::nrShards].lock());
+
+    for (auto [i, end] = shard->equal_range(hash); i != end; ++i)
+        if (contextEquals(i->second, elems))
+            return i->second;
+
+    auto ctx = (const char * *) allocBytes((elems.size() + 1) * sizeof(char *));
+    for (size_t n = 0; n < elems.size(); ++n)
+        ctx[n] = dupString(elems[n].c_str());
+    ctx[elems.size()] = nullptr;
+
+    if (shard->size() >= ContextTable::maxShardSize)
+        shard->clear();
+    shard->emplace(hash, ctx);
+
+    return ctx;
+}
+
+static void decodeContext(const char * * ctx, NixStringContext & context)
+{
+    for (const char * * p = ctx; *p; ++p)
+        context.insert(NixStringContextElem::parse(*p));
 }
 
 void Value::mkString(std::string_view s, const NixStringContext & context)
@@ -1067,29 +1166,35 @@ Value * ExprPath::maybeThunk(EvalState & state, Env & env)
 
 void EvalState::evalFile(const SourcePath & path, Value & v, bool mustBeTrivial)
 {
-    FileEvalCache::iterator i;
-    if ((i = fileEvalCache.find(path)) != fileEvalCache.end()) {
+    auto lookupEvalCache = [&](const SourcePath & p) {
+        auto cache(fileEvalCache.readLock());
+        auto i = cache->find(p);
+        if (i == cache->end()) return false;
         v = i->second;
-        return;
-    }
+        return true;
+    };
+
+    if (lookupEvalCache(path)) return;
 
     auto resolvedPath = resolveExprPath(path);
-    if ((i = fileEvalCache.find(resolvedPath)) != fileEvalCache.end()) {
-        v = i->second;
-        return;
-    }
+    if (lookupEvalCache(resolvedPath)) return;
 
     printTalkative("evaluating file '%1%'", resolvedPath);
     Expr * e = nullptr;
 
-    auto j = fileParseCache.find(resolvedPath);
-    if (j != fileParseCache.end())
-        e = j->second;
+    {
+        auto cache(fileParseCache.readLock());
+        if (auto e2 = get(*cache, resolvedPath))
+            e = *e2;
+    }
 
-    if (!e)
+    if (!e) {
         e = parseExprFromFile(resolvedPath);
-
-    fileParseCache.emplace(resolvedPath, e);
+        /* If another caller parsed this file in the meantime, use
+           their parse tree so that all evaluations of this file
+           share the same AST. */
+        e = fileParseCache.lock()->emplace(resolvedPath, e).first->second;
+    }
 
     try {
         auto dts = debugRepl
@@ -1112,15 +1217,18 @@ void EvalState::evalFile(const SourcePath & path, Value & v, bool mustBeTrivial)
         throw;
     }
 
-    fileEvalCache.emplace(resolvedPath, v);
-    if (path != resolvedPath) fileEvalCache.emplace(path, v);
+    {
+        auto cache(fileEvalCache.lock());
+        cache->emplace(resolvedPath, v);
+        if (path != resolvedPath) cache->emplace(path, v);
+    }
 }
 
 
 void EvalState::resetFileCache()
 {
-    fileEvalCache.clear();
-    fileParseCache.clear();
+    fileEvalCache.lock()->clear();
+    fileParseCache.lock()->clear();
 }
 
 
@@ -1172,6 +1280,13 @@ void Expr::eval(EvalState & state, Env & env, Value & v)
 }
 
 
+ExprCall * Expr::evalTail(EvalState & state, Env * & env, Value & v)
+{
+    eval(state, *env, v);
+    return nullptr;
+}
+
+
 void ExprInt::eval(EvalState & state, Env & env, Value & v)
 {
     v = this->v;
@@ -1299,7 +1414,7 @@ void ExprAttrs::eval(EvalState & state, Env & env, Value & v)
 }
 
 
-void ExprLet::eval(EvalState & state, Env & env, Value & v)
+Env & ExprLet::buildEnv(EvalState & state, Env & env)
 {
     /* Create a new environment that contains the attributes in this
        `let'. */
@@ -1318,6 +1433,14 @@ void ExprLet::eval(EvalState & state, Env & env, Value & v)
             *i.second.chooseByKind(&env2, &env, inheritEnv));
     }
 
+    return env2;
+}
+
+
+void ExprLet::eval(EvalState & state, Env & env, Value & v)
+{
+    Env & env2(buildEnv(state, env));
+
     auto dts = state.debugRepl
         ? makeDebugTraceStacker(
             state,
@@ -1335,6 +1458,13 @@ void ExprLet::eval(EvalState & state, Env & env, Value & v)
 }
 
 
+ExprCall * ExprLet::evalTail(EvalState & state, Env * & env, Value & v)
+{
+    env = &buildEnv(state, *env);
+    return body->evalTail(state, env, v);
+}
+
+
 void ExprList::eval(EvalState & state, Env & env, Value & v)
 {
     auto list = state.buildList(elems.size());
@@ -1386,7 +1516,11 @@ void ExprSelect::eval(EvalState & state, Env & env, Value & v)
     PosIdx pos2;
     Value * vAttrs = &vTmp;
 
-    e->eval(state, env, vTmp);
+    if (eVar) {
+        vAttrs = state.lookupVar(&env, *eVar, false);
+        state.forceValue(*vAttrs, eVar->pos);
+    } else
+        e->eval(state, env, vTmp);
 
     try {
         auto dts = state.debugRepl
@@ -1490,7 +1624,7 @@ void ExprLambda::eval(EvalState & state, Env & env, Value & v)
     v.mkLambda(&env, this);
 }
 
-void EvalState::callFunction(Value & fun, size_t nrArgs, Value * * args, Value & vRes, const PosIdx pos)
+void EvalState::callFunction(Value & fun, size_t nrArgs, Value * * args, Value & vRes, PosIdx pos)
 {
     auto _level = addCallDepth(pos);
 
@@ -1512,215 +1646,306 @@ void EvalState::callFunction(Value & fun, size_t nrArgs, Value * * args, Value &
         }
     };
 
+    /* Add the traces for a call to `lambda` from `callPos`. */
+    auto addCallTrace = [&](Error & e, const ExprLambda & lambda, PosIdx callPos)
+    {
+        addErrorTrace(
+            e,
+            lambda.pos,
+            "while calling %s",
+            lambda.name
+            ? concatStrings("'", symbols[lambda.name], "'")
+            : "anonymous lambda");
+        if (callPos) addErrorTrace(e, callPos, "from call site");
+    };
+
     const Attr * functor;
 
-    while (nrArgs > 0) {
+    /* The arguments of a function call in tail position of a lambda
+       body, which replaces the current call (see below). */
+    SmallValueVector<4> tailArgs;
 
-        if (vCur.isLambda()) {
+    /* The number of tail calls made so far, which `max-tail-calls`
+       limits. */
+    unsigned int nrTailCallsHere = 0;
 
-            ExprLambda & lambda(*vCur.payload.lambda.fun);
+    /* The lambdas that made such tail calls, with their call sites, so
+       that error traces look as if the calls had been nested. At most
+       `max-call-depth` of them are kept, as many as nested calls could
+       have produced; the rest are only counted. */
+    std::vector<std::pair<const ExprLambda *, PosIdx>> tailFrames;
+    size_t tailFramesOmitted = 0;
 
-            auto size =
-                (!lambda.arg ? 0 : 1) +
-                (lambda.hasFormals() ? lambda.formals->formals.size() : 0);
-            Env & env2(allocEnv(size));
-            env2.up = vCur.payload.lambda.env;
+    try {
 
-            Displacement displ = 0;
+        while (nrArgs > 0) {
 
-            if (!lambda.hasFormals())
-                env2.values[displ++] = args[0];
-            else {
-                try {
-                    forceAttrs(*args[0], lambda.pos, "while evaluating the value passed for the lambda argument");
-                } catch (Error & e) {
-                    if (pos) e.addTrace(positions[pos], "from call site");
-                    throw;
-                }
+            if (vCur.isLambda()) {
+
+                ExprLambda & lambda(*vCur.lambda().fun);
+
+                auto size =
+                    (!lambda.arg ? 0 : 1) +
+                    (lambda.hasFormals() ? lambda.formals->formals.size() : 0);
+
+                /* If nothing can capture the environment of this call, it
+                   can be allocated on the stack and released on return. */
+                EnvStack::Scope envScope(envStack);
+                bool onStack = !lambda.envCaptured && size <= EnvStack::maxSize && !debugRepl;
+                if (onStack) nrEnvsOnStack++;
+                Env & env2(onStack ? envStack.alloc(size) : allocEnv(size));
+                env2.up = vCur.lambda().env;
 
-                if (lambda.arg)
+                Displacement displ = 0;
+
+                if (!lambda.hasFormals())
                     env2.values[displ++] = args[0];
+                else {
+                    try {
+                        forceAttrs(*args[0], lambda.pos, "while evaluating the value passed for the lambda argument");
+                    } catch (Error & e) {
+                        if (pos) e.addTrace(positions[pos], "from call site");
+                        throw;
+                    }
 
-                /* For each formal argument, get the actual argument.  If
-                   there is no matching actual argument but the formal
-                   argument has a default, use the default. */
-                size_t attrsUsed = 0;
-                for (auto & i : lambda.formals->formals) {
-                    auto j = args[0]->attrs()->get(i.name);
-                    if (!j) {
-                        if (!i.def) {
-                            error<TypeError>("function '%1%' called without required argument '%2%'",
-                                             (lambda.name ? std::string(symbols[lambda.name]) : "anonymous lambda"),
-                                             symbols[i.name])
+                    if (lambda.arg)
+                        env2.values[displ++] = args[0];
+
+                    /* For each formal argument, get the actual argument.  If
+                       there is no matching actual argument but the formal
+                       argument has a default, use the default. */
+                    size_t attrsUsed = 0;
+                    for (auto & i : lambda.formals->formals) {
+                        auto j = args[0]->attrs()->get(i.name);
+                        if (!j) {
+                            if (!i.def) {
+                                error<TypeError>("function '%1%' called without required argument '%2%'",
+                                                 (lambda.name ? std::string(symbols[lambda.name]) : "anonymous lambda"),
+                                                 symbols[i.name])
+                                        .atPos(lambda.pos)
+                                        .withTrace(pos, "from call site")
+                                        .withFrame(*vCur.lambda().env, lambda)
+                                        .debugThrow();
+                            }
+                            env2.values[displ++] = i.def->maybeThunk(*this, env2);
+                        } else {
+                            attrsUsed++;
+                            env2.values[displ++] = j->value;
+                        }
+                    }
+
+                    /* Check that each actual argument is listed as a formal
+                       argument (unless the attribute match specifies a `...'). */
+                    if (!lambda.formals->ellipsis && attrsUsed != args[0]->attrs()->size()) {
+                        /* Nope, so show the first unexpected argument to the
+                           user. */
+                        for (auto & i : *args[0]->attrs())
+                            if (!lambda.formals->has(i.name)) {
+                                std::set<std::string> formalNames;
+                                for (auto & formal : lambda.formals->formals)
+                                    formalNames.insert(std::string(symbols[formal.name]));
+                                auto suggestions = Suggestions::bestMatches(formalNames, symbols[i.name]);
+                                error<TypeError>("function '%1%' called with unexpected argument '%2%'",
+                                                 (lambda.name ? std::string(symbols[lambda.name]) : "anonymous lambda"),
+                                                 symbols[i.name])
                                     .atPos(lambda.pos)
                                     .withTrace(pos, "from call site")
-                                    .withFrame(*fun.payload.lambda.env, lambda)
+                                    .withSuggestions(suggestions)
+                                    .withFrame(*vCur.lambda().env, lambda)
                                     .debugThrow();
-                        }
-                        env2.values[displ++] = i.def->maybeThunk(*this, env2);
-                    } else {
-                        attrsUsed++;
-                        env2.values[displ++] = j->value;
+                            }
+                        unreachable();
                     }
                 }
 
-                /* Check that each actual argument is listed as a formal
-                   argument (unless the attribute match specifies a `...'). */
-                if (!lambda.formals->ellipsis && attrsUsed != args[0]->attrs()->size()) {
-                    /* Nope, so show the first unexpected argument to the
-                       user. */
-                    for (auto & i : *args[0]->attrs())
-                        if (!lambda.formals->has(i.name)) {
-                            std::set<std::string> formalNames;
-                            for (auto & formal : lambda.formals->formals)
-                                formalNames.insert(std::string(symbols[formal.name]));
-                            auto suggestions = Suggestions::bestMatches(formalNames, symbols[i.name]);
-                            error<TypeError>("function '%1%' called with unexpected argument '%2%'",
-                                             (lambda.name ? std::string(symbols[lambda.name]) : "anonymous lambda"),
-                                             symbols[i.name])
-                                .atPos(lambda.pos)
-                                .withTrace(pos, "from call site")
-                                .withSuggestions(suggestions)
-                                .withFrame(*fun.payload.lambda.env, lambda)
-                                .debugThrow();
+                nrFunctionCalls++;
+                if (countCalls) incrFunctionCall(&lambda);
+
+                /* When applying the last argument, a function call in
+                   tail position of the body is not made from here but
+                   by the next iteration of this loop, so that tail
+                   recursion doesn't use up the C++ stack. Not when the
+                   debugger or `trace-function-calls` needs the stack
+                   of calls, though. */
+                bool tailCalls = nrArgs == 1 && !debugRepl && !trace;
+                ExprCall * tailCall = nullptr;
+
+                /* Evaluate the body. */
+                try {
+                    auto dts = debugRepl
+                        ? makeDebugTraceStacker(
+                            *this, *lambda.body, env2, positions[lambda.pos],
+                            "while calling %s",
+                            lambda.name
+                            ? concatStrings("'", symbols[lambda.name], "'")
+                            : "anonymous lambda")
+                        : nullptr;
+
+                    EvalProfiler::Call _profile(profiler.get(), {.lambda = &lambda});
+
+                    if (tailCalls) {
+                        Env * env3 = &env2;
+                        tailCall = lambda.body->evalTail(*this, env3, vCur);
+                        if (tailCall) {
+                            /* As in ExprCall::eval(). If `env2` is on
+                               the stack, it is released when the loop
+                               continues, so neither the function nor
+                               the arguments of the call may hold on to
+                               it. `ExprLambda::envCaptured` is set
+                               whenever a thunk over `env2` could have
+                               been created, by the body or by defaults
+                               of the formals, so it is heap-allocated
+                               then. */
+                            tailCall->fun->eval(*this, *env3, vCur);
+                            forceValue(vCur, tailCall->pos);
+                            tailArgs.resize(tailCall->args.size());
+                            for (const auto & [n, arg] : enumerate(tailCall->args))
+                                tailArgs[n] = arg->maybeThunk(*this, *env3);
                         }
-                    unreachable();
+                    } else
+                        lambda.body->eval(*this, env2, vCur);
+                } catch (Error & e) {
+                    if (loggerSettings.showTrace.get())
+                        addCallTrace(e, lambda, pos);
+                    throw;
                 }
-            }
-
-            nrFunctionCalls++;
-            if (countCalls) incrFunctionCall(&lambda);
 
-            /* Evaluate the body. */
-            try {
-                auto dts = debugRepl
-                    ? makeDebugTraceStacker(
-                        *this, *lambda.body, env2, positions[lambda.pos],
-                        "while calling %s",
-                        lambda.name
-                        ? concatStrings("'", symbols[lambda.name], "'")
-                        : "anonymous lambda")
-                    : nullptr;
-
-                lambda.body->eval(*this, env2, vCur);
-            } catch (Error & e) {
-                if (loggerSettings.showTrace.get()) {
-                    addErrorTrace(
-                        e,
-                        lambda.pos,
-                        "while calling %s",
-                        lambda.name
-                        ? concatStrings("'", symbols[lambda.name], "'")
-                        : "anonymous lambda");
-                    if (pos) addErrorTrace(e, pos, "from call site");
+                if (tailCall) {
+                    if (loggerSettings.showTrace.get()) {
+                        if (tailFrames.size() < settings.maxCallDepth)
+                            tailFrames.emplace_back(&lambda, pos);
+                        else
+                            tailFramesOmitted++;
+                    }
+                    nrTailCalls++;
+                    pos = tailCall->pos;
+                    /* Tail calls don't use up the stack, so they don't
+                       count towards `max-call-depth`. Infinite tail
+                       recursion would loop forever, though, so it has
+                       a limit of its own. */
+                    if (++nrTailCallsHere > settings.maxTailCalls)
+                        error<EvalError>("too many tail calls; max-tail-calls exceeded").atPos(pos).debugThrow();
+                    args = tailArgs.data();
+                    nrArgs = tailArgs.size();
+                    continue;
                 }
-                throw;
-            }
 
-            nrArgs--;
-            args += 1;
-        }
+                nrArgs--;
+                args += 1;
+            }
 
-        else if (vCur.isPrimOp()) {
+            else if (vCur.isPrimOp()) {
 
-            size_t argsLeft = vCur.primOp()->arity;
+                size_t argsLeft = vCur.primOp()->arity;
 
-            if (nrArgs < argsLeft) {
-                /* We don't have enough arguments, so create a tPrimOpApp chain. */
-                makeAppChain();
-                return;
-            } else {
-                /* We have all the arguments, so call the primop. */
-                auto * fn = vCur.primOp();
+                if (nrArgs < argsLeft) {
+                    /* We don't have enough arguments, so create a tPrimOpApp chain. */
+                    makeAppChain();
+                    return;
+                } else {
+                    /* We have all the arguments, so call the primop. */
+                    auto * fn = vCur.primOp();
 
-                nrPrimOpCalls++;
-                if (countCalls) primOpCalls[fn->name]++;
+                    nrPrimOpCalls++;
+                    if (countCalls) primOpCalls[fn->name]++;
 
-                try {
-                    fn->fun(*this, vCur.determinePos(noPos), args, vCur);
-                } catch (Error & e) {
-                    if (fn->addTrace)
-                        addErrorTrace(e, pos, "while calling the '%1%' builtin", fn->name);
-                    throw;
-                }
+                    EvalProfiler::Call _profile(profiler.get(), {.primOp = fn});
 
-                nrArgs -= argsLeft;
-                args += argsLeft;
-            }
-        }
+                    try {
+                        fn->fun(*this, vCur.determinePos(noPos), args, vCur);
+                    } catch (Error & e) {
+                        if (fn->addTrace)
+                            addErrorTrace(e, pos, "while calling the '%1%' builtin", fn->name);
+                        throw;
+                    }
 
-        else if (vCur.isPrimOpApp()) {
-            /* Figure out the number of arguments still needed. */
-            size_t argsDone = 0;
-            Value * primOp = &vCur;
-            while (primOp->isPrimOpApp()) {
-                argsDone++;
-                primOp = primOp->payload.primOpApp.left;
+                    nrArgs -= argsLeft;
+                    args += argsLeft;
+                }
             }
-            assert(primOp->isPrimOp());
-            auto arity = primOp->primOp()->arity;
-            auto argsLeft = arity - argsDone;
-
-            if (nrArgs < argsLeft) {
-                /* We still don't have enough arguments, so extend the tPrimOpApp chain. */
-                makeAppChain();
-                return;
-            } else {
-                /* We have all the arguments, so call the primop with
-                   the previous and new arguments. */
 
-                Value * vArgs[maxPrimOpArity];
-                auto n = argsDone;
-                for (Value * arg = &vCur; arg->isPrimOpApp(); arg = arg->payload.primOpApp.left)
-                    vArgs[--n] = arg->payload.primOpApp.right;
+            else if (vCur.isPrimOpApp()) {
+                /* Figure out the number of arguments still needed. */
+                size_t argsDone = 0;
+                Value * primOp = &vCur;
+                while (primOp->isPrimOpApp()) {
+                    argsDone++;
+                    primOp = primOp->primOpApp().left;
+                }
+                assert(primOp->isPrimOp());
+                auto arity = primOp->primOp()->arity;
+                auto argsLeft = arity - argsDone;
 
-                for (size_t i = 0; i < argsLeft; ++i)
-                    vArgs[argsDone + i] = args[i];
+                if (nrArgs < argsLeft) {
+                    /* We still don't have enough arguments, so extend the tPrimOpApp chain. */
+                    makeAppChain();
+                    return;
+                } else {
+                    /* We have all the arguments, so call the primop with
+                       the previous and new arguments. */
+
+                    Value * vArgs[maxPrimOpArity];
+                    auto n = argsDone;
+                    for (Value * arg = &vCur; arg->isPrimOpApp(); arg = arg->primOpApp().left)
+                        vArgs[--n] = arg->primOpApp().right;
+
+                    for (size_t i = 0; i < argsLeft; ++i)
+                        vArgs[argsDone + i] = args[i];
+
+                    auto fn = primOp->primOp();
+                    nrPrimOpCalls++;
+                    if (countCalls) primOpCalls[fn->name]++;
+
+                    EvalProfiler::Call _profile(profiler.get(), {.primOp = fn});
+
+                    try {
+                        // TODO:
+                        // 1. Unify this and above code. Heavily redundant.
+                        // 2. Create a fake env (arg1, arg2, etc.) and a fake expr (arg1: arg2: etc: builtins.name arg1 arg2 etc)
+                        //    so the debugger allows to inspect the wrong parameters passed to the builtin.
+                        fn->fun(*this, vCur.determinePos(noPos), vArgs, vCur);
+                    } catch (Error & e) {
+                        if (fn->addTrace)
+                            addErrorTrace(e, pos, "while calling the '%1%' builtin", fn->name);
+                        throw;
+                    }
 
-                auto fn = primOp->primOp();
-                nrPrimOpCalls++;
-                if (countCalls) primOpCalls[fn->name]++;
+                    nrArgs -= argsLeft;
+                    args += argsLeft;
+                }
+            }
 
+            else if (vCur.type() == nAttrs && (functor = vCur.attrs()->get(sFunctor))) {
+                /* 'vCur' may be allocated on the stack of the calling
+                   function, but for functors we may keep a reference, so
+                   heap-allocate a copy and use that instead. */
+                Value * args2[] = {allocValue(), args[0]};
+                *args2[0] = vCur;
                 try {
-                    // TODO:
-                    // 1. Unify this and above code. Heavily redundant.
-                    // 2. Create a fake env (arg1, arg2, etc.) and a fake expr (arg1: arg2: etc: builtins.name arg1 arg2 etc)
-                    //    so the debugger allows to inspect the wrong parameters passed to the builtin.
-                    fn->fun(*this, vCur.determinePos(noPos), vArgs, vCur);
+                    callFunction(*functor->value, 2, args2, vCur, functor->pos);
                 } catch (Error & e) {
-                    if (fn->addTrace)
-                        addErrorTrace(e, pos, "while calling the '%1%' builtin", fn->name);
+                    e.addTrace(positions[pos], "while calling a functor (an attribute set with a '__functor' attribute)");
                     throw;
                 }
-
-                nrArgs -= argsLeft;
-                args += argsLeft;
+                nrArgs--;
+                args++;
             }
-        }
 
-        else if (vCur.type() == nAttrs && (functor = vCur.attrs()->get(sFunctor))) {
-            /* 'vCur' may be allocated on the stack of the calling
-               function, but for functors we may keep a reference, so
-               heap-allocate a copy and use that instead. */
-            Value * args2[] = {allocValue(), args[0]};
-            *args2[0] = vCur;
-            try {
-                callFunction(*functor->value, 2, args2, vCur, functor->pos);
-            } catch (Error & e) {
-                e.addTrace(positions[pos], "while calling a functor (an attribute set with a '__functor' attribute)");
-                throw;
-            }
-            nrArgs--;
-            args++;
+            else
+                error<TypeError>(
+                        "attempt to call something which is not a function but %1%: %2%",
+                        showType(vCur),
+                        ValuePrinter(*this, vCur, errorPrintOptions))
+                    .atPos(pos)
+                    .debugThrow();
         }
 
-        else
-            error<TypeError>(
-                    "attempt to call something which is not a function but %1%: %2%",
-                    showType(vCur),
-                    ValuePrinter(*this, vCur, errorPrintOptions))
-                .atPos(pos)
-                .debugThrow();
+    } catch (Error & e) {
+        if (tailFramesOmitted)
+            e.addTrace(nullptr, HintFmt(fmt("(%d more tail calls omitted)", tailFramesOmitted)));
+        for (auto i = tailFrames.rbegin(); i != tailFrames.rend(); ++i)
+            addCallTrace(e, *i->first, i->second);
+        throw;
     }
 
     vRes = vCur;
@@ -1758,6 +1983,12 @@ void ExprCall::eval(EvalState & state, Env & env, Value & v)
 }
 
 
+ExprCall * ExprCall::evalTail(EvalState & state, Env * & env, Value & v)
+{
+    return this;
+}
+
+
 // Lifted out of callFunction() because it creates a temporary that
 // prevents tail-call optimisation.
 void EvalState::incrFunctionCall(ExprLambda * fun)
@@ -1782,14 +2013,14 @@ void EvalState::autoCallFunction(Bindings & args, Value & fun, Value & res)
         }
     }
 
-    if (!fun.isLambda() || !fun.payload.lambda.fun->hasFormals()) {
+    if (!fun.isLambda() || !fun.lambda().fun->hasFormals()) {
         res = fun;
         return;
     }
 
-    auto attrs = buildBindings(std::max(static_cast<uint32_t>(fun.payload.lambda.fun->formals->formals.size()), args.size()));
+    auto attrs = buildBindings(std::max(static_cast<uint32_t>(fun.lambda().fun->formals->formals.size()), args.size()));
 
-    if (fun.payload.lambda.fun->formals->ellipsis) {
+    if (fun.lambda().fun->formals->ellipsis) {
         // If the formals have an ellipsis (eg the function accepts extra args) pass
         // all available automatic arguments (which includes arguments specified on
         // the command line via --arg/--argstr)
@@ -1797,7 +2028,7 @@ void EvalState::autoCallFunction(Bindings & args, Value & fun, Value & res)
             attrs.insert(v);
     } else {
         // Otherwise, only pass the arguments that the function accepts
-        for (auto & i : fun.payload.lambda.fun->formals->formals) {
+        for (auto & i : fun.lambda().fun->formals->formals) {
             auto j = args.get(i.name);
             if (j) {
                 attrs.insert(*j);
@@ -1807,7 +2038,7 @@ Nix attempted to evaluate a function as a top level expression; in
 this case it must have its arguments supplied either by default
 values, or passed explicitly with '--arg' or '--argstr'. See
 https://nixos.org/manual/nix/stable/language/constructs.html#functions.)", symbols[i.name])
-                    .atPos(i.pos).withFrame(*fun.payload.lambda.env, *fun.payload.lambda.fun).debugThrow();
+                    .atPos(i.pos).withFrame(*fun.lambda().env, *fun.lambda().fun).debugThrow();
             }
         }
     }
@@ -1826,6 +2057,17 @@ void ExprWith::eval(EvalState & state, Env & env, Value & v)
 }
 
 
+ExprCall * ExprWith::evalTail(EvalState & state, Env * & env, Value & v)
+{
+    Env & env2(state.allocEnv(1));
+    env2.up = env;
+    env2.values[0] = attrs->maybeThunk(state, *env);
+    env = &env2;
+
+    return body->evalTail(state, env, v);
+}
+
+
 void ExprIf::eval(EvalState & state, Env & env, Value & v)
 {
     // We cheat in the parser, and pass the position of the condition as the position of the if itself.
@@ -1833,7 +2075,13 @@ void ExprIf::eval(EvalState & state, Env & env, Value & v)
 }
 
 
-void ExprAssert::eval(EvalState & state, Env & env, Value & v)
+ExprCall * ExprIf::evalTail(EvalState & state, Env * & env, Value & v)
+{
+    return (state.evalBool(*env, cond, pos, "while evaluating a branch condition") ? then : else_)->evalTail(state, env, v);
+}
+
+
+void ExprAssert::check(EvalState & state, Env & env)
 {
     if (!state.evalBool(env, cond, pos, "in the condition of the assert statement")) {
         auto exprStr = ({
@@ -1855,10 +2103,23 @@ void ExprAssert::eval(EvalState & state, Env & env, Value & v)
 
         state.error<AssertionError>("assertion '%1%' failed", exprStr).atPos(pos).withFrame(env, *this).debugThrow();
     }
+}
+
+
+void ExprAssert::eval(EvalState & state, Env & env, Value & v)
+{
+    check(state, env);
     body->eval(state, env, v);
 }
 
 
+ExprCall * ExprAssert::evalTail(EvalState & state, Env * & env, Value & v)
+{
+    check(state, *env);
+    return body->evalTail(state, env, v);
+}
+
+
 void ExprOpNot::eval(EvalState & state, Env & env, Value & v)
 {
     v.mkBool(!state.evalBool(env, e, getPos(), "in the argument of the not operator")); // XXX: FIXME: !
@@ -1899,10 +2160,59 @@ void ExprOpImpl::eval(EvalState & state, Env & env, Value & v)
 }
 
 
+/* Merge the sorted attributes `[j, jEnd)` and the attributes of
+   `left` into `attrs`, preferring the former. Returns the number of
+   attributes of `left` that were copied in bulk. */
+static size_t mergeAttrs(BindingsBuilder & attrs, const Bindings & left, const Attr * j, const Attr * jEnd)
+{
+    auto i = left.begin();
+
+    /* If the right operand is small compared to the left one (as in
+       `pkgs // { foo = ...; }`), find the position of each of its
+       attributes with a binary search and copy the runs of `left`
+       in between as a whole, rather than comparing every attribute
+       of `left`. */
+    if ((size_t) (jEnd - j) * std::bit_width(left.size()) < left.size()) {
+        size_t copied = 0;
+        for (; j != jEnd; ++j) {
+            auto k = std::lower_bound(i, left.end(), *j);
+            attrs.insert(i, k);
+            copied += k - i;
+            attrs.insert(*j);
+            i = k != left.end() && k->name == j->name ? k + 1 : k;
+        }
+        attrs.insert(i, left.end());
+        return copied + (left.end() - i);
+    }
+
+    while (i != left.end() && j != jEnd) {
+        if (i->name == j->name) {
+            attrs.insert(*j);
+            ++i; ++j;
+        }
+        else if (i->name < j->name)
+            attrs.insert(*i++);
+        else
+            attrs.insert(*j++);
+    }
+
+    while (i != left.end()) attrs.insert(*i++);
+    while (j != jEnd) attrs.insert(*j++);
+
+    return 0;
+}
+
+
 void ExprOpUpdate::eval(EvalState & state, Env & env, Value & v)
 {
     Value v1, v2;
     state.evalAttrs(env, e1, v1, pos, "in the left operand of the update (//) operator");
+
+    if (e2Attrs && v1.attrs()->size() != 0) {
+        updateWithAttrs(state, env, v1, v);
+        return;
+    }
+
     state.evalAttrs(env, e2, v2, pos, "in the right operand of the update (//) operator");
 
     state.nrOpUpdates++;
@@ -1912,24 +2222,38 @@ void ExprOpUpdate::eval(EvalState & state, Env & env, Value & v)
 
     auto attrs = state.buildBindings(v1.attrs()->size() + v2.attrs()->size());
 
-    /* Merge the sets, preferring values from the second set.  Make
-       sure to keep the resulting vector in sorted order. */
-    auto i = v1.attrs()->begin();
-    auto j = v2.attrs()->begin();
+    state.nrOpUpdateValuesBulkCopied += mergeAttrs(attrs, *v1.attrs(), v2.attrs()->begin(), v2.attrs()->end());
 
-    while (i != v1.attrs()->end() && j != v2.attrs()->end()) {
-        if (i->name == j->name) {
-            attrs.insert(*j);
-            ++i; ++j;
-        }
-        else if (i->name < j->name)
-            attrs.insert(*i++);
-        else
-            attrs.insert(*j++);
-    }
+    v.mkAttrs(attrs.alreadySorted());
+
+    state.nrOpUpdateValuesCopied += v.attrs()->size();
+}
+
+
+/* Specialisation of `e1 // { ... }` that merges the attributes of
+   the literal `e2Attrs` into `v1` directly, creating their thunks the
+   same way `ExprAttrs::eval()` would. */
+void ExprOpUpdate::updateWithAttrs(EvalState & state, Env & env, Value & v1, Value & v)
+{
+    state.nrOpUpdates++;
+
+    if (e2Attrs->attrs.empty()) { v = v1; return; }
 
-    while (i != v1.attrs()->end()) attrs.insert(*i++);
-    while (j != v2.attrs()->end()) attrs.insert(*j++);
+    Env * inheritEnv = e2Attrs->inheritFromExprs ? e2Attrs->buildInheritFromEnv(state, env) : nullptr;
+
+    /* The definitions in `e2Attrs` are sorted by symbol, just like
+       the attributes of a `Bindings`. */
+    SmallVector<Attr, 16> attrs2;
+    attrs2.reserve(e2Attrs->attrs.size());
+    for (auto & [name, def] : e2Attrs->attrs)
+        attrs2.emplace_back(
+            name,
+            def.e->maybeThunk(state, *def.chooseByKind(&env, &env, inheritEnv)),
+            def.pos);
+
+    auto attrs = state.buildBindings(v1.attrs()->size() + attrs2.size());
+
+    state.nrOpUpdateValuesBulkCopied += mergeAttrs(attrs, *v1.attrs(), attrs2.data(), attrs2.data() + attrs2.size());
 
     v.mkAttrs(attrs.alreadySorted());
 
@@ -2007,6 +2331,12 @@ void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
         return result;
     };
 
+    /* Equal contexts usually share an array (see `ContextTable`), so
+       as long as all string parts have no context or the same array,
+       it can be passed through to the result without decoding it. */
+    const char * * sharedContext = nullptr;
+    bool contextDecoded = false;
+
     // List of returned strings. References to these Values must NOT be persisted.
     SmallTemporaryValueVector<conservativeStackReservation> values(es->size());
     Value * vTmpP = values.data();
@@ -2047,6 +2377,21 @@ void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
                 state.error<EvalError>("cannot add %1% to a float", showType(vTmp)).atPos(i_pos).withFrame(env, *this).debugThrow();
         } else {
             if (s.empty()) s.reserve(es->size());
+            if (firstType == nString && vTmp.type() == nString && !contextDecoded) {
+                if (auto ctx = vTmp.context()) {
+                    if (!sharedContext)
+                        sharedContext = ctx;
+                    else if (ctx != sharedContext) {
+                        decodeContext(sharedContext, context);
+                        decodeContext(ctx, context);
+                        contextDecoded = true;
+                    }
+                }
+                sSize += vTmp.string_view().size();
+                s.emplace_back(vTmp.string_view());
+                first = false;
+                continue;
+            }
             /* skip canonization of first path, which would only be not
             canonized in the first place if it's coming from a ./${foo} type
             path */
@@ -2068,8 +2413,13 @@ void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
         if (!context.empty())
             state.error<EvalError>("a string that refers to a store path cannot be appended to a path").atPos(pos).withFrame(env, *this).debugThrow();
         v.mkPath(state.rootPath(CanonPath(canonPath(str()))));
-    } else
+    } else if (sharedContext && !contextDecoded && context.empty())
+        v.mkString(c_str(), sharedContext);
+    else {
+        if (sharedContext && !contextDecoded)
+            decodeContext(sharedContext, context);
         v.mkStringMove(c_str(), context);
+    }
 }
 
 
@@ -2119,7 +2469,7 @@ void EvalState::forceValueDeep(Value & v)
                 try {
                     // If the value is a thunk, we're evaling. Otherwise no trace necessary.
                     auto dts = debugRepl && i.value->isThunk()
-                        ? makeDebugTraceStacker(*this, *i.value->payload.thunk.expr, *i.value->payload.thunk.env, positions[i.pos],
+                        ? makeDebugTraceStacker(*this, *i.value->thunk().expr, *i.value->thunk().env, positions[i.pos],
                             "while evaluating the attribute '%1%'", symbols[i.name])
                         : nullptr;
 
@@ -2243,9 +2593,8 @@ std::string_view EvalState::forceString(Value & v, const PosIdx pos, std::string
 
 void copyContext(const Value & v, NixStringContext & context)
 {
-    if (v.payload.string.context)
-        for (const char * * p = v.payload.string.context; *p; ++p)
-            context.insert(NixStringContextElem::parse(*p));
+    if (v.context())
+        decodeContext(v.context(), context);
 }
 
 
@@ -2314,7 +2663,7 @@ BackedStringView EvalState::coerceToString(
             !canonicalizePath && !copyToStore
             ? // FIXME: hack to preserve path literals that end in a
               // slash, as in /foo/${x}.
-              v.payload.path.path
+              v.pathStr()
             : copyToStore
             ? store->printStorePath(copyPathToStore(context, v.path()))
             : std::string(v.path().path.abs());
@@ -2357,16 +2706,26 @@ BackedStringView EvalState::coerceToString(
         if (v.type() == nNull) return "";
 
         if (v.isList()) {
-            std::string result;
-            for (auto [n, v2] : enumerate(v.listItems())) {
+            /* Coerce all elements first, so that the result can be
+               allocated at its final size. */
+            std::vector<BackedStringView> parts;
+            parts.reserve(v.listSize());
+            size_t size = 0;
+            for (auto v2 : v.listItems()) {
                 try {
-                    result += *coerceToString(pos, *v2, context,
+                    auto & part = parts.emplace_back(coerceToString(pos, *v2, context,
                             "while evaluating one element of the list",
-                            coerceMore, copyToStore, canonicalizePath);
+                            coerceMore, copyToStore, canonicalizePath));
+                    size += part->size() + 1;
                 } catch (Error & e) {
                     e.addTrace(positions[pos], errorCtx);
                     throw;
                 }
+            }
+            std::string result;
+            result.reserve(size);
+            for (auto [n, v2] : enumerate(v.listItems())) {
+                result += *parts[n];
                 if (n < v.listSize() - 1
                     /* !!! not quite correct */
                     && (!v2->isList() || v2->listSize() != 0))
@@ -2581,14 +2940,14 @@ void EvalState::assertEqValues(Value & v1, Value & v2, const PosIdx pos, std::st
         return;
 
     case nPath:
-        if (v1.payload.path.accessor != v2.payload.path.accessor) {
+        if (v1.pathAccessor() != v2.pathAccessor()) {
             error<AssertionError>(
                 "path '%s' is not equal to path '%s' because their accessors are different",
                 ValuePrinter(*this, v1, errorPrintOptions),
                 ValuePrinter(*this, v2, errorPrintOptions))
                 .debugThrow();
         }
-        if (strcmp(v1.payload.path.path, v2.payload.path.path) != 0) {
+        if (strcmp(v1.pathStr(), v2.pathStr()) != 0) {
             error<AssertionError>(
                 "path '%s' is not equal to path '%s'",
                 ValuePrinter(*this, v1, errorPrintOptions),
@@ -2755,8 +3114,8 @@ bool EvalState::eqValues(Value & v1, Value & v2, const PosIdx pos, std::string_v
         case nPath:
             return
                 // FIXME: compare accessors by their fingerprint.
-                v1.payload.path.accessor == v2.payload.path.accessor
-                && strcmp(v1.payload.path.path, v2.payload.path.path) == 0;
+                v1.pathAccessor() == v2.pathAccessor()
+                && strcmp(v1.pathStr(), v2.pathStr()) == 0;
 
         case nNull:
             return true;
@@ -2879,8 +3238,15 @@ void EvalState::printStatistics()
         {"number", nrEnvs},
         {"elements", nrValuesInEnvs},
         {"bytes", bEnvs},
+        {"onStack", nrEnvsOnStack},
+    };
+    topObj["nrExprs"] = Expr::nrExprs.load();
+    topObj["parser"] = {
+        {"number", nrParses.load()},
+        {"cacheHits", nrParseCacheHits.load()},
+        {"bytes", nrBytesParsed.load()},
+        {"time", std::chrono::duration<double>(std::chrono::steady_clock::duration(parseTime.load())).count()},
     };
-    topObj["nrExprs"] = Expr::nrExprs;
     topObj["list"] = {
         {"elements", nrListElems},
         {"bytes", bLists},
@@ -2907,11 +3273,20 @@ void EvalState::printStatistics()
     };
     topObj["nrOpUpdates"] = nrOpUpdates;
     topObj["nrOpUpdateValuesCopied"] = nrOpUpdateValuesCopied;
+    topObj["nrOpUpdateValuesBulkCopied"] = nrOpUpdateValuesBulkCopied;
     topObj["nrThunks"] = nrThunks;
     topObj["nrAvoided"] = nrAvoided;
     topObj["nrLookups"] = nrLookups;
     topObj["nrPrimOpCalls"] = nrPrimOpCalls;
     topObj["nrFunctionCalls"] = nrFunctionCalls;
+    topObj["nrTailCalls"] = nrTailCalls;
+    topObj["nrGenericClosureKeyComparisons"] = nrGenericClosureKeyComparisons;
+    topObj["evalCache"] = {
+        {"hits", eval_cache::stats.hits.load()},
+        {"misses", eval_cache::stats.misses.load()},
+        {"inserts", eval_cache::stats.inserts.load()},
+        {"insertTime", eval_cache::stats.insertTime.load() / 1000000.0},
+    };
 #if HAVE_BOEHMGC
     topObj["gc"] = {
         {"heapSize", heapSize},
@@ -2925,13 +3300,18 @@ void EvalState::printStatistics()
         {
             auto& list = topObj["functions"];
             list = json::array();
-            for (auto & [fun, count] : functionCalls) {
+            std::vector<PosIdx> funPositions;
+            for (auto & [fun, count] : functionCalls)
+                funPositions.push_back(fun->pos);
+            auto resolved = positions.resolve(funPositions);
+            for (auto && [n, i] : enumerate(functionCalls)) {
+                auto & [fun, count] = i;
                 json obj = json::object();
                 if (fun->name)
                     obj["name"] = (std::string_view) symbols[fun->name];
                 else
                     obj["name"] = nullptr;
-                if (auto pos = positions[fun->pos]) {
+                if (auto & pos = resolved[n]) {
                     if (auto path = std::get_if<SourcePath>(&pos.origin))
                         obj["file"] = path->to_string();
                     obj["line"] = pos.line;
@@ -2944,9 +3324,13 @@ void EvalState::printStatistics()
         {
             auto list = topObj["attributes"];
             list = json::array();
-            for (auto & i : attrSelects) {
+            std::vector<PosIdx> selectPositions;
+            for (auto & i : attrSelects)
+                selectPositions.push_back(i.first);
+            auto resolved = positions.resolve(selectPositions);
+            for (auto && [n, i] : enumerate(attrSelects)) {
                 json obj = json::object();
-                if (auto pos = positions[i.first]) {
+                if (auto & pos = resolved[n]) {
                     if (auto path = std::get_if<SourcePath>(&pos.origin))
                         obj["file"] = path->to_string();
                     obj["line"] = pos.line;
@@ -3078,12 +3462,15 @@ SourcePath EvalState::findFile(const LookupPath & lookupPath, const std::string_
 std::optional<std::string> EvalState::resolveLookupPathPath(const LookupPath::Path & value0, bool initAccessControl)
 {
     auto & value = value0.s;
-    auto i = lookupPathResolved.find(value);
-    if (i != lookupPathResolved.end()) return i->second;
+    {
+        auto resolved(lookupPathResolved.lock());
+        if (auto i = get(*resolved, value))
+            return *i;
+    }
 
     auto finish = [&](std::string res) {
         debug("resolved search path element '%s' to '%s'", value, res);
-        lookupPathResolved.emplace(value, res);
+        lookupPathResolved.lock()->emplace(value, res);
         return res;
     };
 
@@ -3150,21 +3537,96 @@ Expr * EvalState::parse(
     const SourcePath & basePath,
     std::shared_ptr<StaticEnv> & staticEnv)
 {
-    DocCommentMap tmpDocComments; // Only used when not origin is not a SourcePath
-    DocCommentMap *docComments = &tmpDocComments;
+    /* The same file may be parsed by a background thread at the same
+       time, so collect the doc comments separately and merge them in
+       afterwards. */
+    DocCommentMap docComments;
+
+    auto sourcePath = std::get_if<SourcePath>(&origin);
+
+    std::vector<SourcePath> literalPaths;
+    bool prefetch = sourcePath && settings.prefetchImports && !debugRepl;
+
+    auto start = std::chrono::steady_clock::now();
 
-    if (auto sourcePath = std::get_if<SourcePath>(&origin)) {
-        auto [it, _] = positionToDocComment.try_emplace(*sourcePath);
-        docComments = &it->second;
+    /* Files that haven't changed since they were last parsed are
+       loaded from the parse cache, if enabled. This has to happen
+       before parsing, which modifies `text`. */
+    std::optional<Hash> cacheKey;
+    if (sourcePath && settings.parseCache)
+        cacheKey = parse_cache::key(*sourcePath, {text, length}, settings);
+
+    auto posOrigin = positions.addOrigin(origin, length);
+
+    Expr * result = nullptr;
+
+    if (cacheKey) {
+        result = parse_cache::lookup(
+            *cacheKey, posOrigin, symbols, positions, rootFS, docComments,
+            prefetch ? &literalPaths : nullptr);
+        if (result) nrParseCacheHits++;
     }
 
-    auto result = parseExprFromBuf(text, length, origin, basePath, symbols, settings, positions, *docComments, rootFS, exprSymbols);
+    if (!result) {
+        result = parseExprFromBuf(
+            text, length, posOrigin, basePath, symbols, settings, positions, docComments, rootFS, exprSymbols,
+            prefetch ? &literalPaths : nullptr);
+
+        nrParses++;
+        nrBytesParsed += length;
+
+        if (cacheKey)
+            parse_cache::add(*cacheKey, result, posOrigin, symbols, docComments);
+    }
 
     result->bindVars(*this, staticEnv);
 
+    parseTime += (std::chrono::steady_clock::now() - start).count();
+
+    if (sourcePath) {
+        auto positionToDocComment_(positionToDocComment.lock());
+        auto [it, inserted] = positionToDocComment_->try_emplace(*sourcePath, std::move(docComments));
+        if (!inserted)
+            it->second.merge(docComments);
+    }
+
+    for (auto & path : literalPaths)
+        prefetchParse(path);
+
     return result;
 }
 
+
+void EvalState::prefetchParse(const SourcePath & path)
+{
+    if (!prefetchedPaths.lock()->insert(path).second)
+        return;
+
+    if (!prefetchPool)
+        prefetchPool = std::make_unique<ThreadPool>(0, true);
+
+    prefetchPool->enqueue([this, path]() {
+        GCThreadRegistration gcThread;
+
+        try {
+            auto resolvedPath = resolveExprPath(path);
+
+            if (!hasSuffix(resolvedPath.path.abs(), ".nix"))
+                return;
+
+            if (fileParseCache.readLock()->count(resolvedPath))
+                return;
+
+            auto e = parseExprFromFile(resolvedPath);
+
+            fileParseCache.lock()->emplace(resolvedPath, e);
+        } catch (...) {
+            /* Ignore all errors. If the file is actually imported,
+               evalFile() will parse it again and report them. */
+        }
+    });
+}
+
 DocComment EvalState::getDocCommentForPos(PosIdx pos)
 {
     auto pos2 = positions[pos];
@@ -3172,8 +3634,10 @@ DocComment EvalState::getDocCommentForPos(PosIdx pos)
     if (!path)
         return {};
 
-    auto table = positionToDocComment.find(*path);
-    if (table == positionToDocComment.end())
+    auto positionToDocComment_(positionToDocComment.lock());
+
+    auto table = positionToDocComment_->find(*path);
+    if (table == positionToDocComment_->end())
         return {};
 
     auto it = table->second.find(pos);
@@ -14,11 +14,18 @@
 #include "source-accessor.hh"
 #include "search-path.hh"
 #include "repl-exit-status.hh"
+#include "eval-profiler.hh"
 #include "ref.hh"
+#include "sync.hh"
 
+#include <cassert>
+#include <chrono>
+#include <cstring>
 #include <map>
 #include <optional>
+#include <unordered_set>
 #include <functional>
+#include <vector>
 
 namespace nix {
 
@@ -30,6 +37,7 @@ namespace nix {
 constexpr size_t maxPrimOpArity = 8;
 
 class Store;
+class ThreadPool;
 namespace fetchers { struct Settings; }
 struct EvalSettings;
 class EvalState;
@@ -153,6 +161,73 @@ struct Env
     Value * values[0];
 };
 
+/**
+ * A stack allocator for environments that cannot outlive the function
+ * call that creates them (see `ExprLambda::envCaptured`). Memory comes
+ * in chunks that the garbage collector scans but never frees, and is
+ * reused once the call returns.
+ */
+class EnvStack
+{
+    std::vector<char *> chunks;
+    size_t chunk = 0;
+    char * top = nullptr, * end = nullptr;
+
+    void grow();
+
+public:
+
+    static constexpr size_t chunkSize = 64 * 1024;
+
+    /**
+     * Environments larger than this are allocated on the heap.
+     */
+    static constexpr size_t maxSize = 64;
+
+    /**
+     * Releases all environments allocated during its lifetime.
+     */
+    class Scope
+    {
+        EnvStack & stack;
+        size_t chunk;
+        char * top;
+
+    public:
+        Scope(EnvStack & stack)
+            : stack(stack), chunk(stack.chunk), top(stack.top)
+        { }
+
+        ~Scope()
+        {
+            stack.chunk = chunk;
+            stack.top = top;
+            stack.end = top ? stack.chunks[chunk] + chunkSize : nullptr;
+        }
+
+        Scope(const Scope &) = delete;
+        Scope & operator =(const Scope &) = delete;
+    };
+
+    EnvStack() = default;
+    EnvStack(const EnvStack &) = delete;
+    EnvStack & operator =(const EnvStack &) = delete;
+    ~EnvStack();
+
+    Env & alloc(size_t size)
+    {
+        assert(size <= maxSize);
+        auto bytes = sizeof(Env) + size * sizeof(Value *);
+        if ((size_t) (end - top) < bytes) [[unlikely]]
+            grow();
+        auto env = (Env *) top;
+        top += bytes;
+        /* Like allocEnv(), return a cleared environment. */
+        memset(env, 0, bytes);
+        return *env;
+    }
+};
+
 void printEnvBindings(const EvalState &es, const Expr & expr, const Env & env);
 void printEnvBindings(const SymbolTable & st, const StaticEnv & se, const Env & env, int lvl = 0);
 
@@ -326,6 +401,12 @@ private:
        paths. */
     Sync<std::unordered_map<SourcePath, StorePath>> srcToStore;
 
+    /* The caches below are shared by everything evaluating in this
+       `EvalState`, so they are protected by a lock. The lock is never
+       held while parsing or evaluating, so a file that is evaluated
+       concurrently by multiple callers may be parsed or evaluated more
+       than once, but only the first result is kept. */
+
     /**
      * A cache from path names to parse trees.
      */
@@ -334,7 +415,7 @@ private:
 #else
     typedef std::unordered_map<SourcePath, Expr *> FileParseCache;
 #endif
-    FileParseCache fileParseCache;
+    SharedSync<FileParseCache> fileParseCache;
 
     /**
      * A cache from path names to values.
@@ -344,17 +425,29 @@ private:
 #else
     typedef std::unordered_map<SourcePath, Value> FileEvalCache;
 #endif
-    FileEvalCache fileEvalCache;
+    SharedSync<FileEvalCache> fileEvalCache;
 
     /**
      * Associate source positions of certain AST nodes with their preceding doc comment, if they have one.
      * Grouped by file.
      */
-    std::unordered_map<SourcePath, DocCommentMap> positionToDocComment;
+    Sync<std::unordered_map<SourcePath, DocCommentMap>> positionToDocComment;
+
+    /**
+     * The files that have been scheduled for parsing in the
+     * background (see `prefetch-imports`).
+     */
+    Sync<std::unordered_set<SourcePath>> prefetchedPaths;
+
+    /**
+     * The threads that parse the files in `prefetchedPaths`. Created
+     * on first use.
+     */
+    std::unique_ptr<ThreadPool> prefetchPool;
 
     LookupPath lookupPath;
 
-    std::map<std::string, std::optional<std::string>> lookupPathResolved;
+    Sync<std::map<std::string, std::optional<std::string>>> lookupPathResolved;
 
     /**
      * Cache used by prim_match().
@@ -373,6 +466,11 @@ private:
     std::shared_ptr<void *> env1AllocCache;
 #endif
 
+    /**
+     * Environments of calls to lambdas that cannot capture them.
+     */
+    EnvStack envStack;
+
 public:
 
     EvalState(
@@ -663,6 +761,13 @@ private:
         const SourcePath & basePath,
         std::shared_ptr<StaticEnv> & staticEnv);
 
+    /**
+     * Parse the file `path` on `prefetchPool` and add it to
+     * `fileParseCache`, unless this was already done. Any errors are
+     * ignored; they are reported when the file is actually imported.
+     */
+    void prefetchParse(const SourcePath & path);
+
     /**
      * Current Nix call stack depth, used with `max-call-depth` setting to throw stack overflow hopefully before we run out of system stack.
      */
@@ -835,6 +940,7 @@ private:
         const SingleDerivedPath & p);
 
     unsigned long nrEnvs = 0;
+    unsigned long nrEnvsOnStack = 0;
     unsigned long nrValuesInEnvs = 0;
     unsigned long nrValues = 0;
     unsigned long nrListElems = 0;
@@ -844,9 +950,23 @@ private:
     unsigned long nrAvoided = 0;
     unsigned long nrOpUpdates = 0;
     unsigned long nrOpUpdateValuesCopied = 0;
+    unsigned long nrOpUpdateValuesBulkCopied = 0;
     unsigned long nrListConcats = 0;
+    unsigned long nrGenericClosureKeyComparisons = 0;
     unsigned long nrPrimOpCalls = 0;
     unsigned long nrFunctionCalls = 0;
+    unsigned long nrTailCalls = 0;
+    /* Files may be parsed in the background (see
+       `prefetch-imports`), so the parser statistics are atomic. */
+    std::atomic<unsigned long> nrParses = 0;
+    std::atomic<unsigned long> nrParseCacheHits = 0;
+    std::atomic<uint64_t> nrBytesParsed = 0;
+
+    /**
+     * Total time spent in `parse()`, including `bindVars()`, in
+     * `std::chrono::steady_clock` ticks.
+     */
+    std::atomic<std::chrono::steady_clock::rep> parseTime = 0;
 
     bool countCalls;
 
@@ -861,6 +981,13 @@ private:
     typedef std::map<PosIdx, size_t> AttrSelects;
     AttrSelects attrSelects;
 
+    /**
+     * The sampling profiler, if `eval-profile-file` is set. This is
+     * the last member so that it is destroyed (and writes its
+     * profile) while the rest of the state is still alive.
+     */
+    std::unique_ptr<EvalProfiler> profiler;
+
     friend struct ExprOpUpdate;
     friend struct ExprOpConcatLists;
     friend struct ExprVar;
@@ -872,6 +999,7 @@ private:
     friend void prim_getAttr(EvalState & state, const PosIdx pos, Value * * args, Value & v);
     friend void prim_match(EvalState & state, const PosIdx pos, Value * * args, Value & v);
     friend void prim_split(EvalState & state, const PosIdx pos, Value * * args, Value & v);
+    friend class GenericClosureKeys;
 
     friend struct Value;
     friend class ListBuilder;
@@ -2,8 +2,8 @@
 #include "value.hh"
 #include "eval.hh"
 
+#include <algorithm>
 #include <limits>
-#include <variant>
 #include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
@@ -13,92 +13,76 @@ namespace nix {
 // for more information, refer to
 // https://github.com/nlohmann/json/blob/master/include/nlohmann/detail/input/json_sax.hpp
 class JSONSax : nlohmann::json_sax<json> {
-    class JSONState {
-    protected:
-        std::unique_ptr<JSONState> parent;
-        RootValue v;
-    public:
-        virtual std::unique_ptr<JSONState> resolve(EvalState &)
-        {
-            throw std::logic_error("tried to close toplevel json parser state");
-        }
-        explicit JSONState(std::unique_ptr<JSONState> && p) : parent(std::move(p)) {}
-        explicit JSONState(Value * v) : v(allocRootValue(v)) {}
-        JSONState(JSONState & p) = delete;
-        Value & value(EvalState & state)
-        {
-            if (!v)
-                v = allocRootValue(state.allocValue());
-            return **v;
-        }
-        virtual ~JSONState() {}
-        virtual void add() {}
+    /**
+     * An array or object that hasn't been closed yet. Its elements are
+     * the tail of `elems` or `members` starting at `start`.
+     */
+    struct Frame {
+        bool object;
+        size_t start;
+        /**
+         * The key under which this value will be stored in the parent
+         * object, if any.
+         */
+        Symbol key;
     };
 
-    class JSONObjectState : public JSONState {
-        using JSONState::JSONState;
-        ValueMap attrs;
-        std::unique_ptr<JSONState> resolve(EvalState & state) override
-        {
-            auto attrs2 = state.buildBindings(attrs.size());
-            for (auto & i : attrs)
-                attrs2.insert(i.first, i.second);
-            parent->value(state).mkAttrs(attrs2);
-            return std::move(parent);
-        }
-        void add() override { v = nullptr; }
-    public:
-        void key(string_t & name, EvalState & state)
-        {
-            attrs.insert_or_assign(state.symbols.create(name), &value(state));
-        }
-    };
-
-    class JSONListState : public JSONState {
-        ValueVector values;
-        std::unique_ptr<JSONState> resolve(EvalState & state) override
-        {
-            auto list = state.buildList(values.size());
-            for (const auto & [n, v2] : enumerate(list))
-                v2 = values[n];
-            parent->value(state).mkList(list);
-            return std::move(parent);
-        }
-        void add() override {
-            values.push_back(*v);
-            v = nullptr;
-        }
-    public:
-        JSONListState(std::unique_ptr<JSONState> && p, std::size_t reserve) : JSONState(std::move(p))
-        {
-            values.reserve(reserve);
-        }
-    };
+    typedef std::pair<Symbol, Value *> Member;
 
     EvalState & state;
-    std::unique_ptr<JSONState> rs;
+    Value & root;
+    std::vector<Frame> frames;
+
+    /**
+     * The elements of all open arrays and the members of all open
+     * objects. These are shared between nesting levels, so parsing
+     * doesn't allocate temporary containers per array or object.
+     */
+    ValueVector elems;
+#if HAVE_BOEHMGC
+    std::vector<Member, traceable_allocator<Member>> members;
+#else
+    std::vector<Member> members;
+#endif
+
+    /**
+     * The most recently seen object key.
+     */
+    Symbol currentKey;
+
+    /**
+     * Allocate the value that is being parsed and add it to the
+     * innermost array or object.
+     */
+    Value & newValue()
+    {
+        if (frames.empty()) return root;
+        auto v = state.allocValue();
+        if (frames.back().object)
+            members.emplace_back(currentKey, v);
+        else
+            elems.push_back(v);
+        return *v;
+    }
 
 public:
-    JSONSax(EvalState & state, Value & v) : state(state), rs(new JSONState(&v)) {};
+    JSONSax(EvalState & state, Value & v) : state(state), root(v) {};
 
     bool null() override
     {
-        rs->value(state).mkNull();
-        rs->add();
+        newValue().mkNull();
         return true;
     }
 
     bool boolean(bool val) override
     {
-        rs->value(state).mkBool(val);
-        rs->add();
+        newValue().mkBool(val);
         return true;
     }
 
     bool number_integer(number_integer_t val) override
     {
-        rs->value(state).mkInt(val);
-        rs->add();
+        newValue().mkInt(val);
         return true;
     }
 
@@ -108,22 +92,19 @@ public:
             throw Error("unsigned json number %1% outside of Nix integer range", val_);
         }
         NixInt::Inner val = val_;
-        rs->value(state).mkInt(val);
-        rs->add();
+        newValue().mkInt(val);
         return true;
     }
 
     bool number_float(number_float_t val, const string_t & s) override
     {
-        rs->value(state).mkFloat(val);
-        rs->add();
+        newValue().mkFloat(val);
         return true;
     }
 
     bool string(string_t & val) override
     {
-        rs->value(state).mkString(val);
-        rs->add();
+        newValue().mkString(val);
         return true;
     }
 
@@ -138,29 +119,56 @@ public:
 
     bool start_object(std::size_t len) override
     {
-        rs = std::make_unique<JSONObjectState>(std::move(rs));
+        frames.push_back({.object = true, .start = members.size(), .key = currentKey});
         return true;
     }
 
     bool key(string_t & name) override
     {
-        dynamic_cast<JSONObjectState*>(rs.get())->key(name, state);
+        currentKey = state.symbols.create(name);
         return true;
     }
 
-    bool end_object() override {
-        rs = rs->resolve(state);
-        rs->add();
+    bool end_object() override
+    {
+        auto frame = frames.back();
+        frames.pop_back();
+
+        /* Sort the members by key. The sort is stable so that the
+           last of several members with the same key wins. */
+        auto first = members.begin() + frame.start;
+        std::stable_sort(first, members.end(), [](const Member & a, const Member & b) {
+            return a.first < b.first;
+        });
+
+        auto attrs = state.buildBindings(members.end() - first);
+        for (auto i = first; i != members.end(); ++i)
+            if (i + 1 == members.end() || i[1].first != i->first)
+                attrs.insert(i->first, i->second);
+        members.erase(first, members.end());
+
+        currentKey = frame.key;
+        newValue().mkAttrs(attrs.alreadySorted());
         return true;
     }
 
-    bool end_array() override {
-        return end_object();
+    bool start_array(size_t len) override
+    {
+        frames.push_back({.object = false, .start = elems.size(), .key = currentKey});
+        return true;
     }
 
-    bool start_array(size_t len) override {
-        rs = std::make_unique<JSONListState>(std::move(rs),
-            len != std::numeric_limits<size_t>::max() ? len : 128);
+    bool end_array() override
+    {
+        auto frame = frames.back();
+        frames.pop_back();
+
+        auto list = state.buildList(elems.size() - frame.start);
+        std::copy(elems.begin() + frame.start, elems.end(), list.begin());
+        elems.resize(frame.start);
+
+        currentKey = frame.key;
+        newValue().mkList(list);
         return true;
     }
 
@@ -11,7 +11,7 @@
 
 namespace nix {
 
-unsigned long Expr::nrExprs = 0;
+std::atomic<unsigned long> Expr::nrExprs = 0;
 
 ExprBlackHole eBlackHole;
 
@@ -65,6 +65,11 @@ void ExprSelect::show(const SymbolTable & symbols, std::ostream & str) const
     }
 }
 
+void ExprOpUpdate::show(const SymbolTable & symbols, std::ostream & str) const
+{
+    str << "("; e1->show(symbols, str); str << " // "; e2->show(symbols, str); str << ")";
+}
+
 void ExprOpHasAttr::show(const SymbolTable & symbols, std::ostream & str) const
 {
     str << "((";
@@ -352,6 +357,18 @@ void ExprSelect::bindVars(EvalState & es, const std::shared_ptr<const StaticEnv>
     for (auto & i : attrPath)
         if (!i.symbol)
             i.expr->bindVars(es, env);
+
+    eVar = dynamic_cast<ExprVar *>(e);
+}
+
+void ExprOpUpdate::bindVars(EvalState & es, const std::shared_ptr<const StaticEnv> & env)
+{
+    e1->bindVars(es, env);
+    e2->bindVars(es, env);
+
+    e2Attrs = dynamic_cast<ExprAttrs *>(e2);
+    if (e2Attrs && (e2Attrs->recursive || !e2Attrs->dynamicAttrs.empty()))
+        e2Attrs = nullptr;
 }
 
 void ExprOpHasAttr::bindVars(EvalState & es, const std::shared_ptr<const StaticEnv> & env)
@@ -459,6 +476,21 @@ void ExprLambda::bindVars(EvalState & es, const std::shared_ptr<const StaticEnv>
     }
 
     body->bindVars(es, newEnv);
+
+    envCaptured = body->capturesEnv();
+    if (hasFormals())
+        for (auto & i : formals->formals) {
+            if (!i.def) continue;
+            if (i.def->thunkCapturesEnv())
+                envCaptured = true;
+            /* A default that refers to an argument of this function
+               (e.g. `{ a ? b, b ? 1 }`) may be evaluated before that
+               argument's slot is filled. ExprVar::maybeThunk() then
+               creates a thunk over the new environment. */
+            auto var = dynamic_cast<ExprVar *>(i.def);
+            if (var && !var->fromWith && var->level == 0)
+                envCaptured = true;
+        }
 }
 
 void ExprCall::bindVars(EvalState & es, const std::shared_ptr<const StaticEnv> & env)
@@ -563,6 +595,44 @@ void ExprPos::bindVars(EvalState & es, const std::shared_ptr<const StaticEnv> &
 }
 
 
+/* Escape analysis for environments. */
+
+static bool capturesEnv(const AttrPath & attrPath)
+{
+    for (auto & i : attrPath)
+        if (!i.symbol && i.expr->capturesEnv())
+            return true;
+    return false;
+}
+
+bool ExprSelect::capturesEnv() const
+{
+    return e->capturesEnv() || (def && def->capturesEnv()) || nix::capturesEnv(attrPath);
+}
+
+bool ExprOpHasAttr::capturesEnv() const
+{
+    return e->capturesEnv() || nix::capturesEnv(attrPath);
+}
+
+bool ExprCall::capturesEnv() const
+{
+    if (fun->capturesEnv()) return true;
+    for (auto e : args)
+        if (e->thunkCapturesEnv())
+            return true;
+    return false;
+}
+
+bool ExprConcatStrings::capturesEnv() const
+{
+    for (auto & [pos, e] : *es)
+        if (e->capturesEnv())
+            return true;
+    return false;
+}
+
+
 /* Storing function names. */
 
 void Expr::setName(Symbol name)
@@ -605,39 +675,191 @@ void ExprLambda::setDocComment(DocComment docComment) {
 
 /* Position table. */
 
-Pos PosTable::operator[](PosIdx p) const
+PosTable::Index::Index(size_t capacity)
+    : capacity(capacity)
+    , offsets(std::make_unique<uint32_t[]>(capacity))
+    , entries(std::make_unique<const Entry *[]>(capacity))
 {
-    auto origin = resolve(p);
-    if (!origin)
-        return {};
+}
+
+PosTable::PosTable()
+{
+    indexes.push_back(std::make_unique<Index>(64));
+    index = indexes.back().get();
+}
+
+PosTable::~PosTable() = default;
+
+PosTable::Origin PosTable::addOrigin(Pos::Origin origin, size_t size)
+{
+    std::lock_guard lock(mutex);
+
+    uint32_t offset = nextOffset;
+    // +1 because all PosIdx are offset by 1 to begin with, and
+    // another +1 to ensure that all origins can point to EOF, eg
+    // on (invalid) empty inputs.
+    if (2 + offset + size < offset)
+        return Origin{origin, offset, 0};
 
-    const auto offset = origin->offsetOf(p);
+    auto & entry = entries.emplace_back(std::make_unique<Entry>(Origin{origin, offset, size}));
+    nextOffset = offset + size;
 
-    Pos result{0, 0, origin->origin};
-    auto lines = this->lines.lock();
-    auto linesForInput = (*lines)[origin->offset];
+    auto n = count.load(std::memory_order_relaxed);
+    auto cur = indexes.back().get();
 
-    if (linesForInput.empty()) {
-        auto source = result.getSource().value_or("");
+    if (n == cur->capacity) {
+        auto next = std::make_unique<Index>(cur->capacity * 2);
+        std::copy(cur->offsets.get(), cur->offsets.get() + n, next->offsets.get());
+        std::copy(cur->entries.get(), cur->entries.get() + n, next->entries.get());
+        cur = next.get();
+        indexes.push_back(std::move(next));
+    }
+
+    cur->offsets[n] = offset;
+    cur->entries[n] = entry.get();
+    index.store(cur, std::memory_order_release);
+    count.store(n + 1, std::memory_order_release);
+
+    return entry->origin;
+}
+
+const PosTable::Lines & PosTable::Entry::getLines() const
+{
+    std::call_once(linesComputed, [&]() {
+        Pos pos{0, 0, origin.origin};
+        auto source = pos.getSource().value_or("");
         const char * begin = source.data();
         for (Pos::LinesIterator it(source), end; it != end; it++)
-            linesForInput.push_back(it->data() - begin);
-        if (linesForInput.empty())
-            linesForInput.push_back(0);
-    }
+            lines.push_back(it->data() - begin);
+        if (lines.empty())
+            lines.push_back(0);
+    });
+    return lines;
+}
+
+Pos PosTable::toPos(const Entry & entry, PosIdx p)
+{
+    const auto offset = entry.origin.offsetOf(p);
+
+    Pos result{0, 0, entry.origin.origin};
+    auto & lines = entry.getLines();
+
     // as above: the first line starts at byte 0 and is always present
     auto lineStartOffset = std::prev(
-        std::upper_bound(linesForInput.begin(), linesForInput.end(), offset));
+        std::upper_bound(lines.begin(), lines.end(), offset));
 
-    result.line = 1 + (lineStartOffset - linesForInput.begin());
+    result.line = 1 + (lineStartOffset - lines.begin());
     result.column = 1 + (offset - *lineStartOffset);
     return result;
 }
 
+Pos PosTable::operator[](PosIdx p) const
+{
+    auto entry = findEntry(p);
+    if (!entry)
+        return {};
+    return toPos(*entry, p);
+}
+
+std::vector<Pos> PosTable::resolve(std::span<const PosIdx> ps) const
+{
+    std::vector<Pos> result;
+    result.reserve(ps.size());
+
+    const Entry * entry = nullptr;
+
+    for (auto p : ps) {
+        if (!p) {
+            result.emplace_back();
+            continue;
+        }
+        if (!entry || p.id - 1 < entry->origin.offset || p.id - 1 >= entry->origin.offset + entry->origin.size)
+            entry = findEntry(p);
+        result.push_back(entry ? toPos(*entry, p) : Pos());
+    }
+
+    return result;
+}
+
 
 
 /* Symbol table. */
 
+SymbolTable::Table::Table(size_t size)
+    : mask(size - 1)
+    , slots(std::make_unique<std::atomic<uint64_t>[]>(size))
+{
+    assert(std::has_single_bit(size));
+}
+
+SymbolTable::SymbolTable()
+{
+    for (auto & shard : shards) {
+        shard.tables.push_back(std::make_unique<Table>(64));
+        shard.table = shard.tables.back().get();
+    }
+}
+
+SymbolTable::~SymbolTable()
+{
+    for (auto & chunk : chunks)
+        delete[] chunk.load();
+}
+
+Symbol SymbolTable::add(Shard & shard, uint64_t hash, std::string_view s)
+{
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    /* Another thread may have added the symbol since the caller
+       looked it up. */
+    auto table = shard.tables.back().get();
+    if (auto id = lookup(*table, hash, s))
+        return Symbol(id);
+
+    auto idx = nextIdx.load(std::memory_order_relaxed);
+    do {
+        if (idx == std::numeric_limits<uint32_t>::max())
+            unreachable();
+    } while (!nextIdx.compare_exchange_weak(idx, idx + 1, std::memory_order_relaxed));
+
+    auto [chunkIdx, offset] = locate(idx);
+    auto chunk = chunks[chunkIdx].load(std::memory_order_acquire);
+    if (!chunk) {
+        auto newChunk = new std::string[firstChunkSize << chunkIdx];
+        if (chunks[chunkIdx].compare_exchange_strong(chunk, newChunk, std::memory_order_acq_rel))
+            chunk = newChunk;
+        else
+            delete[] newChunk;
+    }
+    chunk[offset] = s;
+
+    auto insert = [](Table & table, uint64_t entry) {
+        for (size_t i = entry >> 32; ; ++i) {
+            auto & slot = table.slots[i & table.mask];
+            if (!slot.load(std::memory_order_relaxed)) {
+                slot.store(entry, std::memory_order_release);
+                return;
+            }
+        }
+    };
+
+    /* Keep the load factor below 1/2. */
+    if (2 * (shard.count + 1) > table->mask + 1) {
+        auto newTable = std::make_unique<Table>(2 * (table->mask + 1));
+        for (size_t i = 0; i <= table->mask; ++i)
+            if (auto entry = table->slots[i].load(std::memory_order_relaxed))
+                insert(*newTable, entry);
+        table = newTable.get();
+        shard.tables.push_back(std::move(newTable));
+        shard.table.store(table, std::memory_order_release);
+    }
+
+    insert(*table, (hash >> 32) << 32 | (idx + 1));
+    shard.count++;
+
+    return Symbol(idx + 1);
+}
+
 size_t SymbolTable::totalSize() const
 {
     size_t n = 0;
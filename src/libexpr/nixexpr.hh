@@ -1,6 +1,7 @@
 #pragma once
 ///@file
 
+#include <atomic>
 #include <map>
 #include <vector>
 
@@ -77,6 +78,8 @@ std::string showAttrPath(const SymbolTable & symbols, const AttrPath & attrPath)
 
 /* Abstract syntax of Nix expressions. */
 
+struct ExprCall;
+
 struct Expr
 {
     struct AstSymbols {
@@ -84,7 +87,7 @@ struct Expr
     };
 
 
-    static unsigned long nrExprs;
+    static std::atomic<unsigned long> nrExprs;
     Expr() {
         nrExprs++;
     }
@@ -92,12 +95,38 @@ struct Expr
     virtual void show(const SymbolTable & symbols, std::ostream & str) const;
     virtual void bindVars(EvalState & es, const std::shared_ptr<const StaticEnv> & env);
     virtual void eval(EvalState & state, Env & env, Value & v);
+
+    /**
+     * Like `eval()`, except that a function call in tail position
+     * (possibly under `let`, `with`, `if` or `assert`) is returned
+     * rather than performed, with `env` set to the environment in
+     * which to perform it. This lets `EvalState::callFunction()` turn
+     * tail calls into a loop.
+     */
+    virtual ExprCall * evalTail(EvalState & state, Env * & env, Value & v);
+
     virtual Value * maybeThunk(EvalState & state, Env & env);
     virtual void setName(Symbol name);
     virtual void setDocComment(DocComment docComment) { };
     virtual PosIdx getPos() const { return noPos; }
+
+    /**
+     * Whether `eval()` may store a reference to its environment (for
+     * instance in a thunk or a closure) that can outlive the call.
+     * Must be conservative, and is only valid after `bindVars()`.
+     */
+    virtual bool capturesEnv() const { return true; }
+
+    /**
+     * Like `capturesEnv()`, but for `maybeThunk()`.
+     */
+    virtual bool thunkCapturesEnv() const { return true; }
 };
 
+#define NO_ENV_CAPTURE \
+    bool capturesEnv() const override { return false; } \
+    bool thunkCapturesEnv() const override { return false; }
+
 #define COMMON_METHODS \
     void show(const SymbolTable & symbols, std::ostream & str) const override; \
     void eval(EvalState & state, Env & env, Value & v) override; \
@@ -109,6 +138,7 @@ struct ExprInt : Expr
     ExprInt(NixInt n) { v.mkInt(n); };
     ExprInt(NixInt::Inner n) { v.mkInt(n); };
     Value * maybeThunk(EvalState & state, Env & env) override;
+    NO_ENV_CAPTURE
     COMMON_METHODS
 };
 
@@ -117,6 +147,7 @@ struct ExprFloat : Expr
     Value v;
     ExprFloat(NixFloat nf) { v.mkFloat(nf); };
     Value * maybeThunk(EvalState & state, Env & env) override;
+    NO_ENV_CAPTURE
     COMMON_METHODS
 };
 
@@ -126,6 +157,7 @@ struct ExprString : Expr
     Value v;
     ExprString(std::string &&s) : s(std::move(s)) { v.mkString(this->s.data()); };
     Value * maybeThunk(EvalState & state, Env & env) override;
+    NO_ENV_CAPTURE
     COMMON_METHODS
 };
 
@@ -139,6 +171,7 @@ struct ExprPath : Expr
         v.mkPath(&*accessor, this->s.c_str());
     }
     Value * maybeThunk(EvalState & state, Env & env) override;
+    NO_ENV_CAPTURE
     COMMON_METHODS
 };
 
@@ -170,6 +203,8 @@ struct ExprVar : Expr
     ExprVar(const PosIdx & pos, Symbol name) : pos(pos), name(name) { };
     Value * maybeThunk(EvalState & state, Env & env) override;
     PosIdx getPos() const override { return pos; }
+    bool capturesEnv() const override { return false; }
+    bool thunkCapturesEnv() const override { return fromWith; }
     COMMON_METHODS
 };
 
@@ -195,6 +230,14 @@ struct ExprSelect : Expr
     PosIdx pos;
     Expr * e, * def;
     AttrPath attrPath;
+
+    /**
+     * Set by `bindVars()` if `e` is a variable (as in `lib.foo`). The
+     * variable is then looked up and forced in place, rather than
+     * being copied into a temporary first.
+     */
+    ExprVar * eVar = nullptr;
+
     ExprSelect(const PosIdx & pos, Expr * e, AttrPath attrPath, Expr * def) : pos(pos), e(e), def(def), attrPath(std::move(attrPath)) { };
     ExprSelect(const PosIdx & pos, Expr * e, Symbol name) : pos(pos), e(e), def(0) { attrPath.push_back(AttrName(name)); };
     PosIdx getPos() const override { return pos; }
@@ -209,6 +252,7 @@ struct ExprSelect : Expr
      */
     Symbol evalExceptFinalSelect(EvalState & state, Env & env, Value & attrs);
 
+    bool capturesEnv() const override;
     COMMON_METHODS
 };
 
@@ -218,6 +262,7 @@ struct ExprOpHasAttr : Expr
     AttrPath attrPath;
     ExprOpHasAttr(Expr * e, AttrPath attrPath) : e(e), attrPath(std::move(attrPath)) { };
     PosIdx getPos() const override { return e->getPos(); }
+    bool capturesEnv() const override;
     COMMON_METHODS
 };
 
@@ -333,6 +378,14 @@ struct ExprLambda : Expr
     Expr * body;
     DocComment docComment;
 
+    /**
+     * Whether the environment of a call to this function may outlive
+     * the call, i.e. whether the body or a default value may capture
+     * it. If not, the environment is allocated on `EvalState::envStack`
+     * rather than on the garbage-collected heap. Set by `bindVars()`.
+     */
+    bool envCaptured = true;
+
     ExprLambda(PosIdx pos, Symbol arg, Formals * formals, Expr * body)
         : pos(pos), arg(arg), formals(formals), body(body)
     {
@@ -358,6 +411,8 @@ struct ExprCall : Expr
         : fun(fun), args(args), pos(pos)
     { }
     PosIdx getPos() const override { return pos; }
+    bool capturesEnv() const override;
+    ExprCall * evalTail(EvalState & state, Env * & env, Value & v) override;
     COMMON_METHODS
 };
 
@@ -366,7 +421,14 @@ struct ExprLet : Expr
     ExprAttrs * attrs;
     Expr * body;
     ExprLet(ExprAttrs * attrs, Expr * body) : attrs(attrs), body(body) { };
+    ExprCall * evalTail(EvalState & state, Env * & env, Value & v) override;
     COMMON_METHODS
+
+private:
+    /**
+     * Allocate the environment containing the bindings.
+     */
+    Env & buildEnv(EvalState & state, Env & env);
 };
 
 struct ExprWith : Expr
@@ -377,6 +439,7 @@ struct ExprWith : Expr
     ExprWith * parentWith;
     ExprWith(const PosIdx & pos, Expr * attrs, Expr * body) : pos(pos), attrs(attrs), body(body) { };
     PosIdx getPos() const override { return pos; }
+    ExprCall * evalTail(EvalState & state, Env * & env, Value & v) override;
     COMMON_METHODS
 };
 
@@ -386,6 +449,11 @@ struct ExprIf : Expr
     Expr * cond, * then, * else_;
     ExprIf(const PosIdx & pos, Expr * cond, Expr * then, Expr * else_) : pos(pos), cond(cond), then(then), else_(else_) { };
     PosIdx getPos() const override { return pos; }
+    bool capturesEnv() const override
+    {
+        return cond->capturesEnv() || then->capturesEnv() || else_->capturesEnv();
+    }
+    ExprCall * evalTail(EvalState & state, Env * & env, Value & v) override;
     COMMON_METHODS
 };
 
@@ -395,7 +463,15 @@ struct ExprAssert : Expr
     Expr * cond, * body;
     ExprAssert(const PosIdx & pos, Expr * cond, Expr * body) : pos(pos), cond(cond), body(body) { };
     PosIdx getPos() const override { return pos; }
+    bool capturesEnv() const override { return cond->capturesEnv() || body->capturesEnv(); }
+    ExprCall * evalTail(EvalState & state, Env * & env, Value & v) override;
     COMMON_METHODS
+
+private:
+    /**
+     * Throw an `AssertionError` if the condition is false.
+     */
+    void check(EvalState & state, Env & env);
 };
 
 struct ExprOpNot : Expr
@@ -403,6 +479,7 @@ struct ExprOpNot : Expr
     Expr * e;
     ExprOpNot(Expr * e) : e(e) { };
     PosIdx getPos() const override { return e->getPos(); }
+    bool capturesEnv() const override { return e->capturesEnv(); }
     COMMON_METHODS
 };
 
@@ -423,6 +500,7 @@ struct ExprOpNot : Expr
         } \
         void eval(EvalState & state, Env & env, Value & v) override; \
         PosIdx getPos() const override { return pos; } \
+        bool capturesEnv() const override { return e1->capturesEnv() || e2->capturesEnv(); } \
     };
 
 MakeBinOp(ExprOpEq, "==")
@@ -430,9 +508,34 @@ MakeBinOp(ExprOpNEq, "!=")
 MakeBinOp(ExprOpAnd, "&&")
 MakeBinOp(ExprOpOr, "||")
 MakeBinOp(ExprOpImpl, "->")
-MakeBinOp(ExprOpUpdate, "//")
 MakeBinOp(ExprOpConcatLists, "++")
 
+struct ExprOpUpdate : Expr
+{
+    PosIdx pos;
+    Expr * e1, * e2;
+
+    /**
+     * Set by `bindVars()` if `e2` is a non-recursive attribute set
+     * without dynamic attributes (as in `x // { a = ...; }`). Its
+     * attributes are then merged into the result directly, without
+     * allocating an intermediate attribute set for `e2`.
+     */
+    ExprAttrs * e2Attrs = nullptr;
+
+    ExprOpUpdate(const PosIdx & pos, Expr * e1, Expr * e2) : pos(pos), e1(e1), e2(e2) { };
+    PosIdx getPos() const override { return pos; }
+    bool capturesEnv() const override
+    {
+        /* The attributes of `e2Attrs` become thunks in `env`. */
+        return e2Attrs || e1->capturesEnv() || e2->capturesEnv();
+    }
+    COMMON_METHODS
+
+private:
+    void updateWithAttrs(EvalState & state, Env & env, Value & v1, Value & v);
+};
+
 struct ExprConcatStrings : Expr
 {
     PosIdx pos;
@@ -441,6 +544,7 @@ struct ExprConcatStrings : Expr
     ExprConcatStrings(const PosIdx & pos, bool forceString, std::vector<std::pair<PosIdx, Expr *>> * es)
         : pos(pos), forceString(forceString), es(es) { };
     PosIdx getPos() const override { return pos; }
+    bool capturesEnv() const override;
     COMMON_METHODS
 };
 
@@ -449,6 +553,7 @@ struct ExprPos : Expr
     PosIdx pos;
     ExprPos(const PosIdx & pos) : pos(pos) { };
     PosIdx getPos() const override { return pos; }
+    bool capturesEnv() const override { return false; }
     COMMON_METHODS
 };
 
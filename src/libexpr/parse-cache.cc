@@ -0,0 +1,665 @@
+#include "parse-cache.hh"
+#include "eval-settings.hh"
+#include "serialise.hh"
+#include "file-system.hh"
+#include "users.hh"
+#include "globals.hh"
+#include "config-global.hh"
+#include "logging.hh"
+
+#include <atomic>
+#include <bit>
+#include <filesystem>
+#include <typeinfo>
+
+#include <unistd.h>
+
+namespace nix::parse_cache {
+
+/**
+ * Changed whenever the format of the entries or the syntax tree
+ * changes in a way that the Nix version doesn't capture (e.g. during
+ * development).
+ */
+static constexpr uint64_t formatVersion = 1;
+
+static const std::string magic = "nix-parse-cache";
+
+enum class Tag : uint64_t
+{
+    Null,
+    Int,
+    Float,
+    String,
+    Path,
+    Var,
+    InheritFrom,
+    Select,
+    OpHasAttr,
+    Attrs,
+    List,
+    Lambda,
+    Call,
+    Let,
+    With,
+    If,
+    Assert,
+    OpNot,
+    OpEq,
+    OpNEq,
+    OpAnd,
+    OpOr,
+    OpImpl,
+    OpConcatLists,
+    OpUpdate,
+    ConcatStrings,
+    Pos,
+};
+
+static Path cacheDir()
+{
+    return fmt("%s/nix/parse-cache-v%d", getCacheDir(), formatVersion);
+}
+
+static Path entryPath(const Hash & key)
+{
+    return cacheDir() + "/" + key.to_string(HashFormat::Base16, false);
+}
+
+Hash key(const SourcePath & path, std::string_view text, const EvalSettings & settings)
+{
+    HashSink sink(HashAlgorithm::SHA256);
+    sink
+        << magic
+        << formatVersion
+        << nixVersion
+        /* The parser resolves relative path literals against the
+           directory of the file, and `~/...` against the home
+           directory, unless that is forbidden by pure evaluation. */
+        << path.path.abs()
+        << getHome()
+        << (uint64_t) settings.pureEval.get()
+        << (uint64_t) experimentalFeatureSettings.isEnabled(Xp::PipeOperators)
+        << (uint64_t) experimentalFeatureSettings.isEnabled(Xp::NoUrlLiterals)
+        << text;
+    return sink.finish().first;
+}
+
+namespace {
+
+struct Writer
+{
+    const SymbolTable & symbols;
+    const PosTable::Origin & origin;
+
+    StringSink sink;
+
+    std::unordered_map<Symbol, uint64_t> symbolIds;
+    std::vector<Symbol> symbolsUsed;
+
+    void num(uint64_t n)
+    {
+        sink << n;
+    }
+
+    void tag(Tag t)
+    {
+        num((uint64_t) t);
+    }
+
+    void sym(Symbol s)
+    {
+        if (!s) return num(0);
+        auto [i, inserted] = symbolIds.emplace(s, symbolsUsed.size() + 1);
+        if (inserted) symbolsUsed.push_back(s);
+        num(i->second);
+    }
+
+    void pos(PosIdx p)
+    {
+        if (!p) return num(0);
+        auto offset = origin.offsetOf(p);
+        if (offset > origin.size)
+            throw Error("position does not belong to the file");
+        num(uint64_t(offset) + 1);
+    }
+
+    void attrPath(const AttrPath & attrPath)
+    {
+        num(attrPath.size());
+        for (auto & name : attrPath) {
+            num(bool(name.symbol));
+            if (name.symbol)
+                sym(name.symbol);
+            else
+                expr(name.expr);
+        }
+    }
+
+    void binOp(Tag t, PosIdx p, Expr * e1, Expr * e2)
+    {
+        tag(t);
+        pos(p);
+        expr(e1);
+        expr(e2);
+    }
+
+    void expr(Expr * e)
+    {
+        if (!e)
+            tag(Tag::Null);
+
+        else if (auto e2 = dynamic_cast<ExprInt *>(e)) {
+            tag(Tag::Int);
+            num((uint64_t) e2->v.integer().value);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprFloat *>(e)) {
+            tag(Tag::Float);
+            num(std::bit_cast<uint64_t>(e2->v.fpoint()));
+        }
+
+        else if (auto e2 = dynamic_cast<ExprString *>(e)) {
+            tag(Tag::String);
+            sink << e2->s;
+        }
+
+        else if (auto e2 = dynamic_cast<ExprPath *>(e)) {
+            tag(Tag::Path);
+            sink << e2->s;
+        }
+
+        else if (auto e2 = dynamic_cast<ExprInheritFrom *>(e)) {
+            tag(Tag::InheritFrom);
+            pos(e2->pos);
+            num(e2->displ);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprVar *>(e)) {
+            tag(Tag::Var);
+            pos(e2->pos);
+            sym(e2->name);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprSelect *>(e)) {
+            tag(Tag::Select);
+            pos(e2->pos);
+            expr(e2->e);
+            expr(e2->def);
+            attrPath(e2->attrPath);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprOpHasAttr *>(e)) {
+            tag(Tag::OpHasAttr);
+            expr(e2->e);
+            attrPath(e2->attrPath);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprAttrs *>(e)) {
+            tag(Tag::Attrs);
+            num(e2->recursive);
+            pos(e2->pos);
+            num(e2->attrs.size());
+            for (auto & [name, def] : e2->attrs) {
+                sym(name);
+                num((uint64_t) def.kind);
+                pos(def.pos);
+                expr(def.e);
+            }
+            num(bool(e2->inheritFromExprs));
+            if (e2->inheritFromExprs) {
+                num(e2->inheritFromExprs->size());
+                for (auto from : *e2->inheritFromExprs)
+                    expr(from);
+            }
+            num(e2->dynamicAttrs.size());
+            for (auto & def : e2->dynamicAttrs) {
+                pos(def.pos);
+                expr(def.nameExpr);
+                expr(def.valueExpr);
+            }
+        }
+
+        else if (auto e2 = dynamic_cast<ExprList *>(e)) {
+            tag(Tag::List);
+            num(e2->elems.size());
+            for (auto elem : e2->elems)
+                expr(elem);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprLambda *>(e)) {
+            tag(Tag::Lambda);
+            pos(e2->pos);
+            sym(e2->name);
+            sym(e2->arg);
+            num(e2->hasFormals());
+            if (e2->hasFormals()) {
+                num(e2->formals->ellipsis);
+                num(e2->formals->formals.size());
+                for (auto & formal : e2->formals->formals) {
+                    pos(formal.pos);
+                    sym(formal.name);
+                    expr(formal.def);
+                }
+            }
+            expr(e2->body);
+            pos(e2->docComment.begin);
+            pos(e2->docComment.end);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprCall *>(e)) {
+            tag(Tag::Call);
+            pos(e2->pos);
+            expr(e2->fun);
+            num(e2->args.size());
+            for (auto arg : e2->args)
+                expr(arg);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprLet *>(e)) {
+            tag(Tag::Let);
+            expr(e2->attrs);
+            expr(e2->body);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprWith *>(e)) {
+            tag(Tag::With);
+            pos(e2->pos);
+            expr(e2->attrs);
+            expr(e2->body);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprIf *>(e)) {
+            tag(Tag::If);
+            pos(e2->pos);
+            expr(e2->cond);
+            expr(e2->then);
+            expr(e2->else_);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprAssert *>(e)) {
+            tag(Tag::Assert);
+            pos(e2->pos);
+            expr(e2->cond);
+            expr(e2->body);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprOpNot *>(e)) {
+            tag(Tag::OpNot);
+            expr(e2->e);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprOpEq *>(e))
+            binOp(Tag::OpEq, e2->pos, e2->e1, e2->e2);
+        else if (auto e2 = dynamic_cast<ExprOpNEq *>(e))
+            binOp(Tag::OpNEq, e2->pos, e2->e1, e2->e2);
+        else if (auto e2 = dynamic_cast<ExprOpAnd *>(e))
+            binOp(Tag::OpAnd, e2->pos, e2->e1, e2->e2);
+        else if (auto e2 = dynamic_cast<ExprOpOr *>(e))
+            binOp(Tag::OpOr, e2->pos, e2->e1, e2->e2);
+        else if (auto e2 = dynamic_cast<ExprOpImpl *>(e))
+            binOp(Tag::OpImpl, e2->pos, e2->e1, e2->e2);
+        else if (auto e2 = dynamic_cast<ExprOpConcatLists *>(e))
+            binOp(Tag::OpConcatLists, e2->pos, e2->e1, e2->e2);
+        else if (auto e2 = dynamic_cast<ExprOpUpdate *>(e))
+            binOp(Tag::OpUpdate, e2->pos, e2->e1, e2->e2);
+
+        else if (auto e2 = dynamic_cast<ExprConcatStrings *>(e)) {
+            tag(Tag::ConcatStrings);
+            pos(e2->pos);
+            num(e2->forceString);
+            num(e2->es->size());
+            for (auto & [p, e3] : *e2->es) {
+                pos(p);
+                expr(e3);
+            }
+        }
+
+        else if (auto e2 = dynamic_cast<ExprPos *>(e)) {
+            tag(Tag::Pos);
+            pos(e2->pos);
+        }
+
+        else
+            throw Error("cannot serialise expression of type '%s'", typeid(*e).name());
+    }
+};
+
+struct Reader
+{
+    Source & source;
+    SymbolTable & symbols;
+    PosTable & positions;
+    const PosTable::Origin & origin;
+    const ref<SourceAccessor> rootFS;
+    std::vector<SourcePath> * literalPaths;
+
+    std::vector<Symbol> symbolsUsed;
+
+    uint64_t num()
+    {
+        return readLongLong(source);
+    }
+
+    Symbol sym()
+    {
+        auto n = num();
+        if (n == 0) return {};
+        if (n > symbolsUsed.size())
+            throw Error("invalid symbol");
+        return symbolsUsed[n - 1];
+    }
+
+    PosIdx pos()
+    {
+        auto n = num();
+        if (n == 0) return noPos;
+        if (n - 1 > origin.size)
+            throw Error("invalid position");
+        return positions.add(origin, n - 1);
+    }
+
+    AttrPath attrPath()
+    {
+        AttrPath attrPath;
+        for (auto n = num(); n; --n) {
+            if (num())
+                attrPath.emplace_back(sym());
+            else
+                attrPath.emplace_back(expr());
+        }
+        return attrPath;
+    }
+
+    template<typename T>
+    T * exprOf()
+    {
+        auto e = dynamic_cast<T *>(expr());
+        if (!e)
+            throw Error("unexpected type of expression");
+        return e;
+    }
+
+    /**
+     * @param literal Whether a path expression here is a path literal
+     * by itself rather than the start of an interpolated path.
+     */
+    Expr * expr(bool literal = true)
+    {
+        switch ((Tag) num()) {
+
+        case Tag::Null:
+            return nullptr;
+
+        case Tag::Int:
+            return new ExprInt(NixInt::Inner(num()));
+
+        case Tag::Float:
+            return new ExprFloat(std::bit_cast<NixFloat>(num()));
+
+        case Tag::String:
+            return new ExprString(readString(source));
+
+        case Tag::Path: {
+            auto e = new ExprPath(rootFS, readString(source));
+            if (literal && literalPaths)
+                literalPaths->emplace_back(e->accessor, CanonPath(e->s));
+            return e;
+        }
+
+        case Tag::Var: {
+            auto p = pos();
+            return new ExprVar(p, sym());
+        }
+
+        case Tag::InheritFrom: {
+            auto p = pos();
+            return new ExprInheritFrom(p, num());
+        }
+
+        case Tag::Select: {
+            auto p = pos();
+            auto e = expr();
+            auto def = expr();
+            return new ExprSelect(p, e, attrPath(), def);
+        }
+
+        case Tag::OpHasAttr: {
+            auto e = expr();
+            return new ExprOpHasAttr(e, attrPath());
+        }
+
+        case Tag::Attrs: {
+            auto e = new ExprAttrs;
+            e->recursive = num();
+            e->pos = pos();
+            for (auto n = num(); n; --n) {
+                auto name = sym();
+                auto kind = (ExprAttrs::AttrDef::Kind) num();
+                auto p = pos();
+                e->attrs.emplace(name, ExprAttrs::AttrDef(expr(), p, kind));
+            }
+            if (num()) {
+                e->inheritFromExprs = std::make_unique<std::vector<Expr *>>();
+                for (auto n = num(); n; --n)
+                    e->inheritFromExprs->push_back(expr());
+            }
+            for (auto n = num(); n; --n) {
+                auto p = pos();
+                auto nameExpr = expr();
+                e->dynamicAttrs.emplace_back(nameExpr, expr(), p);
+            }
+            return e;
+        }
+
+        case Tag::List: {
+            auto e = new ExprList;
+            for (auto n = num(); n; --n)
+                e->elems.push_back(expr());
+            return e;
+        }
+
+        case Tag::Lambda: {
+            auto p = pos();
+            auto name = sym();
+            auto arg = sym();
+            Formals * formals = nullptr;
+            if (num()) {
+                formals = new Formals;
+                formals->ellipsis = num();
+                for (auto n = num(); n; --n) {
+                    auto p = pos();
+                    auto name = sym();
+                    formals->formals.push_back({p, name, expr()});
+                }
+                /* Formals are sorted by symbol, and symbols may be
+                   numbered differently in this process. */
+                std::sort(formals->formals.begin(), formals->formals.end(),
+                    [] (const auto & a, const auto & b) {
+                        return std::tie(a.name, a.pos) < std::tie(b.name, b.pos);
+                    });
+            }
+            auto e = new ExprLambda(p, arg, formals, expr());
+            e->name = name;
+            e->docComment.begin = pos();
+            e->docComment.end = pos();
+            return e;
+        }
+
+        case Tag::Call: {
+            auto p = pos();
+            auto fun = expr();
+            std::vector<Expr *> args;
+            for (auto n = num(); n; --n)
+                args.push_back(expr());
+            return new ExprCall(p, fun, std::move(args));
+        }
+
+        case Tag::Let: {
+            auto attrs = exprOf<ExprAttrs>();
+            return new ExprLet(attrs, expr());
+        }
+
+        case Tag::With: {
+            auto p = pos();
+            auto attrs = expr();
+            return new ExprWith(p, attrs, expr());
+        }
+
+        case Tag::If: {
+            auto p = pos();
+            auto cond = expr();
+            auto then = expr();
+            return new ExprIf(p, cond, then, expr());
+        }
+
+        case Tag::Assert: {
+            auto p = pos();
+            auto cond = expr();
+            return new ExprAssert(p, cond, expr());
+        }
+
+        case Tag::OpNot:
+            return new ExprOpNot(expr());
+
+        case Tag::OpEq: return binOp<ExprOpEq>();
+        case Tag::OpNEq: return binOp<ExprOpNEq>();
+        case Tag::OpAnd: return binOp<ExprOpAnd>();
+        case Tag::OpOr: return binOp<ExprOpOr>();
+        case Tag::OpImpl: return binOp<ExprOpImpl>();
+        case Tag::OpConcatLists: return binOp<ExprOpConcatLists>();
+        case Tag::OpUpdate: return binOp<ExprOpUpdate>();
+
+        case Tag::ConcatStrings: {
+            auto p = pos();
+            bool forceString = num();
+            auto es = new std::vector<std::pair<PosIdx, Expr *>>;
+            for (auto n = num(); n; --n) {
+                auto p2 = pos();
+                /* In an interpolated path (`./foo/${bar}`), the first
+                   element is the path up to the interpolation. */
+                es->emplace_back(p2, expr(forceString || !es->empty()));
+            }
+            return new ExprConcatStrings(p, forceString, es);
+        }
+
+        case Tag::Pos:
+            return new ExprPos(pos());
+
+        default:
+            throw Error("invalid expression type");
+        }
+    }
+
+    template<typename T>
+    Expr * binOp()
+    {
+        auto p = pos();
+        auto e1 = expr();
+        return new T(p, e1, expr());
+    }
+};
+
+}
+
+Expr * lookup(
+    const Hash & key,
+    const PosTable::Origin & origin,
+    SymbolTable & symbols,
+    PosTable & positions,
+    const ref<SourceAccessor> rootFS,
+    DocCommentMap & docComments,
+    std::vector<SourcePath> * literalPaths)
+{
+    std::string data;
+    try {
+        data = readFile(entryPath(key));
+    } catch (SysError &) {
+        return nullptr;
+    }
+
+    try {
+        StringSource source(data);
+
+        if (readString(source) != magic || readLongLong(source) != formatVersion)
+            throw Error("unsupported format");
+
+        Reader reader{
+            .source = source,
+            .symbols = symbols,
+            .positions = positions,
+            .origin = origin,
+            .rootFS = rootFS,
+            .literalPaths = literalPaths,
+        };
+
+        for (auto n = reader.num(); n; --n)
+            reader.symbolsUsed.push_back(symbols.create(readString(source)));
+
+        auto e = reader.expr();
+        if (!e)
+            throw Error("missing expression");
+
+        DocCommentMap docComments2;
+        for (auto n = reader.num(); n; --n) {
+            auto p = reader.pos();
+            auto begin = reader.pos();
+            docComments2.emplace(p, DocComment{begin, reader.pos()});
+        }
+
+        if (readString(source) != magic)
+            throw Error("truncated entry");
+
+        docComments.merge(docComments2);
+
+        return e;
+    } catch (Error & e) {
+        debug("ignoring parse cache entry '%s': %s", entryPath(key), e.msg());
+        return nullptr;
+    }
+}
+
+void add(
+    const Hash & key,
+    Expr * e,
+    const PosTable::Origin & origin,
+    const SymbolTable & symbols,
+    const DocCommentMap & docComments)
+{
+    try {
+        Writer writer{.symbols = symbols, .origin = origin};
+
+        writer.expr(e);
+
+        writer.num(docComments.size());
+        for (auto & [p, docComment] : docComments) {
+            writer.pos(p);
+            writer.pos(docComment.begin);
+            writer.pos(docComment.end);
+        }
+
+        /* The symbols are needed first when loading, but are only
+           known once the expression has been written. */
+        StringSink sink;
+        sink << magic << formatVersion << writer.symbolsUsed.size();
+        for (auto s : writer.symbolsUsed)
+            sink << std::string_view(symbols[s]);
+        sink.s += writer.sink.s;
+        sink << magic;
+
+        /* Write the entry atomically, since other processes may be
+           reading it. */
+        static std::atomic<uint64_t> nrTmpFiles{0};
+        auto path = entryPath(key);
+        auto tmpPath = fmt("%s.tmp-%d-%d", path, getpid(), nrTmpFiles++);
+        createDirs(cacheDir());
+        AutoDelete tmpFile(tmpPath, false);
+        writeFile(tmpPath, sink.s);
+        std::filesystem::rename(tmpPath, path);
+        tmpFile.cancel();
+    } catch (std::exception & e) {
+        debug("cannot add parse cache entry: %s", e.what());
+    }
+}
+
+}
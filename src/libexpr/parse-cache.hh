@@ -0,0 +1,67 @@
+#pragma once
+///@file
+
+#include "nixexpr.hh"
+#include "pos-table.hh"
+#include "hash.hh"
+
+namespace nix {
+
+struct EvalSettings;
+
+typedef std::unordered_map<PosIdx, DocComment> DocCommentMap;
+
+/**
+ * A persistent cache of the syntax trees of Nix files, so that files
+ * that haven't changed since an earlier Nix process parsed them don't
+ * have to be parsed again (see the `parse-cache` setting).
+ *
+ * An entry holds the syntax tree of a file as produced by the parser,
+ * i.e. before `bindVars()`, and its doc comments. Symbols are stored
+ * as strings and positions as offsets into the file, so an entry can
+ * be loaded into any `SymbolTable` and `PosTable`. Entries are keyed
+ * by the file's path and contents, the Nix version and the settings
+ * that affect parsing.
+ */
+namespace parse_cache {
+
+/**
+ * Compute the key of the entry for the file `path` with contents
+ * `text`.
+ */
+Hash key(const SourcePath & path, std::string_view text, const EvalSettings & settings);
+
+/**
+ * Load the syntax tree stored under `key`. Its positions are in
+ * `origin`, which must have been added for the same contents.
+ *
+ * @param literalPaths If not null, the path literals in the file are
+ * appended to it, as by the parser.
+ *
+ * @return `nullptr` if there is no usable entry, in which case the
+ * file must be parsed.
+ */
+Expr * lookup(
+    const Hash & key,
+    const PosTable::Origin & origin,
+    SymbolTable & symbols,
+    PosTable & positions,
+    const ref<SourceAccessor> rootFS,
+    DocCommentMap & docComments,
+    std::vector<SourcePath> * literalPaths);
+
+/**
+ * Store the syntax tree `e` of a file that has just been parsed into
+ * `origin` under `key`. Errors are ignored, since the cache is only
+ * an optimisation.
+ */
+void add(
+    const Hash & key,
+    Expr * e,
+    const PosTable::Origin & origin,
+    const SymbolTable & symbols,
+    const DocCommentMap & docComments);
+
+}
+
+}
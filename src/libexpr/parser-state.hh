@@ -85,6 +85,12 @@ struct ParserState
     const Expr::AstSymbols & s;
     const EvalSettings & settings;
 
+    /**
+     * If set, the parser appends every path literal without
+     * interpolation (e.g. `./foo.nix`) to this vector.
+     */
+    std::vector<SourcePath> * literalPaths = nullptr;
+
     void dupAttr(const AttrPath & attrPath, const PosIdx pos, const PosIdx prevPos);
     void dupAttr(Symbol attr, const PosIdx pos, const PosIdx prevPos);
     void addAttr(ExprAttrs * attrs, AttrPath && attrPath, const ParserLocation & loc, Expr * e, const ParserLocation & exprLoc);
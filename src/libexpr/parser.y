@@ -62,14 +62,15 @@ typedef std::unordered_map<PosIdx, DocComment> DocCommentMap;
 Expr * parseExprFromBuf(
     char * text,
     size_t length,
-    Pos::Origin origin,
+    const PosTable::Origin & origin,
     const SourcePath & basePath,
     SymbolTable & symbols,
     const EvalSettings & settings,
     PosTable & positions,
     DocCommentMap & docComments,
     const ref<SourceAccessor> rootFS,
-    const Expr::AstSymbols & astSymbols);
+    const Expr::AstSymbols & astSymbols,
+    std::vector<SourcePath> * literalPaths = nullptr);
 
 }
 
@@ -295,7 +296,13 @@ expr_simple
       $$ = state->stripIndentation(CUR_POS, std::move(*$2));
       delete $2;
   }
-  | path_start PATH_END
+  | path_start PATH_END {
+      $$ = $1;
+      if (state->literalPaths) {
+          auto e = static_cast<ExprPath *>($1);
+          state->literalPaths->emplace_back(e->accessor, CanonPath(e->s));
+      }
+  }
   | path_start string_parts_interpolated PATH_END {
       $2->insert($2->begin(), {state->at(@1), $1});
       $$ = new ExprConcatStrings(CUR_POS, false, $2);
@@ -506,20 +513,21 @@ namespace nix {
 Expr * parseExprFromBuf(
     char * text,
     size_t length,
-    Pos::Origin origin,
+    const PosTable::Origin & origin,
     const SourcePath & basePath,
     SymbolTable & symbols,
     const EvalSettings & settings,
     PosTable & positions,
     DocCommentMap & docComments,
     const ref<SourceAccessor> rootFS,
-    const Expr::AstSymbols & astSymbols)
+    const Expr::AstSymbols & astSymbols,
+    std::vector<SourcePath> * literalPaths)
 {
     yyscan_t scanner;
     LexerState lexerState {
         .positionToDocComment = docComments,
         .positions = positions,
-        .origin = positions.addOrigin(origin, length),
+        .origin = origin,
     };
     ParserState state {
         .lexerState = lexerState,
@@ -530,6 +538,7 @@ Expr * parseExprFromBuf(
         .rootFS = rootFS,
         .s = astSymbols,
         .settings = settings,
+        .literalPaths = literalPaths,
     };
 
     yylex_init_extra(&lexerState, &scanner);
@@ -1,14 +1,25 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
 #include <vector>
 
 #include "pos-idx.hh"
 #include "position.hh"
-#include "sync.hh"
 
 namespace nix {
 
+/**
+ * Maps `PosIdx`es to origins (files, strings, ...) and from there to
+ * line and column numbers.
+ *
+ * Origins may be added by several threads (e.g. when parsing files in
+ * the background). Resolving a position doesn't take any locks.
+ */
 class PosTable
 {
 public:
@@ -35,35 +46,80 @@ public:
 private:
     using Lines = std::vector<uint32_t>;
 
-    std::map<uint32_t, Origin> origins;
-    mutable Sync<std::map<uint32_t, Lines>> lines;
+    /**
+     * An origin and the offsets of its lines, which are computed on
+     * first use.
+     */
+    struct Entry
+    {
+        Origin origin;
+        mutable std::once_flag linesComputed;
+        mutable Lines lines;
+
+        Entry(Origin && origin) : origin(std::move(origin)) {}
+
+        const Lines & getLines() const;
+    };
+
+    /**
+     * A sorted array of the start offsets of the origins, and a
+     * parallel array of the corresponding entries. When it's full, it
+     * is copied into one twice the size. Readers may still be using
+     * the old one, so it's kept until the table is destroyed.
+     */
+    struct Index
+    {
+        size_t capacity;
+        std::unique_ptr<uint32_t[]> offsets;
+        std::unique_ptr<const Entry *[]> entries;
+
+        Index(size_t capacity);
+    };
 
-    const Origin * resolve(PosIdx p) const
+    std::atomic<const Index *> index{nullptr};
+
+    /**
+     * The number of valid elements in `index`. It is increased after
+     * the element has been written (and `index` replaced, if
+     * necessary), so readers that load it before `index` see a
+     * consistent state.
+     */
+    std::atomic<size_t> count{0};
+
+    /**
+     * State that is only used by `addOrigin()`.
+     */
+    std::mutex mutex;
+    uint32_t nextOffset = 0;
+    std::vector<std::unique_ptr<Index>> indexes;
+    std::vector<std::unique_ptr<Entry>> entries;
+
+    const Entry * findEntry(PosIdx p) const
     {
         if (p.id == 0)
             return nullptr;
 
+        auto count = this->count.load(std::memory_order_acquire);
+        if (count == 0)
+            return nullptr;
+        auto index = this->index.load(std::memory_order_acquire);
+
         const auto idx = p.id - 1;
-        /* we want the last key <= idx, so we'll take prev(first key > idx).
-            this is guaranteed to never rewind origin.begin because the first
-            key is always 0. */
-        const auto pastOrigin = origins.upper_bound(idx);
-        return &std::prev(pastOrigin)->second;
+        /* we want the last offset <= idx, so we'll take prev(first offset > idx).
+            this is guaranteed to never rewind to before the start because the first
+            offset is always 0. */
+        auto offsets = index->offsets.get();
+        const auto pastOrigin = std::upper_bound(offsets, offsets + count, idx);
+        return index->entries[pastOrigin - offsets - 1];
     }
 
+    static Pos toPos(const Entry & entry, PosIdx p);
+
 public:
-    Origin addOrigin(Pos::Origin origin, size_t size)
-    {
-        uint32_t offset = 0;
-        if (auto it = origins.rbegin(); it != origins.rend())
-            offset = it->first + it->second.size;
-        // +1 because all PosIdx are offset by 1 to begin with, and
-        // another +1 to ensure that all origins can point to EOF, eg
-        // on (invalid) empty inputs.
-        if (2 + offset + size < offset)
-            return Origin{origin, offset, 0};
-        return origins.emplace(offset, Origin{origin, offset, size}).first->second;
-    }
+    PosTable();
+    ~PosTable();
+
+    Origin addOrigin(Pos::Origin origin, size_t size);
 
     PosIdx add(const Origin & origin, size_t offset)
     {
@@ -74,10 +130,17 @@ public:
 
     Pos operator[](PosIdx p) const;
 
+    /**
+     * Resolve a sequence of positions, e.g. the frames of a stack
+     * trace. This is cheaper than resolving them one by one when
+     * consecutive positions tend to be in the same origin.
+     */
+    std::vector<Pos> resolve(std::span<const PosIdx> ps) const;
+
     Pos::Origin originOf(PosIdx p) const
     {
-        if (auto o = resolve(p))
-            return o->origin;
+        if (auto e = findEntry(p))
+            return e->origin.origin;
         return std::monostate{};
     }
 };
@@ -14,6 +14,9 @@
 #include "value-to-xml.hh"
 #include "primops.hh"
 #include "fetch-to-store.hh"
+#include "std-hash.hh"
+#include "regex.hh"
+#include "lru-cache.hh"
 
 #include <boost/container/small_vector.hpp>
 #include <nlohmann/json.hpp>
@@ -25,7 +28,6 @@
 #include <algorithm>
 #include <cstring>
 #include <sstream>
-#include <regex>
 
 #ifndef _WIN32
 # include <dlfcn.h>
@@ -606,7 +608,7 @@ struct CompareValues
                     // Note: we don't take the accessor into account
                     // since it's not obvious how to compare them in a
                     // reproducible way.
-                    return strcmp(v1->payload.path.path, v2->payload.path.path) < 0;
+                    return strcmp(v1->pathStr(), v2->pathStr()) < 0;
                 case nList:
                     // Lexicographic comparison
                     for (size_t i = 0;; i++) {
@@ -651,6 +653,157 @@ static Bindings::const_iterator getAttr(
     return value;
 }
 
+/**
+ * The set of `key` attributes seen by `builtins.genericClosure`.
+ *
+ * Keys that are numbers, strings, paths or lists of evaluated numbers,
+ * strings and lists are kept in a hash table. `CompareValues` can only fail
+ * on values of different types, so this is only done as long as all
+ * keys have the same "shape" (their type and, recursively, the types
+ * of their list elements). The first key that is not hashable or has
+ * a different shape moves all keys into an ordered set, which from
+ * then on behaves exactly like a plain `std::set`, including the
+ * errors it throws for incomparable keys.
+ */
+class GenericClosureKeys
+{
+    EvalState & state;
+    const CompareValues cmp;
+
+    struct Compare
+    {
+        const GenericClosureKeys & keys;
+
+        bool operator () (Value * v1, Value * v2) const
+        {
+            keys.state.nrGenericClosureKeyComparisons++;
+            return keys.cmp(v1, v2);
+        }
+    };
+
+    /* Neither container needs to be a GC root, because its values are
+       reachable from the result list. */
+    std::unordered_map<size_t, boost::container::small_vector<Value *, 1>> hashed;
+    std::optional<std::set<Value *, Compare>> ordered;
+
+    /**
+     * The shape of the keys in `hashed`.
+     */
+    std::string shape;
+
+    /**
+     * Hash `v` into `h` and append its shape to `shape`. Returns
+     * false if `v` cannot be hashed consistently with `CompareValues`.
+     */
+    bool hash(Value & v, size_t & h, std::string & shape, bool inList)
+    {
+        #pragma GCC diagnostic push
+        #pragma GCC diagnostic ignored "-Wswitch-enum"
+        switch (v.type()) {
+        case nInt:
+        case nFloat: {
+            /* Integers and floats compare equal if they denote the
+               same number. */
+            double d = v.type() == nInt ? (double) v.integer().value : v.fpoint();
+            if (std::isnan(d)) return false;
+            shape += 'n';
+            hash_combine(h, d);
+            return true;
+        }
+        case nString:
+            shape += 's';
+            hash_combine(h, std::string_view(v.c_str()));
+            return true;
+        case nPath:
+            /* Inside lists, paths are compared with `eqValues`, which
+               also takes the accessor into account. */
+            if (inList) return false;
+            shape += 'p';
+            hash_combine(h, std::string_view(v.pathStr()));
+            return true;
+        case nList:
+            shape += '[';
+            /* Unevaluated elements are not hashable, since forcing
+               them could throw where `CompareValues`, which stops
+               at the first difference, would not. */
+            for (auto elem : v.listItems())
+                if (!hash(*elem, h, shape, true)) return false;
+            shape += ']';
+            return true;
+        default:
+            return false;
+        }
+        #pragma GCC diagnostic pop
+    }
+
+    /**
+     * Whether two keys of the same shape are equal.
+     */
+    static bool equal(Value & v1, Value & v2)
+    {
+        #pragma GCC diagnostic push
+        #pragma GCC diagnostic ignored "-Wswitch-enum"
+        switch (v1.type()) {
+        case nInt:
+            return v2.type() == nInt
+                ? v1.integer() == v2.integer()
+                : v1.integer().value == v2.fpoint();
+        case nFloat:
+            return v2.type() == nInt
+                ? v1.fpoint() == v2.integer().value
+                : v1.fpoint() == v2.fpoint();
+        case nString:
+            return strcmp(v1.c_str(), v2.c_str()) == 0;
+        case nPath:
+            return strcmp(v1.pathStr(), v2.pathStr()) == 0;
+        case nList:
+            for (size_t n = 0; n < v1.listSize(); ++n)
+                if (!equal(*v1.listElems()[n], *v2.listElems()[n])) return false;
+            return true;
+        default:
+            unreachable();
+        }
+        #pragma GCC diagnostic pop
+    }
+
+public:
+
+    GenericClosureKeys(EvalState & state)
+        : state(state)
+        , cmp(state, noPos, "while comparing the `key` attributes of two genericClosure elements")
+    { }
+
+    /**
+     * Add a forced key to the set. Returns false if an equal key was
+     * already present.
+     */
+    bool insert(Value * key)
+    {
+        if (!ordered) {
+            size_t h = 0;
+            std::string keyShape;
+            if (hash(*key, h, keyShape, false) && (shape.empty() || shape == keyShape)) {
+                if (shape.empty()) shape = std::move(keyShape);
+                auto & bucket = hashed[h];
+                for (auto v : bucket) {
+                    state.nrGenericClosureKeyComparisons++;
+                    if (equal(*key, *v)) return false;
+                }
+                bucket.push_back(key);
+                return true;
+            }
+
+            ordered.emplace(Compare{*this});
+            for (auto & [_, bucket] : hashed)
+                for (auto v : bucket)
+                    ordered->insert(v);
+            hashed.clear();
+        }
+
+        return ordered->insert(key).second;
+    }
+};
+
 static void prim_genericClosure(EvalState & state, const PosIdx pos, Value * * args, Value & v)
 {
     state.forceAttrs(*args[0], noPos, "while evaluating the first argument passed to builtins.genericClosure");
@@ -677,10 +830,7 @@ static void prim_genericClosure(EvalState & state, const PosIdx pos, Value * * a
        `workSet', adding the result to `workSet', continuing until
        no new elements are found. */
     ValueList res;
-    // `doneKeys' doesn't need to be a GC root, because its values are
-    // reachable from res.
-    auto cmp = CompareValues(state, noPos, "while comparing the `key` attributes of two genericClosure elements");
-    std::set<Value *, decltype(cmp)> doneKeys(cmp);
+    GenericClosureKeys doneKeys(state);
     while (!workSet.empty()) {
         Value * e = *(workSet.begin());
         workSet.pop_front();
@@ -690,7 +840,7 @@ static void prim_genericClosure(EvalState & state, const PosIdx pos, Value * * a
         auto key = getAttr(state, state.sKey, e->attrs(), "in one of the attrsets generated by (or initially passed to) builtins.genericClosure");
         state.forceValue(*key->value, noPos);
 
-        if (!doneKeys.insert(key->value).second) continue;
+        if (!doneKeys.insert(key->value)) continue;
         res.push_back(e);
 
         /* Call the `operator' function with `e' as argument. */
@@ -1190,16 +1340,19 @@ static void derivationStrictInternal(
 {
     checkDerivationName(state, drvName);
 
-    /* Check whether attributes should be passed as a JSON file. */
+    /* Check whether attributes should be passed as a JSON file. If
+       so, the JSON object is written while the attributes are
+       processed, in the same (sorted) order as `nlohmann::json`
+       would. */
     using nlohmann::json;
-    std::optional<json> jsonObject;
+    std::optional<StringSink> jsonObject;
     auto pos = v.determinePos(noPos);
     auto attr = attrs->find(state.sStructuredAttrs);
     if (attr != attrs->end() &&
         state.forceBool(*attr->value, pos,
                         "while evaluating the `__structuredAttrs` "
                         "attribute passed to builtins.derivationStrict"))
-        jsonObject = json::object();
+        jsonObject.emplace("{");
 
     /* Check whether null attributes should be ignored. */
     bool ignoreNulls = false;
@@ -1308,7 +1461,10 @@ static void derivationStrictInternal(
 
                     if (i->name == state.sStructuredAttrs) continue;
 
-                    jsonObject->emplace(key, printValueAsJSON(state, true, *i->value, pos, context));
+                    if (jsonObject->s.size() > 1) jsonObject->s += ',';
+                    jsonObject->s += json(key).dump();
+                    jsonObject->s += ':';
+                    printValueAsJSON(state, true, *i->value, pos, *jsonObject, context);
 
                     if (i->name == state.sBuilder)
                         drv.builder = state.forceString(*i->value, context, pos, context_below);
@@ -1365,7 +1521,8 @@ static void derivationStrictInternal(
     }
 
     if (jsonObject) {
-        drv.env.emplace("__json", jsonObject->dump());
+        jsonObject->s += '}';
+        drv.env.emplace("__json", std::move(jsonObject->s));
         jsonObject.reset();
     }
 
@@ -2238,10 +2395,10 @@ static RegisterPrimOp primop_toXML({
    represented (e.g., functions). */
 static void prim_toJSON(EvalState & state, const PosIdx pos, Value * * args, Value & v)
 {
-    std::ostringstream out;
+    StringSink out;
     NixStringContext context;
     printValueAsJSON(state, true, *args[0], pos, out, context);
-    v.mkString(out.str(), context);
+    v.mkString(out.s, context);
 }
 
 static RegisterPrimOp primop_toJSON({
@@ -3059,13 +3216,13 @@ static void prim_functionArgs(EvalState & state, const PosIdx pos, Value * * arg
     if (!args[0]->isLambda())
         state.error<TypeError>("'functionArgs' requires a function").atPos(pos).debugThrow();
 
-    if (!args[0]->payload.lambda.fun->hasFormals()) {
+    if (!args[0]->lambda().fun->hasFormals()) {
         v.mkAttrs(&state.emptyBindings);
         return;
     }
 
-    auto attrs = state.buildBindings(args[0]->payload.lambda.fun->formals->formals.size());
-    for (auto & i : args[0]->payload.lambda.fun->formals->formals)
+    auto attrs = state.buildBindings(args[0]->lambda().fun->formals->formals.size());
+    for (auto & i : args[0]->lambda().fun->formals->formals)
         attrs.insert(i.name, state.getBool(i.def), i.pos);
     v.mkAttrs(attrs);
 }
@@ -4224,23 +4381,25 @@ static RegisterPrimOp primop_convertHash({
 
 struct RegexCache
 {
-    struct State
-    {
-        // TODO use C++20 transparent comparison when available
-        std::unordered_map<std::string_view, std::regex> cache;
-        std::list<std::string> keys;
-    };
+    /**
+     * The maximum number of compiled regular expressions to keep.
+     * Patterns may be computed at evaluation time (e.g. from file
+     * names), so the cache needs to be bounded.
+     */
+    static constexpr size_t capacity = 4096;
 
-    Sync<State> state_;
+    Sync<LRUCache<std::string, std::shared_ptr<const Regex>>> cache{LRUCache<std::string, std::shared_ptr<const Regex>>(capacity)};
 
-    std::regex get(std::string_view re)
+    std::shared_ptr<const Regex> get(std::string_view re)
     {
-        auto state(state_.lock());
-        auto it = state->cache.find(re);
-        if (it != state->cache.end())
-            return it->second;
-        state->keys.emplace_back(re);
-        return state->cache.emplace(state->keys.back(), std::regex(state->keys.back(), std::regex::extended)).first->second;
+        std::string key(re);
+        if (auto regex = cache.lock()->get(key))
+            return *regex;
+        /* Compile outside of the lock. If another thread compiles the
+           same pattern at the same time, one of them is discarded. */
+        auto regex = std::make_shared<const Regex>(re);
+        cache.lock()->upsert(key, regex);
+        return regex;
     }
 };
 
@@ -4249,43 +4408,46 @@ std::shared_ptr<RegexCache> makeRegexCache()
     return std::make_shared<RegexCache>();
 }
 
+[[noreturn]] static void throwRegexError(EvalState & state, const PosIdx pos, std::string_view re, RegexError & e)
+{
+    if (dynamic_cast<RegexTooLargeError *>(&e))
+        state.error<EvalError>("memory limit exceeded by regular expression '%s'", re)
+            .atPos(pos)
+            .debugThrow();
+    else
+        state.error<EvalError>("invalid regular expression '%s'", re)
+            .atPos(pos)
+            .debugThrow();
+}
+
 void prim_match(EvalState & state, const PosIdx pos, Value * * args, Value & v)
 {
     auto re = state.forceStringNoCtx(*args[0], pos, "while evaluating the first argument passed to builtins.match");
 
+    std::shared_ptr<const Regex> regex;
     try {
+        regex = state.regexCache->get(re);
+    } catch (RegexError & e) {
+        throwRegexError(state, pos, re, e);
+    }
 
-        auto regex = state.regexCache->get(re);
-
-        NixStringContext context;
-        const auto str = state.forceString(*args[1], context, pos, "while evaluating the second argument passed to builtins.match");
-
-        std::cmatch match;
-        if (!std::regex_match(str.begin(), str.end(), match, regex)) {
-            v.mkNull();
-            return;
-        }
-
-        // the first match is the whole string
-        auto list = state.buildList(match.size() - 1);
-        for (const auto & [i, v2] : enumerate(list))
-            if (!match[i + 1].matched)
-                v2 = &state.vNull;
-            else
-                (v2 = state.allocValue())->mkString(match[i + 1].str());
-        v.mkList(list);
+    NixStringContext context;
+    const auto str = state.forceString(*args[1], context, pos, "while evaluating the second argument passed to builtins.match");
 
-    } catch (std::regex_error & e) {
-        if (e.code() == std::regex_constants::error_space) {
-            // limit is _GLIBCXX_REGEX_STATE_LIMIT for libstdc++
-            state.error<EvalError>("memory limit exceeded by regular expression '%s'", re)
-                .atPos(pos)
-                .debugThrow();
-        } else
-            state.error<EvalError>("invalid regular expression '%s'", re)
-                .atPos(pos)
-                .debugThrow();
+    auto match = regex->match(str);
+    if (!match) {
+        v.mkNull();
+        return;
     }
+
+    // the first match is the whole string
+    auto list = state.buildList(match->size() - 1);
+    for (const auto & [i, v2] : enumerate(list))
+        if (auto group = (*match)[i + 1])
+            (v2 = state.allocValue())->mkString(*group);
+        else
+            v2 = &state.vNull;
+    v.mkList(list);
 }
 
 static RegisterPrimOp primop_match({
@@ -4330,68 +4492,60 @@ void prim_split(EvalState & state, const PosIdx pos, Value * * args, Value & v)
 {
     auto re = state.forceStringNoCtx(*args[0], pos, "while evaluating the first argument passed to builtins.split");
 
+    std::shared_ptr<const Regex> regex;
     try {
+        regex = state.regexCache->get(re);
+    } catch (RegexError & e) {
+        throwRegexError(state, pos, re, e);
+    }
 
-        auto regex = state.regexCache->get(re);
+    NixStringContext context;
+    const auto str = state.forceString(*args[1], context, pos, "while evaluating the second argument passed to builtins.split");
 
-        NixStringContext context;
-        const auto str = state.forceString(*args[1], context, pos, "while evaluating the second argument passed to builtins.split");
+    auto matches = regex->searchAll(str);
 
-        auto begin = std::cregex_iterator(str.begin(), str.end(), regex);
-        auto end = std::cregex_iterator();
+    // Any matches results are surrounded by non-matching results.
+    const size_t len = matches.size();
+    auto list = state.buildList(2 * len + 1);
+    size_t idx = 0;
 
-        // Any matches results are surrounded by non-matching results.
-        const size_t len = std::distance(begin, end);
-        auto list = state.buildList(2 * len + 1);
-        size_t idx = 0;
+    if (len == 0) {
+        list[0] = args[1];
+        v.mkList(list);
+        return;
+    }
 
-        if (len == 0) {
-            list[0] = args[1];
-            v.mkList(list);
-            return;
-        }
+    size_t prevEnd = 0;
 
-        for (auto i = begin; i != end; ++i) {
-            assert(idx <= 2 * len + 1 - 3);
-            auto match = *i;
+    for (auto & match : matches) {
+        assert(idx <= 2 * len + 1 - 3);
 
-            // Add a string for non-matched characters.
-            (list[idx++] = state.allocValue())->mkString(match.prefix().str());
+        // Add a string for non-matched characters.
+        (list[idx++] = state.allocValue())->mkString(str.substr(prevEnd, match.start() - prevEnd));
 
-            // Add a list for matched substrings.
-            const size_t slen = match.size() - 1;
+        // Add a list for matched substrings.
+        const size_t slen = match.size() - 1;
 
-            // Start at 1, beacause the first match is the whole string.
-            auto list2 = state.buildList(slen);
-            for (const auto & [si, v2] : enumerate(list2)) {
-                if (!match[si + 1].matched)
-                    v2 = &state.vNull;
-                else
-                    (v2 = state.allocValue())->mkString(match[si + 1].str());
-            }
+        // Start at 1, beacause the first match is the whole string.
+        auto list2 = state.buildList(slen);
+        for (const auto & [si, v2] : enumerate(list2)) {
+            if (auto group = match[si + 1])
+                (v2 = state.allocValue())->mkString(*group);
+            else
+                v2 = &state.vNull;
+        }
 
-            (list[idx++] = state.allocValue())->mkList(list2);
+        (list[idx++] = state.allocValue())->mkList(list2);
 
-            // Add a string for non-matched suffix characters.
-            if (idx == 2 * len)
-                (list[idx++] = state.allocValue())->mkString(match.suffix().str());
-        }
+        prevEnd = match.end();
+    }
 
-        assert(idx == 2 * len + 1);
+    // Add a string for non-matched suffix characters.
+    (list[idx++] = state.allocValue())->mkString(str.substr(prevEnd));
 
-        v.mkList(list);
+    assert(idx == 2 * len + 1);
 
-    } catch (std::regex_error & e) {
-        if (e.code() == std::regex_constants::error_space) {
-            // limit is _GLIBCXX_REGEX_STATE_LIMIT for libstdc++
-            state.error<EvalError>("memory limit exceeded by regular expression '%s'", re)
-                .atPos(pos)
-                .debugThrow();
-        } else
-            state.error<EvalError>("invalid regular expression '%s'", re)
-                .atPos(pos)
-                .debugThrow();
-    }
+    v.mkList(list);
 }
 
 static RegisterPrimOp primop_split({
@@ -4438,16 +4592,36 @@ static void prim_concatStringsSep(EvalState & state, const PosIdx pos, Value * *
     auto sep = state.forceString(*args[0], context, pos, "while evaluating the first argument (the separator string) passed to builtins.concatStringsSep");
     state.forceList(*args[1], pos, "while evaluating the second argument (the list of strings to concat) passed to builtins.concatStringsSep");
 
-    std::string res;
-    res.reserve((args[1]->listSize() + 32) * sep.size());
-    bool first = true;
+    /* Coerce all elements first, so that the result can be written
+       directly into a string of the final size. This matters for
+       large lists, e.g. from `lib.concatMapStrings`. */
+    std::vector<BackedStringView> parts;
+    parts.reserve(args[1]->listSize());
+    size_t size = 0;
 
     for (auto elem : args[1]->listItems()) {
-        if (first) first = false; else res += sep;
-        res += *state.coerceToString(pos, *elem, context, "while evaluating one element of the list of strings to concat passed to builtins.concatStringsSep");
+        auto & part = parts.emplace_back(state.coerceToString(pos, *elem, context, "while evaluating one element of the list of strings to concat passed to builtins.concatStringsSep"));
+        size += part->size();
     }
 
-    v.mkString(res, context);
+    if (!parts.empty())
+        size += (parts.size() - 1) * sep.size();
+
+    char * res = allocString(size + 1);
+    char * p = res;
+    bool first = true;
+
+    for (auto & part : parts) {
+        if (first) first = false; else {
+            memcpy(p, sep.data(), sep.size());
+            p += sep.size();
+        }
+        memcpy(p, part->data(), part->size());
+        p += part->size();
+    }
+    *p = 0;
+
+    v.mkStringMove(res, context);
 }
 
 static RegisterPrimOp primop_concatStringsSep({
@@ -4905,7 +5079,7 @@ void EvalState::createBaseEnv()
 
     /* Now that we've added all primops, sort the `builtins' set,
        because attribute lookups expect it to be sorted. */
-    baseEnv.values[0]->payload.attrs->sort();
+    const_cast<Bindings *>(baseEnv.values[0]->attrs())->sort();
 
     staticBaseEnv->sort();
 
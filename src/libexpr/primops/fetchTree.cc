@@ -132,7 +132,9 @@ static void fetchTree(
                 attrs.emplace(state.symbols[attr.name], uint64_t(intValue));
             } else if (state.symbols[attr.name] == "publicKeys") {
                 experimentalFeatureSettings.require(Xp::VerifiedFetches);
-                attrs.emplace(state.symbols[attr.name], printValueAsJSON(state, true, *attr.value, pos, context).dump());
+                StringSink publicKeys;
+                printValueAsJSON(state, true, *attr.value, pos, publicKeys, context);
+                attrs.emplace(state.symbols[attr.name], std::move(publicKeys.s));
             }
             else
                 state.error<TypeError>("fetchTree argument '%s' is %s while a string, Boolean or integer is expected",
@@ -1,12 +1,13 @@
 #pragma once
 ///@file
 
-#include <list>
-#include <map>
-#include <unordered_map>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <mutex>
 
 #include "types.hh"
-#include "chunked-vector.hh"
 #include "error.hh"
 
 namespace nix {
@@ -77,15 +78,111 @@ public:
 /**
  * Symbol table used by the parser and evaluator to represent and look
  * up identifiers and attributes efficiently.
+ *
+ * `create()` and `operator[]` may be called concurrently from several
+ * threads. Looking up an existing symbol doesn't take any locks.
  */
 class SymbolTable
 {
 private:
-    std::unordered_map<std::string_view, std::pair<const std::string *, uint32_t>> symbols;
-    ChunkedVector<std::string, 8192> store{16};
+    /**
+     * The symbols, indexed by ID minus one, are stored in chunks that
+     * double in size. This way, existing symbols never move, and
+     * finding a symbol doesn't need any synchronisation.
+     */
+    static constexpr size_t firstChunkSize = 1024;
+    static constexpr size_t maxChunks = 23;
+
+    std::array<std::atomic<std::string *>, maxChunks> chunks{};
+
+    /**
+     * The number of symbol IDs handed out.
+     */
+    std::atomic<uint32_t> nextIdx{0};
+
+    /**
+     * An open-addressing hash table. Each slot contains the upper half
+     * of the hash of a symbol and its ID, or 0 if it's empty. Slots
+     * are never changed after they have been filled, so readers don't
+     * need a lock.
+     */
+    struct Table
+    {
+        size_t mask;
+        std::unique_ptr<std::atomic<uint64_t>[]> slots;
+
+        Table(size_t size);
+    };
+
+    /**
+     * The symbols are distributed over a number of shards, each with
+     * its own table and a lock that is only taken to add a symbol.
+     */
+    struct alignas(64) Shard
+    {
+        std::atomic<const Table *> table;
+        std::mutex mutex;
+        size_t count = 0;
+        /**
+         * The current table and the ones it replaced, which concurrent
+         * readers may still be using.
+         */
+        std::vector<std::unique_ptr<Table>> tables;
+    };
+
+    static constexpr size_t nrShards = 32;
+
+    std::array<Shard, nrShards> shards;
+
+    static std::pair<size_t, size_t> locate(uint32_t idx)
+    {
+        size_t chunk = std::bit_width(idx / firstChunkSize + 1) - 1;
+        return {chunk, idx - firstChunkSize * ((size_t(1) << chunk) - 1)};
+    }
+
+    const std::string & get(uint32_t idx) const
+    {
+        auto [chunk, offset] = locate(idx);
+        return chunks[chunk].load(std::memory_order_acquire)[offset];
+    }
+
+    /**
+     * Return the ID of `s` in `table`, or 0 if it's not there.
+     */
+    uint32_t lookup(const Table & table, uint64_t hash, std::string_view s) const
+    {
+        uint32_t tag = hash >> 32;
+        for (size_t i = tag; ; ++i) {
+            auto entry = table.slots[i & table.mask].load(std::memory_order_acquire);
+            if (!entry) return 0;
+            if (entry >> 32 == tag && get(uint32_t(entry) - 1) == s)
+                return uint32_t(entry);
+        }
+    }
+
+    Symbol add(Shard & shard, uint64_t hash, std::string_view s);
 
 public:
 
+    SymbolTable();
+
+    ~SymbolTable();
+
+    /**
+     * Widen a hash as returned by `std::hash` to 64 bits, since table
+     * slots store its upper half. Where `size_t` has only 32 bits, the
+     * upper half is mixed from all of its bits; the lower bits, which
+     * select the shard, still depend only on the lower bits of `hash`.
+     */
+    template<typename H>
+    static constexpr uint64_t widenHash(H hash)
+    {
+        if constexpr (sizeof(H) >= sizeof(uint64_t))
+            return hash;
+        else
+            return uint64_t(hash) * 0x9e3779b97f4a7c15;
+    }
+
     /**
      * converts a string into a symbol.
      */
@@ -93,15 +190,11 @@ public:
     {
         // Most symbols are looked up more than once, so we trade off insertion performance
         // for lookup performance.
-        // TODO: could probably be done more efficiently with transparent Hash and Equals
-        // on the original implementation using unordered_set
-        // FIXME: make this thread-safe.
-        auto it = symbols.find(s);
-        if (it != symbols.end()) return Symbol(it->second.second + 1);
-
-        const auto & [rawSym, idx] = store.add(std::string(s));
-        symbols.emplace(rawSym, std::make_pair(&rawSym, idx));
-        return Symbol(idx + 1);
+        auto hash = widenHash(std::hash<std::string_view>{}(s));
+        auto & shard = shards[hash % nrShards];
+        if (auto id = lookup(*shard.table.load(std::memory_order_acquire), hash, s))
+            return Symbol(id);
+        return add(shard, hash, s);
     }
 
     std::vector<SymbolStr> resolve(const std::vector<Symbol> & symbols) const
@@ -115,25 +208,33 @@ public:
 
     SymbolStr operator[](Symbol s) const
     {
-        if (s.id == 0 || s.id > store.size())
+        if (s.id == 0 || s.id > size())
             unreachable();
-        return SymbolStr(store[s.id - 1]);
+        return SymbolStr(get(s.id - 1));
     }
 
     size_t size() const
     {
-        return store.size();
+        return nextIdx.load(std::memory_order_acquire);
     }
 
     size_t totalSize() const;
 
+    /**
+     * Call `callback` on every symbol. This must not be called
+     * concurrently with `create()`.
+     */
     template<typename T>
     void dump(T callback) const
     {
-        store.forEach(callback);
+        for (uint32_t idx = 0; idx < size(); ++idx)
+            callback(get(idx));
     }
 };
 
+/* The upper halves of 32-bit hashes must be usable as tags too. */
+static_assert(SymbolTable::widenHash(uint32_t(1)) >> 32 != 0);
+
 }
 
 template<>
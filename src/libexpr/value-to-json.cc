@@ -2,6 +2,7 @@
 #include "eval-inline.hh"
 #include "store-api.hh"
 #include "signals.hh"
+#include "serialise.hh"
 
 #include <cstdlib>
 #include <iomanip>
@@ -10,71 +11,124 @@
 
 namespace nix {
 using json = nlohmann::json;
-json printValueAsJSON(EvalState & state, bool strict,
-    Value & v, const PosIdx pos, NixStringContext & context, bool copyToStore)
+namespace {
+
+/**
+ * Writes the JSON representation of a value while traversing it, so
+ * that neither a `nlohmann::json` tree nor the complete output has to
+ * be kept in memory.
+ */
+struct JSONWriter
+{
+    EvalState & state;
+    bool strict;
+    NixStringContext & context;
+    bool copyToStore;
+    Sink & sink;
+
+    /**
+     * Output that hasn't been passed to `sink` yet.
+     */
+    std::string buf;
+
+    static constexpr size_t bufSize = 64 * 1024;
+
+    void write(std::string_view s)
+    {
+        buf.append(s);
+        if (buf.size() >= bufSize) flush();
+    }
+
+    void flush()
+    {
+        sink(buf);
+        buf.clear();
+    }
+
+    void writeString(std::string_view s)
+    {
+        /* Strings that need neither escaping nor UTF-8 validation are
+           by far the most common case. */
+        for (unsigned char c : s)
+            if (c < 0x20 || c >= 0x80 || c == '"' || c == '\\') {
+                write(json(s).dump());
+                return;
+            }
+        buf += '"';
+        write(s);
+        buf += '"';
+    }
+
+    void print(Value & v, const PosIdx pos);
+};
+
+void JSONWriter::print(Value & v, const PosIdx pos)
 {
     checkInterrupt();
 
     if (strict) state.forceValue(v, pos);
 
-    json out;
-
     switch (v.type()) {
 
         case nInt:
-            out = v.integer().value;
+            write(std::to_string(v.integer().value));
             break;
 
         case nBool:
-            out = v.boolean();
+            write(v.boolean() ? "true" : "false");
             break;
 
         case nString:
             copyContext(v, context);
-            out = v.c_str();
+            writeString(v.string_view());
             break;
 
         case nPath:
             if (copyToStore)
-                out = state.store->printStorePath(
-                    state.copyPathToStore(context, v.path()));
+                writeString(state.store->printStorePath(
+                    state.copyPathToStore(context, v.path())));
             else
-                out = v.path().path.abs();
+                writeString(v.path().path.abs());
             break;
 
         case nNull:
-            // already initialized as null
+            write("null");
             break;
 
         case nAttrs: {
             auto maybeString = state.tryAttrsToString(pos, v, context, false, false);
             if (maybeString) {
-                out = *maybeString;
+                writeString(*maybeString);
                 break;
             }
             if (auto i = v.attrs()->get(state.sOutPath))
-                return printValueAsJSON(state, strict, *i->value, i->pos, context, copyToStore);
-            else {
-                out = json::object();
-                for (auto & a : v.attrs()->lexicographicOrder(state.symbols)) {
-                    try {
-                        out.emplace(state.symbols[a->name], printValueAsJSON(state, strict, *a->value, a->pos, context, copyToStore));
-                    } catch (Error & e) {
-                        e.addTrace(state.positions[a->pos],
-                            HintFmt("while evaluating attribute '%1%'", state.symbols[a->name]));
-                        throw;
-                    }
+                return print(*i->value, i->pos);
+            write("{");
+            bool first = true;
+            for (auto & a : v.attrs()->lexicographicOrder(state.symbols)) {
+                if (!first) write(",");
+                first = false;
+                writeString(state.symbols[a->name]);
+                write(":");
+                try {
+                    print(*a->value, a->pos);
+                } catch (Error & e) {
+                    e.addTrace(state.positions[a->pos],
+                        HintFmt("while evaluating attribute '%1%'", state.symbols[a->name]));
+                    throw;
                 }
             }
+            write("}");
             break;
         }
 
         case nList: {
-            out = json::array();
+            write("[");
             int i = 0;
             for (auto elem : v.listItems()) {
+                if (i) write(",");
                 try {
-                    out.push_back(printValueAsJSON(state, strict, *elem, pos, context, copyToStore));
+                    print(*elem, pos);
                 } catch (Error & e) {
                     e.addTrace(state.positions[pos],
                         HintFmt("while evaluating list element at index %1%", i));
@@ -82,15 +136,16 @@ json printValueAsJSON(EvalState & state, bool strict,
                 }
                 i++;
             }
+            write("]");
             break;
         }
 
         case nExternal:
-            return v.external()->printValueAsJSON(state, strict, context, copyToStore);
+            write(v.external()->printValueAsJSON(state, strict, context, copyToStore).dump());
             break;
 
         case nFloat:
-            out = v.fpoint();
+            write(json(v.fpoint()).dump());
             break;
 
         case nThunk:
@@ -102,13 +157,32 @@ json printValueAsJSON(EvalState & state, bool strict,
             .atPos(v.determinePos(pos))
             .debugThrow();
     }
-    return out;
+}
+
+}
+
+void printValueAsJSON(EvalState & state, bool strict,
+    Value & v, const PosIdx pos, Sink & sink, NixStringContext & context, bool copyToStore)
+{
+    JSONWriter writer{state, strict, context, copyToStore, sink};
+    writer.print(v, pos);
+    writer.flush();
 }
 
 void printValueAsJSON(EvalState & state, bool strict,
     Value & v, const PosIdx pos, std::ostream & str, NixStringContext & context, bool copyToStore)
 {
-    str << printValueAsJSON(state, strict, v, pos, context, copyToStore);
+    StringSink sink;
+    printValueAsJSON(state, strict, v, pos, sink, context, copyToStore);
+    str << sink.s;
+}
+
+json printValueAsJSON(EvalState & state, bool strict,
+    Value & v, const PosIdx pos, NixStringContext & context, bool copyToStore)
+{
+    StringSink sink;
+    printValueAsJSON(state, strict, v, pos, sink, context, copyToStore);
+    return json::parse(sink.s);
 }
 
 json ExternalValueBase::printValueAsJSON(EvalState & state, bool strict,
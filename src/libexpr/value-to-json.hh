@@ -10,9 +10,29 @@
 
 namespace nix {
 
+struct Sink;
+
+/**
+ * Convert `v` to a JSON document. This parses the output of the
+ * `Sink` variant below, so prefer that one when the result is only
+ * going to be printed.
+ */
 nlohmann::json printValueAsJSON(EvalState & state, bool strict,
     Value & v, const PosIdx pos, NixStringContext & context, bool copyToStore = true);
 
+/**
+ * Write the JSON representation of `v` to `sink`, forcing and emitting
+ * values as they are reached instead of building the whole document in
+ * memory first. If evaluation fails, `sink` may have received part of
+ * the output.
+ */
+void printValueAsJSON(EvalState & state, bool strict,
+    Value & v, const PosIdx pos, Sink & sink, NixStringContext & context, bool copyToStore = true);
+
+/**
+ * Write the JSON representation of `v` to `str`. Nothing is written
+ * if evaluation fails.
+ */
 void printValueAsJSON(EvalState & state, bool strict,
     Value & v, const PosIdx pos, std::ostream & str, NixStringContext & context, bool copyToStore = true);
 
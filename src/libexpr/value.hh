@@ -1,8 +1,11 @@
 #pragma once
 ///@file
 
+#include <bit>
 #include <cassert>
+#include <cstdint>
 #include <span>
+#include <type_traits>
 
 #include "symbol-table.hh"
 #include "value/context.hh"
@@ -163,31 +166,14 @@ public:
 };
 
 
-struct Value
-{
-private:
-    InternalType internalType = tUninitialized;
-
-    friend std::string showType(const Value & v);
-
-public:
-
-    void print(EvalState &state, std::ostream &str, PrintOptions options = PrintOptions {});
-
-    // Functions needed to distinguish the type
-    // These should be removed eventually, by putting the functionality that's
-    // needed by callers into methods of this type
-
-    // type() == nThunk
-    inline bool isThunk() const { return internalType == tThunk; };
-    inline bool isApp() const { return internalType == tApp; };
-    inline bool isBlackhole() const;
-
-    // type() == nFunction
-    inline bool isLambda() const { return internalType == tLambda; };
-    inline bool isPrimOp() const { return internalType == tPrimOp; };
-    inline bool isPrimOpApp() const { return internalType == tPrimOpApp; };
+namespace detail {
 
+/**
+ * The payload types of `Value`, shared by all `ValueStorage`
+ * implementations.
+ */
+struct ValueBase
+{
     /**
      * Strings in the evaluator carry a so-called `context` which
      * is a list of strings representing store paths.  This is to
@@ -233,7 +219,17 @@ public:
         Env * env;
         ExprLambda * fun;
     };
+};
 
+/**
+ * The representation of a `Value`. The generic implementation stores
+ * the type next to a union of all payloads; see below for a more
+ * compact one on 64-bit platforms. Both provide the same protected
+ * interface to `Value`.
+ */
+template<std::size_t ptrSize, typename Enable = void>
+class ValueStorage : public ValueBase
+{
     using Payload = union
     {
         NixInt integer;
@@ -258,8 +254,268 @@ public:
         NixFloat fpoint;
     };
 
+    InternalType internalType = tUninitialized;
     Payload payload;
 
+    void finishValue(InternalType newType, Payload newPayload)
+    {
+        payload = newPayload;
+        internalType = newType;
+    }
+
+public:
+
+    InternalType getInternalType() const
+    { return internalType; }
+
+protected:
+
+    NixInt getInt() const { return payload.integer; }
+    bool getBool() const { return payload.boolean; }
+    NixFloat getFloat() const { return payload.fpoint; }
+    Bindings * getAttrs() const { return payload.attrs; }
+    PrimOp * getPrimOp() const { return payload.primOp; }
+    ExternalValueBase * getExternal() const { return payload.external; }
+    StringWithContext getString() const { return payload.string; }
+    Path getPath() const { return payload.path; }
+    ClosureThunk getThunk() const { return payload.thunk; }
+    FunctionApplicationThunk getApp() const { return payload.app; }
+    Lambda getLambda() const { return payload.lambda; }
+    FunctionApplicationThunk getPrimOpApp() const { return payload.primOpApp; }
+
+    Value * const * getListElems() const
+    {
+        return internalType == tList1 || internalType == tList2 ? payload.smallList : payload.bigList.elems;
+    }
+
+    size_t getListSize() const
+    {
+        return internalType == tList1 ? 1 : internalType == tList2 ? 2 : payload.bigList.size;
+    }
+
+    void setInt(NixInt n) { finishValue(tInt, { .integer = n }); }
+    void setBool(bool b) { finishValue(tBool, { .boolean = b }); }
+    void setFloat(NixFloat n) { finishValue(tFloat, { .fpoint = n }); }
+    void setNull() { finishValue(tNull, {}); }
+    void setAttrs(Bindings * a) { finishValue(tAttrs, { .attrs = a }); }
+    void setPrimOp(PrimOp * p) { finishValue(tPrimOp, { .primOp = p }); }
+    void setExternal(ExternalValueBase * e) { finishValue(tExternal, { .external = e }); }
+
+    void setString(const char * s, const char * * context)
+    { finishValue(tString, { .string = { .c_str = s, .context = context } }); }
+
+    void setPath(SourceAccessor * accessor, const char * path)
+    { finishValue(tPath, { .path = { .accessor = accessor, .path = path } }); }
+
+    void setThunk(Env * e, Expr * ex)
+    { finishValue(tThunk, { .thunk = { .env = e, .expr = ex } }); }
+
+    void setApp(Value * l, Value * r)
+    { finishValue(tApp, { .app = { .left = l, .right = r } }); }
+
+    void setLambda(Env * e, ExprLambda * f)
+    { finishValue(tLambda, { .lambda = { .env = e, .fun = f } }); }
+
+    void setPrimOpApp(Value * l, Value * r)
+    { finishValue(tPrimOpApp, { .primOpApp = { .left = l, .right = r } }); }
+
+    void setList1(Value * v)
+    { finishValue(tList1, { .smallList = { v } }); }
+
+    void setList2(Value * v1, Value * v2)
+    { finishValue(tList2, { .smallList = { v1, v2 } }); }
+
+    void setListN(size_t size, Value * const * elems)
+    { finishValue(tListN, { .bigList = { .size = size, .elems = elems } }); }
+};
+
+/**
+ * A 16-byte representation for 64-bit platforms, which stores the type
+ * in the alignment bits of the first word instead of in a separate
+ * field.
+ *
+ * The low 3 bits of the first word (the "primary discriminator")
+ * select the layout:
+ *
+ * - `pdSingle`: the first word is the `InternalType` shifted left by
+ *   3 bits, and the second word is the payload, if any. As an
+ *   exception, if the first word is too large to be such a type, the
+ *   value is a `tList2`, and both words are the (untagged) elements.
+ *
+ * - `pdListN`: the first word is the size shifted left by 3 bits, and
+ *   the second word points to the elements.
+ *
+ * - Otherwise, the first word is an 8-byte aligned pointer or'ed with
+ *   the discriminator, and the second word is another pointer.
+ *
+ * Tagged pointers point a few bytes into an object, so the garbage
+ * collector must accept such displacements (see `initGC()`).
+ */
+template<std::size_t ptrSize>
+class ValueStorage<ptrSize, std::enable_if_t<ptrSize == sizeof(uint64_t)>> : public ValueBase
+{
+    enum PrimaryDiscriminator : uintptr_t {
+        pdSingle = 0,
+        pdListN,
+        pdString,
+        pdPath,
+        pdThunk,
+        pdLambda,
+        pdApp,
+        pdPrimOpApp,
+    };
+
+    static constexpr uintptr_t discriminatorMask = 7;
+
+    /**
+     * Pointers are never in the first page, so a first word below
+     * this is a type rather than an element of a `tList2`.
+     */
+    static constexpr uintptr_t maxSingle = 4096;
+    static_assert((uintptr_t(tFloat) << 3) < maxSingle);
+
+    union {
+        uintptr_t words[2] = {0, 0};
+        Value * elems[2];
+    };
+
+    PrimaryDiscriminator getDiscriminator() const
+    { return PrimaryDiscriminator(words[0] & discriminatorMask); }
+
+    template<typename T>
+    T untag() const
+    { return reinterpret_cast<T>(words[0] & ~discriminatorMask); }
+
+    template<typename T>
+    T second() const
+    { return reinterpret_cast<T>(words[1]); }
+
+    void setSingle(InternalType type, uintptr_t payload)
+    {
+        words[0] = uintptr_t(type) << 3;
+        words[1] = payload;
+    }
+
+    void setTagged(PrimaryDiscriminator pd, const void * p1, const void * p2)
+    {
+        words[0] = reinterpret_cast<uintptr_t>(p1) | pd;
+        words[1] = reinterpret_cast<uintptr_t>(p2);
+    }
+
+public:
+
+    InternalType getInternalType() const
+    {
+        switch (getDiscriminator()) {
+            case pdSingle: return words[0] < maxSingle ? InternalType(words[0] >> 3) : tList2;
+            case pdListN: return tListN;
+            case pdString: return tString;
+            case pdPath: return tPath;
+            case pdThunk: return tThunk;
+            case pdLambda: return tLambda;
+            case pdApp: return tApp;
+            case pdPrimOpApp: return tPrimOpApp;
+        }
+        unreachable();
+    }
+
+protected:
+
+    NixInt getInt() const { return NixInt(std::bit_cast<NixInt::Inner>(words[1])); }
+    bool getBool() const { return words[1]; }
+    NixFloat getFloat() const { return std::bit_cast<NixFloat>(words[1]); }
+    Bindings * getAttrs() const { return second<Bindings *>(); }
+    PrimOp * getPrimOp() const { return second<PrimOp *>(); }
+    ExternalValueBase * getExternal() const { return second<ExternalValueBase *>(); }
+
+    StringWithContext getString() const
+    { return { .c_str = second<const char *>(), .context = untag<const char * *>() }; }
+
+    Path getPath() const
+    { return { .accessor = untag<SourceAccessor *>(), .path = second<const char *>() }; }
+
+    ClosureThunk getThunk() const
+    { return { .env = untag<Env *>(), .expr = second<Expr *>() }; }
+
+    FunctionApplicationThunk getApp() const
+    { return { .left = untag<Value *>(), .right = second<Value *>() }; }
+
+    Lambda getLambda() const
+    { return { .env = untag<Env *>(), .fun = second<ExprLambda *>() }; }
+
+    FunctionApplicationThunk getPrimOpApp() const
+    { return { .left = untag<Value *>(), .right = second<Value *>() }; }
+
+    Value * const * getListElems() const
+    {
+        if (getDiscriminator() == pdListN) return second<Value * const *>();
+        /* A `tList1` stores its element in the second word. */
+        return words[0] < maxSingle ? &elems[1] : &elems[0];
+    }
+
+    size_t getListSize() const
+    {
+        if (getDiscriminator() == pdListN) return words[0] >> 3;
+        return words[0] < maxSingle ? 1 : 2;
+    }
+
+    void setInt(NixInt n) { setSingle(tInt, std::bit_cast<uintptr_t>(n.value)); }
+    void setBool(bool b) { setSingle(tBool, b); }
+    void setFloat(NixFloat n) { setSingle(tFloat, std::bit_cast<uintptr_t>(n)); }
+    void setNull() { setSingle(tNull, 0); }
+    void setAttrs(Bindings * a) { setSingle(tAttrs, reinterpret_cast<uintptr_t>(a)); }
+    void setPrimOp(PrimOp * p) { setSingle(tPrimOp, reinterpret_cast<uintptr_t>(p)); }
+    void setExternal(ExternalValueBase * e) { setSingle(tExternal, reinterpret_cast<uintptr_t>(e)); }
+
+    void setString(const char * s, const char * * context) { setTagged(pdString, context, s); }
+    void setPath(SourceAccessor * accessor, const char * path) { setTagged(pdPath, accessor, path); }
+    void setThunk(Env * e, Expr * ex) { setTagged(pdThunk, e, ex); }
+    void setApp(Value * l, Value * r) { setTagged(pdApp, l, r); }
+    void setLambda(Env * e, ExprLambda * f) { setTagged(pdLambda, e, f); }
+    void setPrimOpApp(Value * l, Value * r) { setTagged(pdPrimOpApp, l, r); }
+
+    void setList1(Value * v)
+    {
+        words[0] = uintptr_t(tList1) << 3;
+        elems[1] = v;
+    }
+
+    void setList2(Value * v1, Value * v2)
+    {
+        elems[0] = v1;
+        elems[1] = v2;
+    }
+
+    void setListN(size_t size, Value * const * elems)
+    {
+        words[0] = (size << 3) | pdListN;
+        words[1] = reinterpret_cast<uintptr_t>(elems);
+    }
+};
+
+}
+
+
+struct Value : public detail::ValueStorage<sizeof(void *)>
+{
+    friend std::string showType(const Value & v);
+
+    void print(EvalState &state, std::ostream &str, PrintOptions options = PrintOptions {});
+
+    // Functions needed to distinguish the type
+    // These should be removed eventually, by putting the functionality that's
+    // needed by callers into methods of this type
+
+    // type() == nThunk
+    inline bool isThunk() const { return getInternalType() == tThunk; };
+    inline bool isApp() const { return getInternalType() == tApp; };
+    inline bool isBlackhole() const;
+
+    // type() == nFunction
+    inline bool isLambda() const { return getInternalType() == tLambda; };
+    inline bool isPrimOp() const { return getInternalType() == tPrimOp; };
+    inline bool isPrimOpApp() const { return getInternalType() == tPrimOpApp; };
+
     /**
      * Returns the normal type of a Value. This only returns nThunk if
      * the Value hasn't been forceValue'd
@@ -269,7 +525,7 @@ public:
      */
     inline ValueType type(bool invalidIsThunk = false) const
     {
-        switch (internalType) {
+        switch (getInternalType()) {
             case tUninitialized: break;
             case tInt: return nInt;
             case tBool: return nBool;
@@ -289,12 +545,6 @@ public:
             unreachable();
     }
 
-    inline void finishValue(InternalType newType, Payload newPayload)
-    {
-        payload = newPayload;
-        internalType = newType;
-    }
-
     /**
      * A value becomes valid when it is initialized. We don't use this
      * in the evaluator; only in the bindings, where the slight extra
@@ -302,7 +552,7 @@ public:
      */
     inline bool isValid() const
     {
-        return internalType != tUninitialized;
+        return getInternalType() != tUninitialized;
     }
 
     inline void mkInt(NixInt::Inner n)
@@ -312,17 +562,17 @@ public:
 
     inline void mkInt(NixInt n)
     {
-        finishValue(tInt, { .integer = n });
+        setInt(n);
     }
 
     inline void mkBool(bool b)
     {
-        finishValue(tBool, { .boolean = b });
+        setBool(b);
     }
 
     inline void mkString(const char * s, const char * * context = 0)
     {
-        finishValue(tString, { .string = { .c_str = s, .context = context } });
+        setString(s, context);
     }
 
     void mkString(std::string_view s);
@@ -341,17 +591,17 @@ public:
 
     inline void mkPath(SourceAccessor * accessor, const char * path)
     {
-        finishValue(tPath, { .path = { .accessor = accessor, .path = path } });
+        setPath(accessor, path);
     }
 
     inline void mkNull()
     {
-        finishValue(tNull, {});
+        setNull();
     }
 
     inline void mkAttrs(Bindings * a)
     {
-        finishValue(tAttrs, { .attrs = a });
+        setAttrs(a);
     }
 
     Value & mkAttrs(BindingsBuilder & bindings);
@@ -359,26 +609,26 @@ public:
     void mkList(const ListBuilder & builder)
     {
         if (builder.size == 1)
-            finishValue(tList1, { .smallList = { builder.inlineElems[0] } });
+            setList1(builder.inlineElems[0]);
         else if (builder.size == 2)
-            finishValue(tList2, { .smallList = { builder.inlineElems[0], builder.inlineElems[1] } });
+            setList2(builder.inlineElems[0], builder.inlineElems[1]);
         else
-            finishValue(tListN, { .bigList = { .size = builder.size, .elems = builder.elems } });
+            setListN(builder.size, builder.elems);
     }
 
     inline void mkThunk(Env * e, Expr * ex)
     {
-        finishValue(tThunk, { .thunk = { .env = e, .expr = ex } });
+        setThunk(e, ex);
     }
 
     inline void mkApp(Value * l, Value * r)
     {
-        finishValue(tApp, { .app = { .left = l, .right = r } });
+        setApp(l, r);
     }
 
     inline void mkLambda(Env * e, ExprLambda * f)
     {
-        finishValue(tLambda, { .lambda = { .env = e, .fun = f } });
+        setLambda(e, f);
     }
 
     inline void mkBlackhole();
@@ -387,7 +637,7 @@ public:
 
     inline void mkPrimOpApp(Value * l, Value * r)
     {
-        finishValue(tPrimOpApp, { .primOpApp = { .left = l, .right = r } });
+        setPrimOpApp(l, r);
     }
 
     /**
@@ -397,22 +647,23 @@ public:
 
     inline void mkExternal(ExternalValueBase * e)
     {
-        finishValue(tExternal, { .external = e });
+        setExternal(e);
     }
 
     inline void mkFloat(NixFloat n)
     {
-        finishValue(tFloat, { .fpoint = n });
+        setFloat(n);
     }
 
     bool isList() const
     {
-        return internalType == tList1 || internalType == tList2 || internalType == tListN;
+        auto t = getInternalType();
+        return t == tList1 || t == tList2 || t == tListN;
     }
 
-    Value * const * listElems()
+    Value * const * listElems() const
     {
-        return internalType == tList1 || internalType == tList2 ? payload.smallList : payload.bigList.elems;
+        return getListElems();
     }
 
     std::span<Value * const> listItems() const
@@ -421,14 +672,9 @@ public:
         return std::span<Value * const>(listElems(), listSize());
     }
 
-    Value * const * listElems() const
-    {
-        return internalType == tList1 || internalType == tList2 ? payload.smallList : payload.bigList.elems;
-    }
-
     size_t listSize() const
     {
-        return internalType == tList1 ? 1 : internalType == tList2 ? 2 : payload.bigList.size;
+        return getListSize();
     }
 
     PosIdx determinePos(const PosIdx pos) const;
@@ -442,46 +688,64 @@ public:
 
     SourcePath path() const
     {
-        assert(internalType == tPath);
+        assert(getInternalType() == tPath);
         return SourcePath(
-            ref(payload.path.accessor->shared_from_this()),
-            CanonPath(CanonPath::unchecked_t(), payload.path.path));
+            ref(pathAccessor()->shared_from_this()),
+            CanonPath(CanonPath::unchecked_t(), pathStr()));
     }
 
+    SourceAccessor * pathAccessor() const
+    { return getPath().accessor; }
+
+    const char * pathStr() const
+    { return getPath().path; }
+
     std::string_view string_view() const
     {
-        assert(internalType == tString);
-        return std::string_view(payload.string.c_str);
+        assert(getInternalType() == tString);
+        return std::string_view(getString().c_str);
     }
 
     const char * c_str() const
     {
-        assert(internalType == tString);
-        return payload.string.c_str;
+        assert(getInternalType() == tString);
+        return getString().c_str;
     }
 
     const char * * context() const
     {
-        return payload.string.context;
+        return getString().context;
     }
 
     ExternalValueBase * external() const
-    { return payload.external; }
+    { return getExternal(); }
 
     const Bindings * attrs() const
-    { return payload.attrs; }
+    { return getAttrs(); }
 
     const PrimOp * primOp() const
-    { return payload.primOp; }
+    { return getPrimOp(); }
 
     bool boolean() const
-    { return payload.boolean; }
+    { return getBool(); }
 
     NixInt integer() const
-    { return payload.integer; }
+    { return getInt(); }
 
     NixFloat fpoint() const
-    { return payload.fpoint; }
+    { return getFloat(); }
+
+    ClosureThunk thunk() const
+    { return getThunk(); }
+
+    FunctionApplicationThunk app() const
+    { return getApp(); }
+
+    Lambda lambda() const
+    { return getLambda(); }
+
+    FunctionApplicationThunk primOpApp() const
+    { return getPrimOpApp(); }
 };
 
 
@@ -489,7 +753,7 @@ extern ExprBlackHole eBlackHole;
 
 bool Value::isBlackhole() const
 {
-    return internalType == tThunk && payload.thunk.expr == (Expr*) &eBlackHole;
+    return isThunk() && thunk().expr == (Expr*) &eBlackHole;
 }
 
 void Value::mkBlackhole()
@@ -1,9 +1,108 @@
 #include "fetch-to-store.hh"
 #include "fetchers.hh"
 #include "cache.hh"
+#include "posix-source-accessor.hh"
+#include "archive.hh"
+#include "signals.hh"
+
+#include <unordered_set>
 
 namespace nix {
 
+/**
+ * A fingerprint of the file system tree at a path, computed from the
+ * metadata returned by `lstat()` rather than from the file contents,
+ * similar to git's index.
+ */
+struct StatFingerprint
+{
+    std::string fingerprint;
+
+    /**
+     * The location of the tree in the local file system.
+     */
+    std::filesystem::path physicalPath;
+
+    /**
+     * The paths below the root accepted by the filter, so that it
+     * doesn't have to be called again while copying the tree.
+     */
+    std::unordered_set<std::string> accepted;
+
+    /**
+     * A hash of the paths in `accepted`, i.e. of the result of the
+     * filter.
+     */
+    std::string acceptedHash;
+};
+
+/**
+ * Compute the `StatFingerprint` of `path`. Only the entries accepted
+ * by `filter` are included, so the fingerprint also reflects the
+ * filter.
+ *
+ * Returns `std::nullopt` if `path` is not in the local file system, or
+ * if some file was modified so recently that another modification in
+ * the same second would not change its timestamps.
+ */
+static std::optional<StatFingerprint> statFingerprint(const SourcePath & path, PathFilter & filter)
+{
+    auto accessor = dynamic_cast<PosixSourceAccessor *>(&*path.accessor);
+    if (!accessor) return std::nullopt;
+
+    auto now = time(nullptr);
+
+    HashSink hashSink(HashAlgorithm::SHA256);
+    HashSink acceptedSink(HashAlgorithm::SHA256);
+
+    StatFingerprint res;
+
+    std::function<bool(const CanonPath & path)> fingerprint;
+
+    fingerprint = [&](const CanonPath & path) {
+        checkInterrupt();
+
+        auto physicalPath = accessor->getPhysicalPath(path);
+        if (!physicalPath) return false;
+
+        auto st = lstat(physicalPath->string());
+        if (st.st_mtime >= now - 1 || st.st_ctime >= now - 1) return false;
+
+        hashSink
+            << path.abs()
+            << st.st_mode
+            << st.st_size
+            << st.st_ino
+            << st.st_dev
+            << st.st_mtime
+            << st.st_ctime;
+
+        if (S_ISDIR(st.st_mode))
+            for (auto & [name, _] : accessor->readDirectory(path)) {
+                /* Names with a case hack suffix are renamed in the NAR,
+                   which we don't bother to replicate here. */
+                if (name.find(caseHackSuffix) != std::string::npos) return false;
+                auto child = path / name;
+                if (filter(child.abs())) {
+                    res.accepted.insert(child.abs());
+                    acceptedSink << child.abs();
+                    if (!fingerprint(child)) return false;
+                }
+            }
+
+        return true;
+    };
+
+    auto physicalPath = accessor->getPhysicalPath(path.path);
+    if (!physicalPath || !fingerprint(path.path)) return std::nullopt;
+
+    res.fingerprint = "stat:" + hashSink.finish().first.to_string(HashFormat::Nix32, false);
+    res.acceptedHash = acceptedSink.finish().first.to_string(HashFormat::Nix32, false);
+    res.physicalPath = std::move(*physicalPath);
+
+    return res;
+}
+
 StorePath fetchToStore(
     Store & store,
     const SourcePath & path,
@@ -18,10 +117,41 @@ StorePath fetchToStore(
 
     std::optional<fetchers::Cache::Key> cacheKey;
 
-    if (!filter && path.accessor->fingerprint) {
+    auto filter2 = filter ? *filter : defaultPathFilter;
+
+    std::optional<std::string> fingerprint;
+    std::optional<StatFingerprint> statFp;
+    if (!filter && path.accessor->fingerprint)
+        fingerprint = path.accessor->fingerprint;
+    else if ((statFp = statFingerprint(path, filter2))) {
+        fingerprint = statFp->fingerprint;
+        /* The filter has been applied to every entry of the tree, so
+           reuse its results rather than calling it again. */
+        filter2 = [&](const Path & p) { return statFp->accepted.count(p) > 0; };
+    }
+
+    if (statFp) {
+        /* Key the entry by location and by the entries the filter
+           accepted rather than by fingerprint, so that changes to
+           files replace the previous entry instead of adding a new
+           one, while different filters on the same tree (e.g. several
+           `builtins.path` calls on `./.`) each get their own. */
+        cacheKey = fetchers::Cache::Key{"statFetchToStore", {
+            {"accepted", statFp->acceptedHash},
+            {"name", std::string{name}},
+            {"method", std::string{method.render()}},
+            {"physicalPath", statFp->physicalPath.string()}
+        }};
+        if (auto res = fetchers::getCache()->lookupStorePath(*cacheKey, store);
+            res && fetchers::maybeGetStrAttr(res->value, "fingerprint") == *fingerprint)
+        {
+            debug("store path cache hit for '%s'", path);
+            return res->storePath;
+        }
+    } else if (fingerprint) {
         cacheKey = fetchers::Cache::Key{"fetchToStore", {
             {"name", std::string{name}},
-            {"fingerprint", *path.accessor->fingerprint},
+            {"fingerprint", *fingerprint},
             {"method", std::string{method.render()}},
             {"path", path.path.abs()}
         }};
@@ -35,8 +165,6 @@ StorePath fetchToStore(
     Activity act(*logger, lvlChatty, actUnknown,
         fmt(mode == FetchMode::DryRun ? "hashing '%s'" : "copying '%s' to the store", path));
 
-    auto filter2 = filter ? *filter : defaultPathFilter;
-
     auto storePath =
         mode == FetchMode::DryRun
         ? store.computeStorePath(
@@ -45,7 +173,9 @@ StorePath fetchToStore(
             name, path, method, HashAlgorithm::SHA256, {}, filter2, repair);
 
     if (cacheKey && mode == FetchMode::Copy)
-        fetchers::getCache()->upsert(*cacheKey, store, {}, storePath);
+        fetchers::getCache()->upsert(*cacheKey, store,
+            statFp ? fetchers::Attrs{{"fingerprint", *fingerprint}} : fetchers::Attrs{},
+            storePath);
 
     return storePath;
 }
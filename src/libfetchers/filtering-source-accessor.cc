@@ -57,7 +57,7 @@ void FilteringSourceAccessor::checkAccess(const CanonPath & path)
 
 struct AllowListSourceAccessorImpl : AllowListSourceAccessor
 {
-    std::set<CanonPath> allowedPrefixes;
+    SharedSync<std::set<CanonPath>> allowedPrefixes;
 
     AllowListSourceAccessorImpl(
         ref<SourceAccessor> next,
@@ -69,12 +69,12 @@ struct AllowListSourceAccessorImpl : AllowListSourceAccessor
 
     bool isAllowed(const CanonPath & path) override
     {
-        return path.isAllowed(allowedPrefixes);
+        return path.isAllowed(*allowedPrefixes.readLock());
     }
 
     void allowPrefix(CanonPath prefix) override
     {
-        allowedPrefixes.insert(std::move(prefix));
+        allowedPrefixes.lock()->insert(std::move(prefix));
     }
 };
 
@@ -88,10 +88,13 @@ ref<AllowListSourceAccessor> AllowListSourceAccessor::create(
 
 bool CachingFilteringSourceAccessor::isAllowed(const CanonPath & path)
 {
-    auto i = cache.find(path);
-    if (i != cache.end()) return i->second;
+    {
+        auto cache(this->cache.readLock());
+        auto i = cache->find(path);
+        if (i != cache->end()) return i->second;
+    }
     auto res = isAllowedUncached(path);
-    cache.emplace(path, res);
+    cache.lock()->emplace(path, res);
     return res;
 }
 
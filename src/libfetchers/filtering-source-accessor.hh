@@ -1,6 +1,7 @@
 #pragma once
 
 #include "source-path.hh"
+#include "sync.hh"
 
 namespace nix {
 
@@ -80,7 +81,7 @@ struct AllowListSourceAccessor : public FilteringSourceAccessor
  */
 struct CachingFilteringSourceAccessor : FilteringSourceAccessor
 {
-    std::map<CanonPath, bool> cache;
+    SharedSync<std::map<CanonPath, bool>> cache;
 
     using FilteringSourceAccessor::FilteringSourceAccessor;
 
@@ -154,7 +154,9 @@ static FlakeInput parseFlakeInput(EvalState & state,
                         if (attr.name == state.symbols.create("publicKeys")) {
                             experimentalFeatureSettings.require(Xp::VerifiedFetches);
                             NixStringContext emptyContext = {};
-                            attrs.emplace(state.symbols[attr.name], printValueAsJSON(state, true, *attr.value, pos, emptyContext).dump());
+                            StringSink publicKeys;
+                            printValueAsJSON(state, true, *attr.value, pos, publicKeys, emptyContext);
+                            attrs.emplace(state.symbols[attr.name], std::move(publicKeys.s));
                         } else
                             state.error<TypeError>("flake input attribute '%s' is %s while a string, Boolean, or integer is expected",
                                 state.symbols[attr.name], showType(*attr.value)).debugThrow();
@@ -247,8 +249,8 @@ static Flake readFlake(
     if (auto outputs = vInfo.attrs()->get(sOutputs)) {
         expectType(state, nFunction, *outputs->value, outputs->pos);
 
-        if (outputs->value->isLambda() && outputs->value->payload.lambda.fun->hasFormals()) {
-            for (auto & formal : outputs->value->payload.lambda.fun->formals->formals) {
+        if (outputs->value->isLambda() && outputs->value->lambda().fun->hasFormals()) {
+            for (auto & formal : outputs->value->lambda().fun->formals->formals) {
                 if (formal.name != state.sSelf)
                     flake.inputs.emplace(state.symbols[formal.name], FlakeInput {
                         .ref = parseFlakeRef(state.fetchSettings, std::string(state.symbols[formal.name]))
@@ -1,5 +1,6 @@
 #include "derivations.hh"
 #include "downstream-placeholder.hh"
+#include "drv-hash-cache.hh"
 #include "store-api.hh"
 #include "globals.hh"
 #include "types.hh"
@@ -259,12 +260,22 @@ static bool endOfList(StringViewStream & str)
 }
 
 
-static StringSet parseStrings(StringViewStream & str, bool arePaths)
+static StringSet parseStrings(StringViewStream & str)
 {
     StringSet res;
     expect(str, "[");
     while (!endOfList(str))
-        res.insert((arePaths ? parsePath(str) : parseString(str)).toOwned());
+        res.insert(parseString(str).toOwned());
+    return res;
+}
+
+
+static StorePathSet parseStorePaths(const StoreDirConfig & store, StringViewStream & str)
+{
+    StorePathSet res;
+    expect(str, "[");
+    while (!endOfList(str))
+        res.insert(store.parseStorePath(*parsePath(str)));
     return res;
 }
 
@@ -353,7 +364,7 @@ static DerivedPathMap<StringSet>::ChildNode parseDerivedPathMapNode(
     DerivedPathMap<StringSet>::ChildNode node;
 
     auto parseNonDynamic = [&]() {
-        node.value = parseStrings(str, false);
+        node.value = parseStrings(str);
     };
 
     // Older derivation should never use new form, but newer
@@ -369,7 +380,7 @@ static DerivedPathMap<StringSet>::ChildNode parseDerivedPathMapNode(
             break;
         case '(':
             expect(str, "(");
-            node.value = parseStrings(str, false);
+            node.value = parseStrings(str);
             expect(str, ",[");
             while (!endOfList(str)) {
                 expect(str, "(");
@@ -442,7 +453,7 @@ Derivation parseDerivation(
         expect(str, ")");
     }
 
-    expect(str, ","); drv.inputSrcs = store.parseStorePathSet(parseStrings(str, true));
+    expect(str, ","); drv.inputSrcs = parseStorePaths(store, str);
     expect(str, ","); drv.platform = parseString(str).toOwned();
     expect(str, ","); drv.builder = parseString(str).toOwned();
 
@@ -780,11 +791,27 @@ DerivationType BasicDerivation::type() const
 
 Sync<DrvHashes> drvHashes;
 
+/* Return the persistent cache of derivation hashes, or nullptr if it's
+   disabled or cannot be opened. */
+static DrvHashCache * getDrvHashCacheIfEnabled()
+{
+    if (!settings.useDrvHashCache) return nullptr;
+    static DrvHashCache * cache = []() -> DrvHashCache * {
+        try {
+            return &*getDrvHashCache();
+        } catch (Error &) {
+            ignoreException(lvlDebug);
+            return nullptr;
+        }
+    }();
+    return cache;
+}
+
 /* pathDerivationModulo and hashDerivationModulo are mutually recursive
  */
 
 /* Look up the derivation by value and memoize the
-   `hashDerivationModulo` call.
+   `hashDerivationModulo` call, both in memory and on disk.
  */
 static const DrvHash pathDerivationModulo(Store & store, const StorePath & drvPath)
 {
@@ -795,13 +822,39 @@ static const DrvHash pathDerivationModulo(Store & store, const StorePath & drvPa
             return h->second;
         }
     }
-    auto h = hashDerivationModulo(
-        store,
-        store.readInvalidDerivation(drvPath),
-        false);
+
+    auto cache = getDrvHashCacheIfEnabled();
+    std::optional<DrvHash> h;
+
+    if (cache) {
+        try {
+            /* Only use entries for derivations that are in the
+               store, so that a bad entry can't produce output paths
+               for a derivation that doesn't exist. */
+            h = cache->lookup(store.printStorePath(drvPath));
+            if (h && !store.isValidPath(drvPath)) h.reset();
+        } catch (Error &) {
+            ignoreException(lvlDebug);
+        }
+    }
+
+    if (!h) {
+        h = hashDerivationModulo(
+            store,
+            store.readInvalidDerivation(drvPath),
+            false);
+        if (cache) {
+            try {
+                cache->upsert(store.printStorePath(drvPath), *h);
+            } catch (Error &) {
+                ignoreException(lvlDebug);
+            }
+        }
+    }
+
     // Cache it
-    drvHashes.lock()->insert_or_assign(drvPath, h);
-    return h;
+    drvHashes.lock()->insert_or_assign(drvPath, *h);
+    return *h;
 }
 
 /* See the header for interface details. These are the implementation details.
@@ -0,0 +1,98 @@
+#include "drv-hash-cache.hh"
+#include "users.hh"
+#include "sync.hh"
+#include "sqlite.hh"
+
+#include <nlohmann/json.hpp>
+
+namespace nix {
+
+static const char * schema = R"sql(
+
+create table if not exists DrvHashes (
+    drvPath   text primary key not null,
+    kind      integer not null,
+    hashes    text not null -- JSON object mapping output names to SRI hashes
+);
+
+)sql";
+
+class DrvHashCacheImpl : public DrvHashCache
+{
+    struct State
+    {
+        SQLite db;
+        SQLiteStmt insert, query;
+    };
+
+    Sync<State> _state;
+
+public:
+
+    DrvHashCacheImpl(Path dbPath = getCacheDir() + "/nix/drv-hashes-v1.sqlite")
+    {
+        auto state(_state.lock());
+
+        createDirs(dirOf(dbPath));
+
+        state->db = SQLite(dbPath);
+
+        state->db.isCache();
+
+        state->db.exec(schema);
+
+        state->insert.create(state->db,
+            "insert or replace into DrvHashes(drvPath, kind, hashes) values (?, ?, ?)");
+
+        state->query.create(state->db,
+            "select kind, hashes from DrvHashes where drvPath = ?");
+    }
+
+    std::optional<DrvHash> lookup(const std::string & drvPath) override
+    {
+        return retrySQLite<std::optional<DrvHash>>([&]() -> std::optional<DrvHash> {
+            auto state(_state.lock());
+
+            auto query(state->query.use()(drvPath));
+            if (!query.next()) return std::nullopt;
+
+            DrvHash res {
+                .kind = query.getInt(0) ? DrvHash::Kind::Deferred : DrvHash::Kind::Regular,
+            };
+            for (auto & [outputName, hash] : nlohmann::json::parse(query.getStr(1)).items())
+                res.hashes.insert_or_assign(outputName, Hash::parseSRI(hash.get<std::string>()));
+
+            return res;
+        });
+    }
+
+    void upsert(const std::string & drvPath, const DrvHash & hash) override
+    {
+        auto hashes = nlohmann::json::object();
+        for (auto & [outputName, h] : hash.hashes)
+            hashes[outputName] = h.to_string(HashFormat::SRI, true);
+
+        retrySQLite<void>([&]() {
+            auto state(_state.lock());
+
+            state->insert.use()
+                (drvPath)
+                (hash.kind == DrvHash::Kind::Deferred ? 1 : 0)
+                (hashes.dump())
+                .exec();
+        });
+    }
+};
+
+ref<DrvHashCache> getDrvHashCache()
+{
+    static ref<DrvHashCache> cache = make_ref<DrvHashCacheImpl>();
+    return cache;
+}
+
+ref<DrvHashCache> getTestDrvHashCache(Path dbPath)
+{
+    return make_ref<DrvHashCacheImpl>(dbPath);
+}
+
+}
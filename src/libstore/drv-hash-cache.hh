@@ -0,0 +1,36 @@
+#pragma once
+///@file
+
+#include "ref.hh"
+#include "derivations.hh"
+
+namespace nix {
+
+/**
+ * A persistent cache of the results of `hashDerivationModulo()` for
+ * derivations in the store, so that input derivations don't have to
+ * be read and hashed again in every process.
+ *
+ * Since a store derivation's path is determined by its contents, the
+ * cached results never become stale.
+ */
+class DrvHashCache
+{
+public:
+
+    virtual ~DrvHashCache() { }
+
+    virtual std::optional<DrvHash> lookup(const std::string & drvPath) = 0;
+
+    virtual void upsert(const std::string & drvPath, const DrvHash & hash) = 0;
+};
+
+/**
+ * Return a singleton cache object that can be used concurrently by
+ * multiple threads.
+ */
+ref<DrvHashCache> getDrvHashCache();
+
+ref<DrvHashCache> getTestDrvHashCache(Path dbPath);
+
+}
@@ -950,6 +950,17 @@ public:
           mismatch if the build isn't reproducible.
         )"};
 
+    Setting<bool> useDrvHashCache{this, false, "use-drv-hash-cache",
+        R"(
+          Whether to keep the hashes of store derivations that are needed to
+          compute output paths in a database in `~/.cache/nix`. This way,
+          subsequent invocations of Nix don't need to read and hash the
+          closure of input derivations again.
+
+          A cached hash is only used if the derivation is valid in the
+          store.
+        )"};
+
     Setting<bool> printMissing{this, true, "print-missing",
         "Whether to print what paths need to be built or downloaded."};
 
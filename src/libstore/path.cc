@@ -77,6 +77,15 @@ StorePath StorePath::random(std::string_view name)
 
 StorePath StoreDirConfig::parseStorePath(std::string_view path) const
 {
+    /* Fast path for paths that are already canonical, which avoids
+       allocating temporary strings. */
+    if (path.size() > storeDir.size() + 1
+        && path.starts_with(storeDir)
+        && path[storeDir.size()] == '/'
+        && path[storeDir.size() + 1] != '.'
+        && path.find('/', storeDir.size() + 1) == path.npos)
+        return StorePath(path.substr(storeDir.size() + 1));
+
     // On Windows, `/nix/store` is not a canonical path. More broadly it
     // is unclear whether this function should be using the native
     // notion of a canonical path at all. For example, it makes to
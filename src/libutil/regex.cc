@@ -0,0 +1,896 @@
+#include "regex.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <memory>
+
+namespace nix {
+
+/**
+ * The maximum number of instructions in a program. This is the same
+ * as libstdc++'s limit on the number of states of a `std::regex`.
+ */
+static constexpr size_t maxProgramSize = 100000;
+
+/**
+ * The maximum repetition count in `{m,n}`.
+ */
+static constexpr size_t maxRepeat = 65535;
+
+/**
+ * Don't build a DFA for programs with more instructions than this, or
+ * with more entries than this in the transition table. The matcher
+ * then falls back to simulating the program.
+ */
+static constexpr size_t maxDfaProgramSize = 1000;
+static constexpr size_t maxDfaSize = 1 << 14;
+
+struct Regex::Node
+{
+    enum Type {
+        Empty,
+        Char,
+        Set,
+        Any,
+        Bol,
+        Eol,
+        Group,
+        Concat,
+        Alt,
+        Repeat,
+    } type;
+
+    uint32_t value = 0;
+
+    /**
+     * For `Repeat`: the minimum and maximum number of iterations. A
+     * maximum of `unbounded` means there is none.
+     */
+    size_t min = 0, max = 0;
+
+    static constexpr size_t unbounded = SIZE_MAX;
+
+    std::vector<std::unique_ptr<Node>> children;
+
+    Node(Type type, uint32_t value = 0) : type(type), value(value) { }
+};
+
+struct Regex::Parser
+{
+    Regex & regex;
+    std::string_view s;
+    size_t pos = 0;
+
+    [[noreturn]] void fail(std::string_view msg)
+    {
+        throw RegexError("invalid regular expression '%s': %s", s, msg);
+    }
+
+    bool atEnd() const
+    {
+        return pos == s.size();
+    }
+
+    char peek(size_t n = 0) const
+    {
+        return pos + n < s.size() ? s[pos + n] : 0;
+    }
+
+    static bool isQuantifier(char c)
+    {
+        return c == '*' || c == '+' || c == '?' || c == '{';
+    }
+
+    std::unique_ptr<Node> parseAlt()
+    {
+        auto first = parseConcat();
+        if (peek() != '|' || atEnd())
+            return first;
+        auto alt = std::make_unique<Node>(Node::Alt);
+        alt->children.push_back(std::move(first));
+        while (!atEnd() && peek() == '|') {
+            pos++;
+            alt->children.push_back(parseConcat());
+        }
+        return alt;
+    }
+
+    std::unique_ptr<Node> parseConcat()
+    {
+        auto concat = std::make_unique<Node>(Node::Concat);
+
+        while (!atEnd() && peek() != '|' && peek() != ')') {
+            auto atom = parseAtom();
+
+            bool repeatable = atom->type != Node::Bol && atom->type != Node::Eol;
+
+            while (!atEnd() && isQuantifier(peek())) {
+                if (!repeatable)
+                    fail("repetition operator without an operand");
+                atom = parseQuantifier(std::move(atom));
+            }
+
+            concat->children.push_back(std::move(atom));
+        }
+
+        if (concat->children.size() == 1)
+            return std::move(concat->children[0]);
+        if (concat->children.empty())
+            return std::make_unique<Node>(Node::Empty);
+        return concat;
+    }
+
+    std::unique_ptr<Node> parseQuantifier(std::unique_ptr<Node> atom)
+    {
+        auto repeat = std::make_unique<Node>(Node::Repeat);
+        char c = s[pos++];
+        if (c == '*') {
+            repeat->min = 0;
+            repeat->max = Node::unbounded;
+        } else if (c == '+') {
+            repeat->min = 1;
+            repeat->max = Node::unbounded;
+        } else if (c == '?') {
+            repeat->min = 0;
+            repeat->max = 1;
+        } else {
+            if (atEnd())
+                fail("unterminated '{'");
+            repeat->min = parseCount();
+            repeat->max = repeat->min;
+            if (peek() == ',') {
+                pos++;
+                repeat->max = peek() == '}' ? Node::unbounded : parseCount();
+            }
+            if (atEnd())
+                fail("unterminated '{'");
+            if (peek() != '}')
+                fail("invalid contents of '{}'");
+            pos++;
+            if (repeat->max < repeat->min)
+                fail("invalid repetition count");
+        }
+        repeat->children.push_back(std::move(atom));
+        return repeat;
+    }
+
+    size_t parseCount()
+    {
+        if (!isdigit(peek()))
+            fail(atEnd() ? "unterminated '{'" : "invalid contents of '{}'");
+        size_t n = 0;
+        while (isdigit(peek())) {
+            n = n * 10 + (s[pos++] - '0');
+            if (n > maxRepeat)
+                throw RegexTooLargeError("regular expression '%s' is too large", s);
+        }
+        return n;
+    }
+
+    std::unique_ptr<Node> parseAtom()
+    {
+        char c = s[pos++];
+        switch (c) {
+
+        case '(': {
+            auto group = std::make_unique<Node>(Node::Group, ++regex.nrGroups);
+            group->children.push_back(parseAlt());
+            if (atEnd() || peek() != ')')
+                fail("unmatched '('");
+            pos++;
+            return group;
+        }
+
+        case ')':
+            fail("unmatched ')'");
+
+        case '*': case '+': case '?': case '{':
+            fail("repetition operator without an operand");
+
+        case '[':
+            return parseBracket();
+
+        case '.':
+            return std::make_unique<Node>(Node::Any);
+
+        case '^':
+            return std::make_unique<Node>(Node::Bol);
+
+        case '$':
+            return std::make_unique<Node>(Node::Eol);
+
+        case '\\': {
+            static constexpr std::string_view escapable = "^$\\.*+?()[{|";
+            if (atEnd() || escapable.find(peek()) == escapable.npos)
+                fail("invalid escape sequence");
+            return std::make_unique<Node>(Node::Char, (unsigned char) s[pos++]);
+        }
+
+        default:
+            return std::make_unique<Node>(Node::Char, (unsigned char) c);
+        }
+    }
+
+    static bool inClass(std::string_view name, unsigned char c)
+    {
+        bool alpha = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+        bool digit = c >= '0' && c <= '9';
+        bool space = c == ' ' || (c >= '\t' && c <= '\r');
+        bool print = c >= 0x20 && c < 0x7f;
+        if (name == "alpha") return alpha;
+        if (name == "digit" || name == "d") return digit;
+        if (name == "alnum") return alpha || digit;
+        if (name == "w") return alpha || digit || c == '_';
+        if (name == "upper") return c >= 'A' && c <= 'Z';
+        if (name == "lower") return c >= 'a' && c <= 'z';
+        if (name == "space" || name == "s") return space;
+        if (name == "blank") return c == ' ' || c == '\t';
+        if (name == "cntrl") return c < 0x20 || c == 0x7f;
+        if (name == "print") return print;
+        if (name == "graph") return print && c != ' ';
+        if (name == "punct") return print && c != ' ' && !alpha && !digit;
+        if (name == "xdigit") return digit || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+        abort();
+    }
+
+    /**
+     * Parse a `[:class:]`, `[.c.]` or `[=c=]` inside a bracket
+     * expression. Return the character for the latter two.
+     */
+    std::optional<unsigned char> parseBracketTerm(std::bitset<256> & set)
+    {
+        char kind = s[pos + 1];
+        pos += 2;
+        auto end = s.find(std::string{kind, ']'}, pos);
+        if (end == s.npos)
+            fail("unterminated '['");
+        auto name = s.substr(pos, end - pos);
+        pos = end + 2;
+
+        if (kind == ':') {
+            std::string lower;
+            for (auto c : name) lower += tolower(c);
+            static constexpr std::string_view classes[] = {
+                "alpha", "digit", "d", "alnum", "w", "upper", "lower", "space", "s",
+                "blank", "cntrl", "print", "graph", "punct", "xdigit",
+            };
+            if (std::find(std::begin(classes), std::end(classes), lower) == std::end(classes))
+                fail("invalid character class");
+            for (size_t c = 0; c < 256; ++c)
+                if (inClass(lower, c))
+                    set.set(c);
+            return std::nullopt;
+        }
+
+        /* Only single-character collating elements are supported. */
+        if (name.size() != 1)
+            fail("invalid collating element");
+        return (unsigned char) name[0];
+    }
+
+    std::unique_ptr<Node> parseBracket()
+    {
+        std::bitset<256> set;
+
+        bool negate = peek() == '^';
+        if (negate) pos++;
+
+        bool first = true;
+
+        while (true) {
+            if (atEnd())
+                fail("unterminated '['");
+
+            char c = peek();
+
+            if (c == ']' && !first) {
+                pos++;
+                break;
+            }
+
+            first = false;
+
+            std::optional<unsigned char> from;
+            if (c == '[' && (peek(1) == ':' || peek(1) == '.' || peek(1) == '=')) {
+                bool single = peek(1) != '.';
+                from = parseBracketTerm(set);
+                if (single) {
+                    if (from) set.set(*from);
+                    if (peek() == '-' && peek(1) != ']' && pos + 1 < s.size())
+                        fail("invalid character range");
+                    continue;
+                }
+            } else {
+                from = (unsigned char) c;
+                pos++;
+            }
+
+            if (peek() == '-' && pos + 1 < s.size() && peek(1) != ']') {
+                pos++;
+                unsigned char to;
+                if (peek() == '[' && peek(1) == '.') {
+                    auto t = parseBracketTerm(set);
+                    to = *t;
+                } else if (peek() == '[' && (peek(1) == ':' || peek(1) == '='))
+                    fail("invalid character range");
+                else
+                    to = (unsigned char) s[pos++];
+                if (to < *from)
+                    fail("invalid character range");
+                for (size_t ch = *from; ch <= to; ++ch)
+                    set.set(ch);
+                if (peek() == '-' && pos + 1 < s.size() && peek(1) != ']')
+                    fail("invalid character range");
+            } else
+                set.set(*from);
+        }
+
+        if (negate)
+            set.flip();
+
+        regex.sets.push_back(set);
+        return std::make_unique<Node>(Node::Set, regex.sets.size() - 1);
+    }
+};
+
+Regex::Regex(std::string_view pattern)
+    : pattern(pattern)
+{
+    Parser parser{*this, pattern};
+
+    auto root = parser.parseAlt();
+    if (!parser.atEnd())
+        parser.fail("unmatched ')'");
+
+    /* Group 0 is the entire match. */
+    emit({Op::Save, 0});
+    compile(*root);
+    emit({Op::Save, 1});
+    emit({Op::Match});
+
+    std::vector<uint32_t> pcs;
+    std::vector<bool> seen(program.size());
+    closure(pcs, seen, 0, false, false);
+
+    std::bitset<256> first;
+    bool canBeEmpty = false;
+    for (auto pc : pcs) {
+        auto & inst = program[pc];
+        switch (inst.op) {
+        case Op::Char: first.set(inst.x); break;
+        case Op::Set: first |= sets[inst.x]; break;
+        case Op::Any: first.set().reset(0); break;
+        case Op::Split:
+        case Op::Jmp:
+        case Op::Save:
+        case Op::Bol:
+        case Op::Eol:
+        case Op::Match:
+            canBeEmpty = true;
+            break;
+        }
+    }
+    if (!canBeEmpty) {
+        firstBytes = first;
+        if (first.count() == 1)
+            for (size_t c = 0; c < 256; ++c)
+                if (first.test(c))
+                    firstByte = (char) c;
+    }
+
+    buildDfa();
+}
+
+void Regex::emit(Inst inst)
+{
+    if (program.size() >= maxProgramSize)
+        throw RegexTooLargeError("regular expression '%s' is too large", pattern);
+    program.push_back(inst);
+}
+
+void Regex::compile(const Node & node)
+{
+    switch (node.type) {
+
+    case Node::Empty:
+        break;
+
+    case Node::Char:
+        emit({Op::Char, node.value});
+        break;
+
+    case Node::Set:
+        emit({Op::Set, node.value});
+        break;
+
+    case Node::Any:
+        emit({Op::Any});
+        break;
+
+    case Node::Bol:
+        emit({Op::Bol});
+        break;
+
+    case Node::Eol:
+        emit({Op::Eol});
+        break;
+
+    case Node::Group:
+        emit({Op::Save, 2 * node.value});
+        compile(*node.children[0]);
+        emit({Op::Save, 2 * node.value + 1});
+        break;
+
+    case Node::Concat:
+        for (auto & child : node.children)
+            compile(*child);
+        break;
+
+    case Node::Alt: {
+        /* Split L1, N1; L1: child 1; Jmp end; N1: Split L2, N2; ...;
+           child n; end: */
+        std::vector<size_t> jumps;
+        for (auto & child : node.children) {
+            bool last = &child == &node.children.back();
+            size_t split = program.size();
+            if (!last)
+                emit({Op::Split, uint32_t(split + 1)});
+            compile(*child);
+            if (!last) {
+                jumps.push_back(program.size());
+                emit({Op::Jmp});
+                program[split].y = program.size();
+            }
+        }
+        for (auto jump : jumps)
+            program[jump].x = program.size();
+        break;
+    }
+
+    case Node::Repeat: {
+        auto & child = *node.children[0];
+
+        for (size_t n = 0; n < node.min; ++n)
+            compile(child);
+
+        if (node.max == Node::unbounded) {
+            /* loop: Split body, end; body: child; Jmp loop; end: */
+            size_t loop = program.size();
+            emit({Op::Split, uint32_t(loop + 1)});
+            compile(child);
+            emit({Op::Jmp, uint32_t(loop)});
+            program[loop].y = program.size();
+        } else {
+            /* Split L1, end; L1: child; Split L2, end; ...; end: */
+            std::vector<size_t> splits;
+            for (size_t n = node.min; n < node.max; ++n) {
+                splits.push_back(program.size());
+                emit({Op::Split, uint32_t(program.size() + 1)});
+                compile(child);
+            }
+            for (auto split : splits)
+                program[split].y = program.size();
+        }
+        break;
+    }
+    }
+}
+
+void Regex::closure(std::vector<uint32_t> & pcs, std::vector<bool> & seen, uint32_t pc0, bool atBol, bool atEol) const
+{
+    std::vector<uint32_t> todo{pc0};
+
+    while (!todo.empty()) {
+        auto pc = todo.back();
+        todo.pop_back();
+
+        if (seen[pc]) continue;
+        seen[pc] = true;
+
+        auto & inst = program[pc];
+        switch (inst.op) {
+        case Op::Jmp:
+            todo.push_back(inst.x);
+            break;
+        case Op::Split:
+            todo.push_back(inst.y);
+            todo.push_back(inst.x);
+            break;
+        case Op::Save:
+            todo.push_back(pc + 1);
+            break;
+        case Op::Bol:
+            if (atBol)
+                todo.push_back(pc + 1);
+            break;
+        case Op::Eol:
+            if (atEol)
+                todo.push_back(pc + 1);
+            else
+                pcs.push_back(pc);
+            break;
+        case Op::Char:
+        case Op::Set:
+        case Op::Any:
+        case Op::Match:
+            pcs.push_back(pc);
+            break;
+        }
+    }
+}
+
+void Regex::buildDfa()
+{
+    if (program.size() > maxDfaProgramSize)
+        return;
+
+    /* Divide the bytes into classes, such that no instruction
+       distinguishes between the bytes of a class. */
+    std::bitset<257> boundaries;
+    boundaries.set(0);
+    for (auto & inst : program) {
+        switch (inst.op) {
+        case Op::Char:
+            boundaries.set(inst.x);
+            boundaries.set(inst.x + 1);
+            break;
+        case Op::Set:
+            for (size_t c = 1; c < 256; ++c)
+                if (sets[inst.x][c] != sets[inst.x][c - 1])
+                    boundaries.set(c);
+            break;
+        case Op::Any:
+            boundaries.set(1);
+            break;
+        case Op::Split:
+        case Op::Jmp:
+        case Op::Save:
+        case Op::Bol:
+        case Op::Eol:
+        case Op::Match:
+            break;
+        }
+    }
+
+    std::vector<unsigned char> representatives;
+    for (size_t c = 0; c < 256; ++c) {
+        if (boundaries[c])
+            representatives.push_back(c);
+        dfa.byteClasses[c] = representatives.size() - 1;
+    }
+    dfa.nrClasses = representatives.size();
+
+    /* Each state is the sorted set of instructions of the threads
+       that are alive, where `searching` stands for the threads that a
+       search starts at every position. */
+    const uint32_t searching = program.size();
+    std::map<std::vector<uint32_t>, uint32_t> ids;
+    std::vector<std::vector<uint32_t>> states;
+    bool tooLarge = false;
+
+    auto intern = [&](std::vector<uint32_t> pcs) -> uint32_t
+    {
+        std::sort(pcs.begin(), pcs.end());
+        auto i = ids.find(pcs);
+        if (i != ids.end())
+            return i->second;
+        if ((states.size() + 1) * dfa.nrClasses > maxDfaSize) {
+            tooLarge = true;
+            return 0;
+        }
+        ids.emplace(pcs, states.size());
+        states.push_back(std::move(pcs));
+        return states.size() - 1;
+    };
+
+    std::vector<bool> seen;
+
+    /* The dead state, from which there is no match. */
+    intern({});
+
+    for (bool atBol : {false, true}) {
+        for (bool search : {false, true}) {
+            std::vector<uint32_t> pcs;
+            seen.assign(program.size(), false);
+            closure(pcs, seen, 0, atBol, false);
+            if (search)
+                pcs.push_back(searching);
+            (search ? dfa.searchStart : dfa.anchoredStart)[atBol] = intern(std::move(pcs));
+        }
+    }
+
+    for (size_t state = 0; state < states.size() && !tooLarge; ++state) {
+        auto pcs = states[state];
+
+        for (auto c : representatives) {
+            std::vector<uint32_t> next;
+            seen.assign(program.size(), false);
+            for (auto pc : pcs) {
+                if (pc == searching) {
+                    closure(next, seen, 0, false, false);
+                    next.push_back(searching);
+                    continue;
+                }
+                auto & inst = program[pc];
+                if ((inst.op == Op::Char && c == inst.x)
+                    || (inst.op == Op::Set && sets[inst.x].test(c))
+                    || (inst.op == Op::Any && c != 0))
+                    closure(next, seen, pc + 1, false, false);
+            }
+            dfa.next.push_back(intern(std::move(next)));
+        }
+
+        uint8_t flags = 0;
+        for (auto pc : pcs) {
+            if (pc == searching) continue;
+            if (program[pc].op == Op::Match)
+                flags |= Dfa::matched | Dfa::matchedAtEnd;
+            else if (program[pc].op == Op::Eol) {
+                std::vector<uint32_t> atEnd;
+                seen.assign(program.size(), false);
+                closure(atEnd, seen, pc + 1, false, true);
+                for (auto pc2 : atEnd)
+                    if (program[pc2].op == Op::Match)
+                        flags |= Dfa::matchedAtEnd;
+            }
+        }
+        dfa.flags.push_back(flags);
+    }
+
+    if (tooLarge) {
+        dfa.next.clear();
+        dfa.flags.clear();
+    }
+}
+
+bool Regex::mayMatch(std::string_view s, size_t start, bool anchored, bool full) const
+{
+    /* Matches at the start of the input are rare and may depend on
+       `^` and `$` both matching, so just let the caller look. */
+    if (dfa.next.empty() || start >= s.size())
+        return true;
+
+    auto state = (anchored ? dfa.anchoredStart : dfa.searchStart)[start == 0];
+
+    for (size_t pos = start; pos < s.size(); ++pos) {
+        if (!full && (dfa.flags[state] & Dfa::matched))
+            return true;
+        state = dfa.next[state * dfa.nrClasses + dfa.byteClasses[(unsigned char) s[pos]]];
+        if (!state)
+            return false;
+    }
+
+    return dfa.flags[state] & Dfa::matchedAtEnd;
+}
+
+std::optional<Regex::Match> Regex::run(std::string_view s, size_t start, bool full, RegexSearchFlags flags) const
+{
+    constexpr auto npos = Match::npos;
+
+    const size_t nrSlots = 2 * (nrGroups + 1);
+
+    /* A list of threads, in order of decreasing priority. `slots`
+       holds the group offsets of each thread. `mark` records which
+       instructions have already been added to the list in the
+       current step. */
+    struct Threads
+    {
+        std::vector<uint32_t> pcs;
+        std::vector<size_t> slots;
+        std::vector<size_t> mark;
+    };
+
+    Threads threadsA, threadsB;
+    for (auto threads : {&threadsA, &threadsB}) {
+        threads->mark.assign(program.size(), npos);
+        /* Most expressions only have a few threads alive at a time. */
+        threads->pcs.reserve(std::min(program.size(), (size_t) 64));
+        threads->slots.reserve(threads->pcs.capacity() * nrSlots);
+    }
+    auto * cur = &threadsA, * next = &threadsB;
+
+    /* The current position, used to tell whether an instruction has
+       already been visited in this step. */
+    size_t pos = start;
+
+    /* Scratch space for the slots of the thread being added, and a
+       stack of instructions to visit or slots to restore. */
+    std::vector<size_t> scratch(nrSlots);
+    struct Todo { uint32_t pc; uint32_t slot; size_t value; };
+    std::vector<Todo> todo;
+    static constexpr uint32_t noSlot = UINT32_MAX;
+
+    /* Add the thread at `pc` with slots `scratch` to `list`, after
+       following all instructions that don't consume input. This
+       clobbers `scratch`. */
+    auto addThread = [&](Threads & list, uint32_t pc, size_t at)
+    {
+        while (true) {
+            if (list.mark[pc] != at) {
+                list.mark[pc] = at;
+
+                auto & inst = program[pc];
+                switch (inst.op) {
+                case Op::Jmp:
+                    pc = inst.x;
+                    continue;
+                case Op::Split:
+                    todo.push_back({inst.y, noSlot, 0});
+                    pc = inst.x;
+                    continue;
+                case Op::Save:
+                    /* Only the threads still on the stack need the
+                       old value. */
+                    if (!todo.empty())
+                        todo.push_back({0, inst.x, scratch[inst.x]});
+                    scratch[inst.x] = at;
+                    pc++;
+                    continue;
+                case Op::Bol:
+                    if (at == 0) {
+                        pc++;
+                        continue;
+                    }
+                    break;
+                case Op::Eol:
+                    if (at == s.size()) {
+                        pc++;
+                        continue;
+                    }
+                    break;
+                case Op::Char:
+                case Op::Set:
+                case Op::Any:
+                case Op::Match:
+                    list.pcs.push_back(pc);
+                    list.slots.insert(list.slots.end(), scratch.begin(), scratch.end());
+                    break;
+                }
+            }
+
+            /* Continue with the next thread on the stack. */
+            while (true) {
+                if (todo.empty())
+                    return;
+                auto t = todo.back();
+                todo.pop_back();
+                if (t.slot == noSlot) {
+                    pc = t.pc;
+                    break;
+                }
+                scratch[t.slot] = t.value;
+            }
+        }
+    };
+
+    std::optional<Match> best;
+
+    while (true) {
+        /* If no thread is alive, skip to the next byte with which a
+           match can start. */
+        if (cur->pcs.empty() && !best && !flags.continuous && pos > start && firstBytes) {
+            if (firstByte) {
+                auto p = (const char *) std::memchr(s.data() + pos, *firstByte, s.size() - pos);
+                pos = p ? p - s.data() : s.size();
+            } else
+                while (pos < s.size() && !firstBytes->test((unsigned char) s[pos]))
+                    pos++;
+            if (pos == s.size())
+                break;
+        }
+
+        /* Start a new thread at this position, with the lowest
+           priority, unless we already have a match (which will start
+           earlier). */
+        if (!best && (pos == start || !flags.continuous)) {
+            std::fill(scratch.begin(), scratch.end(), npos);
+            addThread(*cur, 0, pos);
+        }
+
+        if (cur->pcs.empty() && (best || flags.continuous || pos == s.size()))
+            break;
+
+        for (size_t i = 0; i < cur->pcs.size(); ++i) {
+            auto pc = cur->pcs[i];
+            auto slots = &cur->slots[i * nrSlots];
+
+            /* Once we have a match, threads that started later can't
+               produce a better one. */
+            if (best && slots[0] > best->offsets[0])
+                continue;
+
+            auto & inst = program[pc];
+
+            bool advance = false;
+            if (pos < s.size()) {
+                unsigned char c = s[pos];
+                switch (inst.op) {
+                case Op::Char: advance = c == inst.x; break;
+                case Op::Set: advance = sets[inst.x].test(c); break;
+                case Op::Any: advance = c != 0; break;
+                case Op::Split:
+                case Op::Jmp:
+                case Op::Save:
+                case Op::Bol:
+                case Op::Eol:
+                case Op::Match:
+                    break;
+                }
+            }
+
+            if (advance) {
+                std::copy(slots, slots + nrSlots, scratch.begin());
+                addThread(*next, pc + 1, pos + 1);
+            }
+
+            else if (inst.op == Op::Match) {
+                if (full && pos != s.size()) continue;
+                if (flags.notNull && slots[0] == pos) continue;
+                /* Prefer a match that starts earlier or, failing
+                   that, is longer. Of equally good matches, the first
+                   one found has the highest priority. */
+                if (!best
+                    || slots[0] < best->offsets[0]
+                    || (slots[0] == best->offsets[0] && pos > best->offsets[1]))
+                {
+                    if (!best) {
+                        best.emplace();
+                        best->subject = s;
+                    }
+                    best->offsets.assign(slots, slots + nrSlots);
+                }
+            }
+        }
+
+        std::swap(cur, next);
+        next->pcs.clear();
+        next->slots.clear();
+
+        if (pos == s.size())
+            break;
+        pos++;
+    }
+
+    return best;
+}
+
+std::optional<Regex::Match> Regex::match(std::string_view s) const
+{
+    if (!mayMatch(s, 0, true, true))
+        return std::nullopt;
+    return run(s, 0, true, {.continuous = true});
+}
+
+std::optional<Regex::Match> Regex::search(std::string_view s, size_t start, RegexSearchFlags flags) const
+{
+    if (!flags.notNull && !mayMatch(s, start, flags.continuous, false))
+        return std::nullopt;
+    return run(s, start, false, flags);
+}
+
+std::vector<Regex::Match> Regex::searchAll(std::string_view s) const
+{
+    std::vector<Match> matches;
+
+    auto m = search(s);
+
+    while (m) {
+        size_t end = m->end();
+        bool empty = m->start() == end;
+        matches.push_back(std::move(*m));
+
+        if (empty) {
+            if (end == s.size())
+                break;
+            m = search(s, end, {.continuous = true, .notNull = true});
+            if (!m)
+                m = search(s, end + 1);
+        } else
+            m = search(s, end);
+    }
+
+    return matches;
+}
+
+}
@@ -0,0 +1,238 @@
+#pragma once
+///@file
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "error.hh"
+
+namespace nix {
+
+MakeError(RegexError, Error);
+
+/**
+ * Thrown if a regular expression would need an unreasonably large
+ * program (e.g. because of large repetition counts).
+ */
+MakeError(RegexTooLargeError, RegexError);
+
+struct RegexSearchFlags
+{
+    /**
+     * Only look for a match that starts at the start position.
+     */
+    bool continuous = false;
+
+    /**
+     * Don't accept an empty match.
+     */
+    bool notNull = false;
+};
+
+/**
+ * A POSIX extended regular expression.
+ *
+ * Matching is done by simulating all possible paths through the
+ * expression in lockstep (a "Pike VM"), so it takes time linear in the
+ * length of the input and uses no recursion. Strings that don't match
+ * are usually rejected up front by a DFA that ignores groups, and
+ * searches skip ahead to bytes that can start a match. In case of
+ * ambiguity,
+ * the longest match at the leftmost position is chosen. Its groups
+ * are those of the first way to obtain it, preferring the left side
+ * of alternations and more iterations of loops, like libstdc++'s
+ * `std::regex` does.
+ *
+ * The syntax accepted is that of `std::regex::extended`, except that
+ * back-references are not supported.
+ *
+ * A `Regex` is immutable, so it can be used concurrently by several
+ * threads.
+ */
+class Regex
+{
+public:
+
+    /**
+     * The result of a successful match: the offsets of the match and
+     * of each group in the subject string.
+     */
+    class Match
+    {
+        friend Regex;
+
+        std::string_view subject;
+
+        /**
+         * The start and end of each group, or `npos` if the group did
+         * not participate in the match. Group 0 is the entire match.
+         */
+        std::vector<size_t> offsets;
+
+    public:
+
+        static constexpr size_t npos = std::string_view::npos;
+
+        size_t size() const
+        {
+            return offsets.size() / 2;
+        }
+
+        size_t start(size_t group = 0) const
+        {
+            return offsets[2 * group];
+        }
+
+        size_t end(size_t group = 0) const
+        {
+            return offsets[2 * group + 1];
+        }
+
+        std::optional<std::string_view> operator[](size_t group) const
+        {
+            if (start(group) == npos)
+                return std::nullopt;
+            return subject.substr(start(group), end(group) - start(group));
+        }
+    };
+
+    /**
+     * @throws RegexError if `pattern` is not a valid regular
+     * expression.
+     */
+    Regex(std::string_view pattern);
+
+    /**
+     * The number of parenthesized groups.
+     */
+    size_t groups() const
+    {
+        return nrGroups;
+    }
+
+    /**
+     * Match the entire string `s`.
+     */
+    std::optional<Match> match(std::string_view s) const;
+
+    /**
+     * Find the leftmost match in `s` that starts at or after `start`.
+     * `^` and `$` only match at the beginning and end of `s`.
+     */
+    std::optional<Match> search(std::string_view s, size_t start = 0, RegexSearchFlags flags = {}) const;
+
+    /**
+     * Return all non-overlapping matches in `s`, from left to right,
+     * in the same way as `std::regex_iterator`: after an empty match,
+     * the next match must not be empty or must start later.
+     */
+    std::vector<Match> searchAll(std::string_view s) const;
+
+private:
+
+    enum struct Op : uint8_t {
+        Char,
+        Set,
+        Any,
+        Split,
+        Jmp,
+        Save,
+        Bol,
+        Eol,
+        Match,
+    };
+
+    /**
+     * An instruction of the program. `x` is the character for `Char`,
+     * the index in `sets` for `Set`, the slot for `Save` and the
+     * target for `Jmp`. `Split` continues at `x` and, with lower
+     * priority, at `y`.
+     */
+    struct Inst
+    {
+        Op op;
+        uint32_t x = 0, y = 0;
+    };
+
+    std::string pattern;
+    std::vector<Inst> program;
+    std::vector<std::bitset<256>> sets;
+    size_t nrGroups = 0;
+
+    /**
+     * The bytes with which a match can start, if no match can be
+     * empty.
+     */
+    std::optional<std::bitset<256>> firstBytes;
+
+    /**
+     * The byte in `firstBytes` if there is only one, to be searched
+     * for with `memchr()`.
+     */
+    std::optional<char> firstByte;
+
+    /**
+     * A DFA that tells whether a match exists, or empty if the
+     * program would need too many states. The input alphabet is the
+     * set of classes of bytes that no instruction distinguishes
+     * between. State 0 is the dead state.
+     */
+    struct Dfa
+    {
+        std::array<uint8_t, 256> byteClasses;
+        size_t nrClasses = 0;
+
+        /**
+         * The transition table, indexed by `state * nrClasses + class`.
+         */
+        std::vector<uint32_t> next;
+
+        /**
+         * For each state, whether a match has been found
+         * (`matched`), or would be found at the end of the input
+         * (`matchedAtEnd`).
+         */
+        std::vector<uint8_t> flags;
+        static constexpr uint8_t matched = 1, matchedAtEnd = 2;
+
+        /**
+         * The start states for a full match or a search, at the
+         * beginning of the input (`[1]`) or not (`[0]`).
+         */
+        std::array<uint32_t, 2> anchoredStart, searchStart;
+    };
+
+    Dfa dfa;
+
+    struct Parser;
+    struct Node;
+
+    void emit(Inst inst);
+    void compile(const Node & node);
+
+    /**
+     * Add the instructions that consume input or match and that are
+     * reachable from `pc` without consuming input to `pcs`, skipping
+     * those marked in `seen`. `Bol` is only passed if `atBol`; `Eol`
+     * is passed if `atEol` and otherwise added to `pcs`.
+     */
+    void closure(std::vector<uint32_t> & pcs, std::vector<bool> & seen, uint32_t pc, bool atBol, bool atEol) const;
+
+    void buildDfa();
+
+    /**
+     * Return false if there is definitely no match in `s` that starts
+     * at (if `anchored`) or after `start`, and that extends to the end
+     * of `s` if `full`.
+     */
+    bool mayMatch(std::string_view s, size_t start, bool anchored, bool full) const;
+
+    std::optional<Match> run(std::string_view s, size_t start, bool full, RegexSearchFlags flags) const;
+};
+
+}
@@ -4,15 +4,16 @@
 
 namespace nix {
 
-ThreadPool::ThreadPool(size_t _maxThreads)
+ThreadPool::ThreadPool(size_t _maxThreads, bool background)
     : maxThreads(_maxThreads)
+    , background(background)
 {
     if (!maxThreads) {
         maxThreads = std::thread::hardware_concurrency();
         if (!maxThreads) maxThreads = 1;
     }
 
-    debug("starting pool of %d threads", maxThreads - 1);
+    debug("starting pool of %d threads", background ? maxThreads : maxThreads - 1);
 }
 
 ThreadPool::~ThreadPool()
@@ -46,7 +47,8 @@ void ThreadPool::enqueue(const work_t & t)
         throw ThreadPoolShutDown("cannot enqueue a work item while the thread pool is shutting down");
     state->pending.push(t);
     /* Note: process() also executes items, so count it as a worker. */
-    if (state->pending.size() > state->workers.size() + 1 && state->workers.size() + 1 < maxThreads)
+    size_t callers = background ? 0 : 1;
+    if (state->pending.size() > state->workers.size() + callers && state->workers.size() + callers < maxThreads)
         state->workers.emplace_back(&ThreadPool::doWork, this, false);
     work.notify_one();
 }
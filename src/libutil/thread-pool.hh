@@ -22,7 +22,16 @@ class ThreadPool
 {
 public:
 
-    ThreadPool(size_t maxThreads = 0);
+    /**
+     * @param maxThreads The maximum number of threads executing work
+     * items, including the caller of `process()`. 0 means the number
+     * of CPUs.
+     *
+     * @param background If true, `process()` will not be called, so
+     * all work items are executed by worker threads, which are started
+     * as soon as there is work for them.
+     */
+    ThreadPool(size_t maxThreads = 0, bool background = false);
 
     ~ThreadPool();
 
@@ -52,10 +61,19 @@ public:
      */
     void process();
 
+    /**
+     * Discard the pending work items and wait for the active ones to
+     * finish. Subsequent calls to `enqueue()` throw
+     * `ThreadPoolShutDown`.
+     */
+    void shutdown();
+
 private:
 
     size_t maxThreads;
 
+    bool background;
+
     struct State
     {
         std::queue<work_t> pending;
@@ -72,8 +90,6 @@ private:
     std::condition_variable work;
 
     void doWork(bool mainThread);
-
-    void shutdown();
 };
 
 /**
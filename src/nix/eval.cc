@@ -116,7 +116,12 @@ struct CmdEval : MixJSON, InstallableValueCommand, MixReadOnlyOption
         }
 
         else if (json) {
-            logger->cout("%s", printValueAsJSON(*state, true, *v, pos, context, false));
+            /* Evaluate the whole value before printing anything, so
+               that an evaluation error doesn't leave truncated JSON
+               on stdout. */
+            StringSink sink;
+            printValueAsJSON(*state, true, *v, pos, sink, context, false);
+            logger->cout("%s", sink.s);
         }
 
         else {
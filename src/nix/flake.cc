@@ -18,6 +18,8 @@
 #include "markdown.hh"
 #include "users.hh"
 #include "terminal.hh"
+#include "eval-gc.hh"
+#include "thread-pool.hh"
 
 #include <filesystem>
 #include <nlohmann/json.hpp>
@@ -324,6 +326,170 @@ struct CmdFlakeInfo : CmdFlakeMetadata
     }
 };
 
+/**
+ * Builds derivations in background threads as soon as they are handed
+ * to it, so that building overlaps with evaluation. Derivations that
+ * arrive while others are being built are built in a new batch, so
+ * that a slow build doesn't hold up the ones after it; at most
+ * `max-jobs` batches are built at the same time.
+ */
+struct BackgroundBuilder
+{
+    ref<Store> store;
+
+    /**
+     * The number of checks that may be built at the same time. This
+     * is shared by all batches, so that running several batches
+     * doesn't exceed `max-jobs`.
+     */
+    size_t maxJobs;
+
+    struct State
+    {
+        std::vector<DerivedPath> pending;
+        /**
+         * The number of checks in the batches that are being built.
+         */
+        size_t building = 0;
+        /**
+         * The number of threads that have been started but haven't
+         * taken a batch yet.
+         */
+        size_t starting = 0;
+        /**
+         * The number of threads that haven't exited.
+         */
+        size_t running = 0;
+        std::map<std::thread::id, std::thread> threads;
+        /**
+         * Threads that have exited and need to be joined.
+         */
+        std::vector<std::thread> finished;
+        std::exception_ptr exception;
+    };
+
+    Sync<State> state_;
+
+    std::condition_variable done;
+
+    BackgroundBuilder(ref<Store> store)
+        : store(store)
+        , maxJobs(std::max(settings.maxBuildJobs.get(), 1U))
+    { }
+
+    ~BackgroundBuilder()
+    {
+        state_.lock()->pending.clear();
+        join();
+    }
+
+    /**
+     * Queue a derivation for building. Throws the error of a failed
+     * build, unless `--keep-going` is in effect.
+     */
+    void add(DerivedPath && path)
+    {
+        std::vector<std::thread> finished;
+        {
+            auto state(state_.lock());
+            if (state->exception && !settings.keepGoing)
+                std::rethrow_exception(state->exception);
+            state->pending.push_back(std::move(path));
+            /* Start a thread for the new check if there are job slots
+               left and no starting thread will take it anyway.
+               Otherwise a running batch picks it up when it's done. */
+            if (state->building < maxJobs && !state->starting) {
+                state->starting++;
+                state->running++;
+                std::thread thread([this]() { builderThread(); });
+                auto id = thread.get_id();
+                state->threads.emplace(id, std::move(thread));
+            }
+            std::swap(finished, state->finished);
+        }
+        for (auto & thread : finished)
+            thread.join();
+    }
+
+    /**
+     * Wait until all queued derivations have been built, and throw
+     * the first build error, if any.
+     */
+    void finish()
+    {
+        join();
+
+        if (auto exception = state_.lock()->exception)
+            std::rethrow_exception(exception);
+    }
+
+private:
+
+    void join()
+    {
+        std::vector<std::thread> finished;
+        {
+            auto state(state_.lock());
+            while (state->running)
+                state.wait(done);
+            std::swap(finished, state->finished);
+        }
+        for (auto & thread : finished)
+            thread.join();
+    }
+
+    /**
+     * Build the pending derivations in batches that fit in the free
+     * job slots, until there are none left or no slots are free.
+     */
+    void builderThread()
+    {
+        bool started = true;
+
+        while (true) {
+            std::vector<DerivedPath> paths;
+
+            {
+                auto state(state_.lock());
+                if (started) {
+                    state->starting--;
+                    started = false;
+                }
+                if (state->exception && !settings.keepGoing)
+                    state->pending.clear();
+                auto n = std::min(state->pending.size(), maxJobs - state->building);
+                if (!n) {
+                    /* The threads that are still building pick up
+                       the remaining checks once they are done. */
+                    auto self = state->threads.find(std::this_thread::get_id());
+                    state->finished.push_back(std::move(self->second));
+                    state->threads.erase(self);
+                    state->running--;
+                    done.notify_all();
+                    return;
+                }
+                paths.assign(
+                    std::make_move_iterator(state->pending.begin()),
+                    std::make_move_iterator(state->pending.begin() + n));
+                state->pending.erase(state->pending.begin(), state->pending.begin() + n);
+                state->building += n;
+            }
+
+            try {
+                Activity act(*logger, lvlInfo, actUnknown,
+                    fmt("running %d flake checks", paths.size()));
+                store->buildPaths(paths);
+            } catch (...) {
+                auto state(state_.lock());
+                if (!state->exception)
+                    state->exception = std::current_exception();
+            }
+
+            state_.lock()->building -= paths.size();
+        }
+    }
+};
+
 struct CmdFlakeCheck : FlakeCommand
 {
     bool build = true;
@@ -368,7 +534,7 @@ struct CmdFlakeCheck : FlakeCommand
         auto flake = lockFlake();
         auto localSystem = std::string(settings.thisSystem.get());
 
-        bool hasErrors = false;
+        std::atomic_bool hasErrors = false;
         auto reportError = [&](const Error & e) {
             try {
                 throw e;
@@ -413,11 +579,11 @@ struct CmdFlakeCheck : FlakeCommand
             }
         };
 
-        auto checkDerivation = [&](const std::string & attrPath, Value & v, const PosIdx pos) -> std::optional<StorePath> {
+        auto checkDerivation = [&](EvalState & state, const std::string & attrPath, Value & v, const PosIdx pos) -> std::optional<StorePath> {
             try {
                 Activity act(*logger, lvlInfo, actUnknown,
                     fmt("checking derivation %s", attrPath));
-                auto packageInfo = getDerivation(*state, v, false);
+                auto packageInfo = getDerivation(state, v, false);
                 if (!packageInfo)
                     throw Error("flake attribute '%s' is not a derivation", attrPath);
                 else {
@@ -431,13 +597,112 @@ struct CmdFlakeCheck : FlakeCommand
                     return storePath;
                 }
             } catch (Error & e) {
-                e.addTrace(resolve(pos), HintFmt("while checking the derivation '%s'", attrPath));
+                e.addTrace(state.positions[pos], HintFmt("while checking the derivation '%s'", attrPath));
                 reportError(e);
             }
             return std::nullopt;
         };
 
-        std::vector<DerivedPath> drvPaths;
+        std::optional<BackgroundBuilder> builder;
+        if (build) builder.emplace(store);
+
+        auto buildDerivation = [&](const StorePath & drvPath) {
+            if (builder)
+                builder->add(DerivedPath::Built {
+                    .drvPath = makeConstantStorePathRef(drvPath),
+                    .outputs = OutputsSpec::All { },
+                });
+        };
+
+        /* If `eval-jobs` allows it, derivations and NixOS
+           configurations are checked by a thread pool. Each worker
+           thread has its own evaluator, and looks up the attributes to
+           check in its own copy of the flake outputs. */
+        struct Worker
+        {
+            std::shared_ptr<EvalState> state;
+            RootValue vOutputs;
+        };
+
+        Sync<std::map<std::thread::id, Worker>> workers_;
+
+        auto getWorker = [&]() -> Worker &
+        {
+            auto workers(workers_.lock());
+            auto & worker = (*workers)[std::this_thread::get_id()];
+            if (!worker.state) {
+                auto state = makeEvalState();
+                auto vFlake = state->allocValue();
+                flake::callFlake(*state, flake, *vFlake);
+                state->forceAttrs(*vFlake, noPos, "while evaluating a flake to get its outputs");
+                auto aOutputs = vFlake->attrs()->get(state->symbols.create("outputs"));
+                assert(aOutputs);
+                worker.vOutputs = allocRootValue(aOutputs->value);
+                worker.state = state;
+            }
+            return worker;
+        };
+
+        std::optional<ThreadPool> pool;
+        if (evalSettings.evalJobs != 1)
+            pool.emplace(evalSettings.evalJobs);
+
+        typedef std::function<void(EvalState & state, const std::string & attrPath, Value & v, const PosIdx pos)> Check;
+
+        /* Run `check` on the flake output attribute `attrPath`, whose
+           value in the main evaluator is `v`. */
+        auto schedule = [&](std::vector<std::string> && attrPath, Value & v, const PosIdx pos, Check && check) {
+            auto attrPathS = concatStringsSep(".", attrPath);
+
+            if (!pool)
+                return check(*state, attrPathS, v, pos);
+
+            auto work = [&, attrPath(std::move(attrPath)), attrPathS, check(std::move(check))]() {
+                GCThreadRegistration gcThread;
+
+                auto & worker = getWorker();
+                auto & state = *worker.state;
+
+                Value * v = *worker.vOutputs;
+                PosIdx pos = noPos, outputPos = noPos;
+
+                try {
+                    for (auto & name : attrPath) {
+                        state.forceAttrs(*v, pos, "");
+                        auto attr = v->attrs()->get(state.symbols.create(name));
+                        if (!attr)
+                            throw Error("flake output attribute '%s' does not exist", attrPathS);
+                        v = attr->value;
+                        pos = attr->pos;
+                        if (!outputPos) outputPos = pos;
+                    }
+
+                    check(state, attrPathS, *v, pos);
+                } catch (Error & e) {
+                    e.addTrace(state.positions[outputPos], HintFmt("while checking flake output '%s'", attrPath.front()));
+                    reportError(e);
+                }
+            };
+
+            try {
+                pool->enqueue(work);
+            } catch (ThreadPoolShutDown &) {
+                /* A check has failed and `--keep-going` isn't in
+                   effect, so stop checking and throw its error rather
+                   than this one. */
+                pool->process();
+                throw;
+            }
+        };
+
+        auto scheduleDerivation = [&](std::vector<std::string> && attrPath, Value & v, const PosIdx pos, bool build) {
+            schedule(std::move(attrPath), v, pos,
+                [&, build](EvalState & state, const std::string & attrPath, Value & v, const PosIdx pos) {
+                    auto drvPath = checkDerivation(state, attrPath, v, pos);
+                    if (drvPath && build)
+                        buildDerivation(*drvPath);
+                });
+        };
 
         auto checkApp = [&](const std::string & attrPath, Value & v, const PosIdx pos) {
             try {
@@ -488,8 +753,8 @@ struct CmdFlakeCheck : FlakeCommand
                 if (!v.isLambda()) {
                     throw Error("overlay is not a function, but %s instead", showType(v));
                 }
-                if (v.payload.lambda.fun->hasFormals()
-                    || !argHasName(v.payload.lambda.fun->arg, "final"))
+                if (v.lambda().fun->hasFormals()
+                    || !argHasName(v.lambda().fun->arg, "final"))
                     throw Error("overlay does not take an argument named 'final'");
                 // FIXME: if we have a 'nixpkgs' input, use it to
                 // evaluate the overlay.
@@ -527,7 +792,7 @@ struct CmdFlakeCheck : FlakeCommand
                     if (state->isDerivation(*attr.value)) {
                         Activity act(*logger, lvlInfo, actUnknown,
                             fmt("checking Hydra job '%s'", attrPath2));
-                        checkDerivation(attrPath2, *attr.value, attr.pos);
+                        checkDerivation(*state, attrPath2, *attr.value, attr.pos);
                     } else
                         checkHydraJobs(attrPath2, *attr.value, attr.pos);
                 }
@@ -538,17 +803,17 @@ struct CmdFlakeCheck : FlakeCommand
             }
         };
 
-        auto checkNixOSConfiguration = [&](const std::string & attrPath, Value & v, const PosIdx pos) {
+        auto checkNixOSConfiguration = [&](EvalState & state, const std::string & attrPath, Value & v, const PosIdx pos) {
             try {
                 Activity act(*logger, lvlInfo, actUnknown,
                     fmt("checking NixOS configuration '%s'", attrPath));
-                Bindings & bindings(*state->allocBindings(0));
-                auto vToplevel = findAlongAttrPath(*state, "config.system.build.toplevel", bindings, v).first;
-                state->forceValue(*vToplevel, pos);
-                if (!state->isDerivation(*vToplevel))
+                Bindings & bindings(*state.allocBindings(0));
+                auto vToplevel = findAlongAttrPath(state, "config.system.build.toplevel", bindings, v).first;
+                state.forceValue(*vToplevel, pos);
+                if (!state.isDerivation(*vToplevel))
                     throw Error("attribute 'config.system.build.toplevel' is not a derivation");
             } catch (Error & e) {
-                e.addTrace(resolve(pos), HintFmt("while checking the NixOS configuration '%s'", attrPath));
+                e.addTrace(state.positions[pos], HintFmt("while checking the NixOS configuration '%s'", attrPath));
                 reportError(e);
             }
         };
@@ -607,6 +872,8 @@ struct CmdFlakeCheck : FlakeCommand
             auto vFlake = state->allocValue();
             flake::callFlake(*state, flake, *vFlake);
 
+            bool importFromDerivationRestored = false;
+
             enumerateOutputs(*state,
                 *vFlake,
                 [&](std::string_view name, Value & vOutput, const PosIdx pos) {
@@ -614,7 +881,15 @@ struct CmdFlakeCheck : FlakeCommand
                         fmt("checking flake output '%s'", name));
 
                     try {
-                        evalSettings.enableImportFromDerivation.setDefault(name != "hydraJobs");
+                        /* hydraJobs is checked first, without IFD. Only
+                           re-enable IFD once, since worker threads may
+                           be evaluating later outputs. */
+                        if (name == "hydraJobs")
+                            evalSettings.enableImportFromDerivation.setDefault(false);
+                        else if (!importFromDerivationRestored) {
+                            evalSettings.enableImportFromDerivation.setDefault(true);
+                            importFromDerivationRestored = true;
+                        }
 
                         state->forceValue(vOutput, pos);
 
@@ -637,17 +912,11 @@ struct CmdFlakeCheck : FlakeCommand
                                 checkSystemName(attr_name, attr.pos);
                                 if (checkSystemType(attr_name, attr.pos)) {
                                     state->forceAttrs(*attr.value, attr.pos, "");
-                                    for (auto & attr2 : *attr.value->attrs()) {
-                                        auto drvPath = checkDerivation(
-                                            fmt("%s.%s.%s", name, attr_name, state->symbols[attr2.name]),
-                                            *attr2.value, attr2.pos);
-                                        if (drvPath && attr_name == settings.thisSystem.get()) {
-                                            drvPaths.push_back(DerivedPath::Built {
-                                                .drvPath = makeConstantStorePathRef(*drvPath),
-                                                .outputs = OutputsSpec::All { },
-                                            });
-                                        }
-                                    }
+                                    for (auto & attr2 : *attr.value->attrs())
+                                        scheduleDerivation(
+                                            {std::string(name), std::string(attr_name), std::string(state->symbols[attr2.name])},
+                                            *attr2.value, attr2.pos,
+                                            attr_name == settings.thisSystem.get());
                                 }
                             }
                         }
@@ -658,9 +927,9 @@ struct CmdFlakeCheck : FlakeCommand
                                 const auto & attr_name = state->symbols[attr.name];
                                 checkSystemName(attr_name, attr.pos);
                                 if (checkSystemType(attr_name, attr.pos)) {
-                                    checkDerivation(
-                                        fmt("%s.%s", name, attr_name),
-                                        *attr.value, attr.pos);
+                                    scheduleDerivation(
+                                        {std::string(name), std::string(attr_name)},
+                                        *attr.value, attr.pos, false);
                                 };
                             }
                         }
@@ -673,9 +942,9 @@ struct CmdFlakeCheck : FlakeCommand
                                 if (checkSystemType(attr_name, attr.pos)) {
                                     state->forceAttrs(*attr.value, attr.pos, "");
                                     for (auto & attr2 : *attr.value->attrs())
-                                        checkDerivation(
-                                            fmt("%s.%s.%s", name, attr_name, state->symbols[attr2.name]),
-                                            *attr2.value, attr2.pos);
+                                        scheduleDerivation(
+                                            {std::string(name), std::string(attr_name), std::string(state->symbols[attr2.name])},
+                                            *attr2.value, attr2.pos, false);
                                 };
                             }
                         }
@@ -701,9 +970,9 @@ struct CmdFlakeCheck : FlakeCommand
                                 const auto & attr_name = state->symbols[attr.name];
                                 checkSystemName(attr_name, attr.pos);
                                 if (checkSystemType(attr_name, attr.pos)) {
-                                    checkDerivation(
-                                        fmt("%s.%s", name, attr_name),
-                                        *attr.value, attr.pos);
+                                    scheduleDerivation(
+                                        {std::string(name), std::string(attr_name)},
+                                        *attr.value, attr.pos, false);
                                 };
                             }
                         }
@@ -753,8 +1022,8 @@ struct CmdFlakeCheck : FlakeCommand
                         else if (name == "nixosConfigurations") {
                             state->forceAttrs(vOutput, pos, "");
                             for (auto & attr : *vOutput.attrs())
-                                checkNixOSConfiguration(fmt("%s.%s", name, state->symbols[attr.name]),
-                                    *attr.value, attr.pos);
+                                schedule({std::string(name), std::string(state->symbols[attr.name])},
+                                    *attr.value, attr.pos, checkNixOSConfiguration);
                         }
 
                         else if (name == "hydraJobs")
@@ -824,11 +1093,12 @@ struct CmdFlakeCheck : FlakeCommand
                 });
         }
 
-        if (build && !drvPaths.empty()) {
-            Activity act(*logger, lvlInfo, actUnknown,
-                fmt("running %d flake checks", drvPaths.size()));
-            store->buildPaths(drvPaths);
-        }
+        if (pool)
+            pool->process();
+
+        if (builder)
+            builder->finish();
+
         if (hasErrors)
             throw Error("some errors were encountered during the evaluation");
 
@@ -11,6 +11,9 @@
 #include "attr-path.hh"
 #include "hilite.hh"
 #include "strings-inline.hh"
+#include "installable-flake.hh"
+#include "eval-gc.hh"
+#include "thread-pool.hh"
 
 #include <regex>
 #include <fstream>
@@ -65,6 +68,139 @@ struct CmdSearch : InstallableValueCommand, MixJSON
         };
     }
 
+    std::vector<std::regex> regexes;
+    std::vector<std::regex> excludeRegexes;
+
+    /**
+     * A matching package, rendered for output.
+     */
+    struct Result
+    {
+        std::string attrPath;
+        nlohmann::json json;
+        std::vector<std::string> lines;
+    };
+
+    /**
+     * Search the attribute `cursor` and its children, passing matches
+     * to `emit`. If `spawn` is set, the children of package sets are
+     * passed to it instead of being searched, so that they can be
+     * searched in parallel.
+     */
+    void visit(
+        EvalState & state,
+        eval_cache::AttrCursor & cursor,
+        const std::vector<Symbol> & attrPath,
+        bool initialRecurse,
+        const std::function<void(Result &&)> & emit,
+        const std::function<void(eval_cache::AttrCursor &)> & spawn)
+    {
+        auto attrPathS = state.symbols.resolve(attrPath);
+
+        Activity act(*logger, lvlInfo, actUnknown,
+            fmt("evaluating '%s'", concatStringsSep(".", attrPathS)));
+        try {
+            auto recurse = [&]()
+            {
+                bool partition = spawn
+                    && !(attrPath.size() < 2
+                        && (attrPath.empty() || attrPathS[0] == "legacyPackages" || attrPathS[0] == "packages"));
+
+                for (const auto & attr : cursor.getAttrs()) {
+                    auto cursor2 = cursor.getAttr(state.symbols[attr]);
+                    if (partition) {
+                        spawn(*cursor2);
+                        continue;
+                    }
+                    auto attrPath2(attrPath);
+                    attrPath2.push_back(attr);
+                    visit(state, *cursor2, attrPath2, false, emit, spawn);
+                }
+            };
+
+            if (cursor.isDerivation()) {
+                DrvName name(cursor.getAttr(state.sName)->getString());
+
+                auto aMeta = cursor.maybeGetAttr(state.sMeta);
+                auto aDescription = aMeta ? aMeta->maybeGetAttr(state.sDescription) : nullptr;
+                auto description = aDescription ? aDescription->getString() : "";
+                std::replace(description.begin(), description.end(), '\n', ' ');
+                auto attrPath2 = concatStringsSep(".", attrPathS);
+
+                std::vector<std::smatch> attrPathMatches;
+                std::vector<std::smatch> descriptionMatches;
+                std::vector<std::smatch> nameMatches;
+                bool found = false;
+
+                for (auto & regex : excludeRegexes) {
+                    if (
+                        std::regex_search(attrPath2, regex)
+                        || std::regex_search(name.name, regex)
+                        || std::regex_search(description, regex))
+                        return;
+                }
+
+                for (auto & regex : regexes) {
+                    found = false;
+                    auto addAll = [&found](std::sregex_iterator it, std::vector<std::smatch> & vec) {
+                        const auto end = std::sregex_iterator();
+                        while (it != end) {
+                            vec.push_back(*it++);
+                            found = true;
+                        }
+                    };
+
+                    addAll(std::sregex_iterator(attrPath2.begin(), attrPath2.end(), regex), attrPathMatches);
+                    addAll(std::sregex_iterator(name.name.begin(), name.name.end(), regex), nameMatches);
+                    addAll(std::sregex_iterator(description.begin(), description.end(), regex), descriptionMatches);
+
+                    if (!found)
+                        break;
+                }
+
+                if (found)
+                {
+                    Result result{.attrPath = attrPath2};
+                    if (json) {
+                        result.json = {
+                            {"pname", name.name},
+                            {"version", name.version},
+                            {"description", description},
+                        };
+                    } else {
+                        result.lines.push_back(fmt(
+                            "* %s%s",
+                            wrap("\e[0;1m", hiliteMatches(attrPath2, attrPathMatches, ANSI_GREEN, "\e[0;1m")),
+                            name.version != "" ? " (" + name.version + ")" : ""));
+                        if (description != "")
+                            result.lines.push_back(fmt(
+                                "  %s", hiliteMatches(description, descriptionMatches, ANSI_GREEN, ANSI_NORMAL)));
+                    }
+                    emit(std::move(result));
+                }
+            }
+
+            else if (
+                attrPath.size() == 0
+                || (attrPathS[0] == "legacyPackages" && attrPath.size() <= 2)
+                || (attrPathS[0] == "packages" && attrPath.size() <= 2))
+                recurse();
+
+            else if (initialRecurse)
+                recurse();
+
+            else if (attrPathS[0] == "legacyPackages" && attrPath.size() > 2) {
+                auto attr = cursor.maybeGetAttr(state.sRecurseForDerivations);
+                if (attr && attr->getBool())
+                    recurse();
+            }
+
+        } catch (EvalError & e) {
+            if (!(attrPath.size() > 0 && attrPathS[0] == "legacyPackages"))
+                throw;
+        }
+    }
+
     void run(ref<Store> store, ref<InstallableValue> installable) override
     {
         settings.readOnlyMode = true;
@@ -74,8 +210,6 @@ struct CmdSearch : InstallableValueCommand, MixJSON
         if (res.empty())
             throw UsageError("Must provide at least one regex! To match all packages, use '%s'.", "nix search <installable> ^");
 
-        std::vector<std::regex> regexes;
-        std::vector<std::regex> excludeRegexes;
         regexes.reserve(res.size());
         excludeRegexes.reserve(excludeRes.size());
 
@@ -92,117 +226,148 @@ struct CmdSearch : InstallableValueCommand, MixJSON
 
         uint64_t results = 0;
 
-        std::function<void(eval_cache::AttrCursor & cursor, const std::vector<Symbol> & attrPath, bool initialRecurse)> visit;
-
-        visit = [&](eval_cache::AttrCursor & cursor, const std::vector<Symbol> & attrPath, bool initialRecurse)
+        auto emit = [&](Result && result)
         {
-            auto attrPathS = state->symbols.resolve(attrPath);
+            results++;
+            if (json)
+                (*jsonOut)[result.attrPath] = std::move(result.json);
+            else {
+                if (results > 1) logger->cout("");
+                for (auto & line : result.lines)
+                    logger->cout("%s", line);
+            }
+        };
 
-            Activity act(*logger, lvlInfo, actUnknown,
-                fmt("evaluating '%s'", concatStringsSep(".", attrPathS)));
-            try {
-                auto recurse = [&]()
-                {
-                    for (const auto & attr : cursor.getAttrs()) {
-                        auto cursor2 = cursor.getAttr(state->symbols[attr]);
-                        auto attrPath2(attrPath);
-                        attrPath2.push_back(attr);
-                        visit(*cursor2, attrPath2, false);
-                    }
-                };
-
-                if (cursor.isDerivation()) {
-                    DrvName name(cursor.getAttr(state->sName)->getString());
-
-                    auto aMeta = cursor.maybeGetAttr(state->sMeta);
-                    auto aDescription = aMeta ? aMeta->maybeGetAttr(state->sDescription) : nullptr;
-                    auto description = aDescription ? aDescription->getString() : "";
-                    std::replace(description.begin(), description.end(), '\n', ' ');
-                    auto attrPath2 = concatStringsSep(".", attrPathS);
-
-                    std::vector<std::smatch> attrPathMatches;
-                    std::vector<std::smatch> descriptionMatches;
-                    std::vector<std::smatch> nameMatches;
-                    bool found = false;
-
-                    for (auto & regex : excludeRegexes) {
-                        if (
-                            std::regex_search(attrPath2, regex)
-                            || std::regex_search(name.name, regex)
-                            || std::regex_search(description, regex))
-                            return;
-                    }
+        auto flake = installable.dynamic_pointer_cast<InstallableFlake>();
 
-                    for (auto & regex : regexes) {
-                        found = false;
-                        auto addAll = [&found](std::sregex_iterator it, std::vector<std::smatch> & vec) {
-                            const auto end = std::sregex_iterator();
-                            while (it != end) {
-                                vec.push_back(*it++);
-                                found = true;
-                            }
-                        };
+        if (evalSettings.evalJobs == 1 || !flake) {
+            for (auto & cursor : installable->getCursors(*state))
+                visit(*state, *cursor, cursor->getAttrPath(), true, emit, nullptr);
+        } else
+            runParallel(*state, *flake, emit);
 
-                        addAll(std::sregex_iterator(attrPath2.begin(), attrPath2.end(), regex), attrPathMatches);
-                        addAll(std::sregex_iterator(name.name.begin(), name.name.end(), regex), nameMatches);
-                        addAll(std::sregex_iterator(description.begin(), description.end(), regex), descriptionMatches);
+        if (json)
+            logger->cout("%s", *jsonOut);
 
-                        if (!found)
-                            break;
-                    }
+        if (!json && !results)
+            throw Error("no results for the given search term(s)!");
+    }
 
-                    if (found)
-                    {
-                        results++;
-                        if (json) {
-                            (*jsonOut)[attrPath2] = {
-                                {"pname", name.name},
-                                {"version", name.version},
-                                {"description", description},
-                            };
-                        } else {
-                            auto name2 = hiliteMatches(name.name, nameMatches, ANSI_GREEN, "\e[0;2m");
-                            if (results > 1) logger->cout("");
-                            logger->cout(
-                                "* %s%s",
-                                wrap("\e[0;1m", hiliteMatches(attrPath2, attrPathMatches, ANSI_GREEN, "\e[0;1m")),
-                                name.version != "" ? " (" + name.version + ")" : "");
-                            if (description != "")
-                                logger->cout(
-                                    "  %s", hiliteMatches(description, descriptionMatches, ANSI_GREEN, ANSI_NORMAL));
-                        }
-                    }
-                }
+    /**
+     * Search the package sets of a flake using a thread pool. The main
+     * thread finds the package sets; each of their attributes is then
+     * searched by a worker thread with its own evaluator. Results are
+     * emitted in the same order as a sequential search.
+     */
+    void runParallel(
+        EvalState & state,
+        InstallableFlake & installable,
+        const std::function<void(Result &&)> & emit)
+    {
+        /* Worker evaluators, indexed by thread. They only read from the
+           evaluation cache, since the main evaluator holds a write
+           transaction on it. */
+        struct Worker
+        {
+            std::shared_ptr<EvalState> state;
+            std::shared_ptr<eval_cache::AttrCursor> root;
+        };
 
-                else if (
-                    attrPath.size() == 0
-                    || (attrPathS[0] == "legacyPackages" && attrPath.size() <= 2)
-                    || (attrPathS[0] == "packages" && attrPath.size() <= 2))
-                    recurse();
+        Sync<std::map<std::thread::id, Worker>> workers_;
 
-                else if (initialRecurse)
-                    recurse();
+        auto getWorker = [&]() -> Worker &
+        {
+            auto workers(workers_.lock());
+            auto & worker = (*workers)[std::this_thread::get_id()];
+            if (!worker.state) {
+                worker.state = makeEvalState();
+                worker.root = openEvalCache(*worker.state, installable.getLockedFlake(), true)->getRoot();
+            }
+            return worker;
+        };
 
-                else if (attrPathS[0] == "legacyPackages" && attrPath.size() > 2) {
-                    auto attr = cursor.maybeGetAttr(state->sRecurseForDerivations);
-                    if (attr && attr->getBool())
-                        recurse();
-                }
+        struct Progress
+        {
+            /* The results of each subtree, or `std::nullopt` if it
+               hasn't been searched yet. */
+            std::vector<std::optional<std::vector<Result>>> subtrees;
+            size_t nextToEmit = 0;
+        };
+
+        Sync<Progress> progress_;
 
-            } catch (EvalError & e) {
-                if (!(attrPath.size() > 0 && attrPathS[0] == "legacyPackages"))
-                    throw;
+        auto searchSubtree = [&](size_t index, std::vector<std::string> attrPathS)
+        {
+            GCThreadRegistration gcThread;
+
+            auto & worker = getWorker();
+
+            std::vector<Result> results;
+
+            std::vector<Symbol> attrPath;
+            for (auto & attr : attrPathS)
+                attrPath.push_back(worker.state->symbols.create(attr));
+
+            auto cursor = worker.root->findAlongAttrPath(attrPath);
+            if (cursor)
+                visit(*worker.state, **cursor, attrPath, false,
+                    [&](Result && result) { results.push_back(std::move(result)); },
+                    nullptr);
+
+            auto progress(progress_.lock());
+            progress->subtrees[index] = std::move(results);
+            while (progress->nextToEmit < progress->subtrees.size()
+                && progress->subtrees[progress->nextToEmit])
+            {
+                for (auto & result : *progress->subtrees[progress->nextToEmit])
+                    emit(std::move(result));
+                progress->subtrees[progress->nextToEmit].reset();
+                progress->nextToEmit++;
             }
         };
 
-        for (auto & cursor : installable->getCursors(*state))
-            visit(*cursor, cursor->getAttrPath(), true);
+        ThreadPool pool(evalSettings.evalJobs);
 
-        if (json)
-            logger->cout("%s", *jsonOut);
+        auto spawn = [&](eval_cache::AttrCursor & cursor)
+        {
+            auto attrPathS = state.symbols.resolve(cursor.getAttrPath());
+            size_t index;
+            {
+                auto progress(progress_.lock());
+                index = progress->subtrees.size();
+                progress->subtrees.emplace_back();
+            }
+            try {
+                pool.enqueue(std::bind(searchSubtree, index,
+                    std::vector<std::string>(attrPathS.begin(), attrPathS.end())));
+            } catch (ThreadPoolShutDown &) {
+                /* A worker has failed, so stop searching and throw
+                   its error rather than this one. */
+                pool.process();
+                throw;
+            }
+        };
 
-        if (!json && !results)
-            throw Error("no results for the given search term(s)!");
+        /* Matches outside of package sets are found by the main
+           thread, so they have to be emitted in order with the rest. */
+        auto emitInOrder = [&](Result && result)
+        {
+            auto progress(progress_.lock());
+            progress->subtrees.emplace_back(std::vector<Result>{});
+            progress->subtrees.back()->push_back(std::move(result));
+        };
+
+        for (auto & cursor : installable.getCursors(state))
+            visit(state, *cursor, cursor->getAttrPath(), true, emitInOrder, spawn);
+
+        pool.process();
+
+        /* Emit the results of the main thread that follow the last
+           subtree. */
+        auto progress(progress_.lock());
+        for (; progress->nextToEmit < progress->subtrees.size(); progress->nextToEmit++)
+            for (auto & result : *progress->subtrees[progress->nextToEmit])
+                emit(std::move(result));
     }
 };
 
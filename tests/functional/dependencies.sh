@@ -8,6 +8,11 @@ drvPath=$(nix-instantiate dependencies.nix)
 
 echo "derivation is $drvPath"
 
+# Hashes from the derivation hash cache give the same result.
+for i in 1 2; do
+    [[ $(nix-instantiate --option use-drv-hash-cache true dependencies.nix) = "$drvPath" ]]
+done
+
 nix-store -q --tree "$drvPath" | grep '───.*builder-dependencies-input-1.sh'
 
 # Test Graphviz graph generation.
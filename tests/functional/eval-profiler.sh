@@ -0,0 +1,16 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+profile="$TEST_ROOT/eval-profile"
+
+nix-instantiate --eval \
+    --eval-profile-file "$profile" \
+    --eval-profiler-frequency 10000 \
+    --expr 'let fib = n: if n < 2 then n else fib (n - 1) + fib (n - 2); in fib 25'
+
+# Every line is a stack of frames followed by a sample count.
+grep -q . "$profile"
+(! grep -vE '^«top-level»(;[^;]+)* [0-9]+$' "$profile")
+
+grepQuiet "^«top-level»;'fib' at «string»:1:11;'fib' at «string»:1:11" "$profile"
@@ -23,6 +23,13 @@ nix eval --expr 'assert 1 + 2 == 3; true'
 [[ $(nix eval int -f - < "./eval.nix") == 123 ]]
 [[ "$(nix eval --expr '{"assert"=1;bar=2;}')" == '{ "assert" = 1; bar = 2; }' ]]
 
+# Check that an evaluation error doesn't leave partial JSON on stdout,
+# even if the output so far is larger than the JSON writer's buffer.
+partial='{ a = builtins.genList (x: x) 100000; b = throw "foo"; }'
+expectStderr 1 nix eval --json --expr "$partial" | grepQuiet foo
+[[ -z "$(nix eval --json --expr "$partial" 2> /dev/null || true)" ]]
+[[ -z "$(nix-instantiate --eval --strict --json -E "$partial" 2> /dev/null || true)" ]]
+
 # Check if toFile can be utilized during restricted eval
 [[ $(nix eval --restrict-eval --expr 'import (builtins.toFile "source" "42")') == 42 ]]
 
@@ -62,3 +69,41 @@ out="$(expectStderr 0 nix eval --option foobar baz --expr '""' --raw)"
 # Test flag alias
 out="$(nix eval --expr '{}' --build-cores 1)"
 [[ "$(echo "$out" | wc -l)" = 1 ]]
+
+# Test that files prefetched by `prefetch-imports` evaluate the same,
+# and that errors in files that are never imported are not reported.
+mkdir -p $TEST_ROOT/prefetch
+echo '{ a = import ./a.nix; b = if false then import ./broken.nix else 2; c = ./c; }' > $TEST_ROOT/prefetch/default.nix
+echo '{ x = 1; y = import ./c; }' > $TEST_ROOT/prefetch/a.nix
+echo 'this is not { valid' > $TEST_ROOT/prefetch/broken.nix
+mkdir -p $TEST_ROOT/prefetch/c
+echo '[ 3 ]' > $TEST_ROOT/prefetch/c/default.nix
+[[ "$(nix eval --json --option prefetch-imports true --file $TEST_ROOT/prefetch a)" = '{"x":1,"y":[3]}' ]]
+[[ "$(nix eval --option prefetch-imports true --file $TEST_ROOT/prefetch b)" = 2 ]]
+
+# Test that calls whose environment can't be captured use the
+# environment stack, and that those using it evaluate correctly.
+for f in env-stack env-stack-defaults; do
+    NIX_SHOW_STATS=1 NIX_SHOW_STATS_PATH=$TEST_ROOT/stats.json \
+        nix-instantiate --eval --strict lang/eval-okay-$f.nix > $TEST_ROOT/$f.out
+    diff $TEST_ROOT/$f.out lang/eval-okay-$f.exp
+    [[ "$(jq .envs.onStack < $TEST_ROOT/stats.json)" -gt 0 ]]
+done
+
+# Test that files loaded from the parse cache evaluate the same as
+# parsed ones, and that their errors point to the same positions.
+for f in attrs attrs6 concatmap functionargs ind-string let scope-1 string with; do
+    for i in 1 2; do
+        NIX_SHOW_STATS=1 NIX_SHOW_STATS_PATH=$TEST_ROOT/stats.json \
+            nix-instantiate --option parse-cache true --eval --strict lang/eval-okay-$f.nix > $TEST_ROOT/$f.out
+        diff $TEST_ROOT/$f.out lang/eval-okay-$f.exp
+    done
+    [[ "$(jq .parser.cacheHits < $TEST_ROOT/stats.json)" -gt 0 ]]
+done
+
+printf '{ x ? 1 }:\n\n  let y = x + "a"; in y\n' > $TEST_ROOT/parse-cache-error.nix
+expectStderr 1 nix-instantiate --eval $TEST_ROOT/parse-cache-error.nix > $TEST_ROOT/parse-cache-error.expected
+for i in 1 2; do
+    expectStderr 1 nix-instantiate --option parse-cache true --eval $TEST_ROOT/parse-cache-error.nix \
+        | diff - $TEST_ROOT/parse-cache-error.expected
+done
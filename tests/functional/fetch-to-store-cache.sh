@@ -0,0 +1,52 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+dir="$TEST_ROOT/stat-cache"
+rm -rf "$dir"
+mkdir -p "$dir/sub"
+echo foo > "$dir/sub/foo"
+echo bar > "$dir/bar"
+
+# Files that changed within the last second are never cached.
+sleep 2
+
+expr="builtins.path { path = $dir; filter = path: type: builtins.trace \"filter \${baseNameOf path}\" (baseNameOf path != \"bar\"); }"
+
+out1=$(nix-instantiate --eval --debug --expr "$expr" 2> "$TEST_ROOT/log")
+grepQuietInverse "store path cache hit" "$TEST_ROOT/log"
+
+# The filter is called once per entry, not again while copying.
+[[ $(grep -c "trace: filter" "$TEST_ROOT/log") = 3 ]]
+
+# An unchanged tree is not copied again.
+out2=$(nix-instantiate --eval --debug --expr "$expr" 2> "$TEST_ROOT/log")
+grepQuiet "store path cache hit" "$TEST_ROOT/log"
+[[ "$out1" = "$out2" ]]
+
+# Changes to files excluded by the filter don't matter.
+echo baz > "$dir/bar"
+sleep 2
+out2=$(nix-instantiate --eval --debug --expr "$expr" 2> "$TEST_ROOT/log")
+grepQuiet "store path cache hit" "$TEST_ROOT/log"
+[[ "$out1" = "$out2" ]]
+
+# Changes to included files do.
+echo baz > "$dir/sub/foo"
+sleep 2
+out2=$(nix-instantiate --eval --debug --expr "$expr" 2> "$TEST_ROOT/log")
+grepQuietInverse "store path cache hit" "$TEST_ROOT/log"
+[[ "$out1" != "$out2" ]]
+
+# Changes replace the cache entry of the tree instead of adding one.
+[[ $(sqlite3 "$TEST_HOME/.cache/nix/fetcher-cache-v2.sqlite" "select count(*) from Cache where domain = 'statFetchToStore'") = 1 ]]
+
+# Different filters on the same tree have their own entries, so using
+# them in turn doesn't make them evict each other.
+expr2="builtins.path { path = $dir; filter = path: type: baseNameOf path != \"sub\"; }"
+nix-instantiate --eval --expr "$expr2" > /dev/null
+for e in "$expr" "$expr2"; do
+    nix-instantiate --eval --debug --expr "$e" 2> "$TEST_ROOT/log" > /dev/null
+    grepQuiet "store path cache hit" "$TEST_ROOT/log"
+done
+[[ $(sqlite3 "$TEST_HOME/.cache/nix/fetcher-cache-v2.sqlite" "select count(*) from Cache where domain = 'statFetchToStore'") = 2 ]]
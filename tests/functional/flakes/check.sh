@@ -92,6 +92,39 @@ checkRes=$(nix flake check --all-systems --keep-going $flakeDir 2>&1 && fail "ni
 echo "$checkRes" | grepQuiet "packages.system-1.default"
 echo "$checkRes" | grepQuiet "packages.system-2.default"
 
+checkRes=$(nix flake check --all-systems --keep-going --eval-jobs 2 $flakeDir 2>&1 && fail "nix flake check --all-systems should have failed" || true)
+echo "$checkRes" | grepQuiet "packages.system-1.default"
+echo "$checkRes" | grepQuiet "packages.system-2.default"
+
+# A check that has been evaluated while another one is being built
+# doesn't wait for that build. Here the slow check only finishes once
+# the fast one, which comes after it, has been built.
+cp ../config.nix $flakeDir/
+cat > $flakeDir/flake.nix <<EOF
+{
+  outputs = { self }: with import ./config.nix; {
+    checks.$system = {
+      a-slow = mkDerivation {
+        name = "slow";
+        buildCommand = ''
+          while [[ ! -e $TEST_ROOT/fast-built ]]; do sleep 0.1; done
+          mkdir \$out
+        '';
+      };
+      b-fast = mkDerivation {
+        name = "fast";
+        buildCommand = ''
+          touch $TEST_ROOT/fast-built
+          mkdir \$out
+        '';
+      };
+    };
+  };
+}
+EOF
+
+timeout 60 nix flake check --max-jobs 2 $flakeDir
+
 cat > $flakeDir/flake.nix <<EOF
 {
   outputs = { self }: {
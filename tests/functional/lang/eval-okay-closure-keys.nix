@@ -0,0 +1,27 @@
+let
+
+  keysOf = startSet: map (x: x.key) (builtins.genericClosure {
+    inherit startSet;
+    operator = x: x.next or [];
+  });
+
+in [
+  # Integers and floats denoting the same number are the same key.
+  (keysOf [ { key = 1; } { key = 1.0; } { key = 2.5; } ])
+
+  (keysOf [ { key = "a"; next = [ { key = "b"; } { key = "a"; } ]; } ])
+
+  (keysOf [ { key = ./a; } { key = ./b; } { key = ./a; } ])
+
+  (keysOf [
+    { key = [ "foo" 1 ]; next = [ { key = [ "foo" 1.0 ]; } { key = [ "foo" 2 ]; } ]; }
+    { key = [ "bar" 1 ]; }
+  ])
+
+  # Keys of different shapes fall back to ordered comparison.
+  (keysOf [ { key = [ 1 ]; } { key = [ 1 2 ]; } { key = [ 1.0 ]; } { key = [ ]; } ])
+
+  # So do lists with unevaluated elements, which are not forced
+  # unless the comparison gets to them.
+  (map builtins.head (keysOf [ { key = [ 1 (throw "x") ]; } { key = [ 2 (throw "x") ]; } ]))
+]
@@ -0,0 +1,27 @@
+with builtins;
+
+let
+
+  mkDrv = name: derivation { inherit name; builder = "/bin/sh"; system = "x86_64-linux"; };
+
+  a = mkDrv "a";
+  b = mkDrv "b";
+
+  sa = "${a}";
+  sb = "${b}";
+
+  ctx = s: attrNames (getContext s);
+
+in [
+  # Parts that share a context.
+  (ctx "${sa}/bin:${sa}/lib" == ctx sa)
+  (ctx (sa + "/bin" + sa) == ctx sa)
+  # Parts with different contexts.
+  (ctx "${sa}:${sb}" == sort lessThan (ctx sa ++ ctx sb))
+  (ctx "${sa}:${sb}:${sa}" == ctx "${sb}:${sa}")
+  # A shared context merged with one from a non-string part.
+  (ctx "${sa}:${b}" == ctx "${sa}:${sb}")
+  (ctx "${a}:${sa}" == ctx sa)
+  # Strings without context.
+  (getContext "${unsafeDiscardStringContext sa}:${"x"}" == { })
+]
@@ -0,0 +1,19 @@
+# A default that refers to another argument of the same function is
+# evaluated before that argument is set, so it becomes a thunk over the
+# function's environment. That environment must not be released when
+# the call returns, even though nothing else captures it.
+let
+  wrap = x: [ x ];
+  f = { a ? b, b ? 1 }: wrap a;
+  g = { a ? b, b ? a }: wrap b;
+
+  # Calls that reuse the memory of released environments.
+  add = x: y: x + y;
+  sumTo = n: builtins.foldl' add 0 (builtins.genList (i: i) n);
+
+  r1 = f { b = 2; };
+  r2 = f { };
+  r3 = g { a = 3; };
+in
+  builtins.seq r1 (builtins.seq r2 (builtins.seq r3 (builtins.seq (sumTo 100)
+    (r1 ++ r2 ++ r3))))
@@ -0,0 +1,24 @@
+# Calls to functions whose environment is not captured by a thunk or a
+# closure use stack-allocated environments.
+let
+  id = x: x;
+  second = a: b: b;
+  isFoo = x: x == "foo";
+  getName = { name, default ? "none" }: name;
+  getDefault = { name, default ? "none" }: default;
+  nested = x: id (id (id x));
+  check = x: assert x; x;
+  deep = n: if n == 0 then 0 else 1 + deep (n - 1);
+in [
+  (id 1)
+  (second 1 2)
+  (isFoo "foo")
+  (getName { name = "a"; })
+  (getDefault { name = "a"; })
+  (nested 5)
+  (builtins.tryEval (check false))
+  (map getName [ { name = "x"; } { name = "y"; } ])
+  (builtins.sort (a: b: a < b) [ 3 1 2 ])
+  (builtins.filter isFoo [ "foo" "bar" (id "foo") ])
+  (deep 100)
+]
@@ -0,0 +1,8 @@
+builtins.fromJSON ''
+  {
+    "b": [ 1, { "x": [ ], "y": { } }, [ [ "a" ], [ ] ] ],
+    "a": { "d": 1, "c": { "e": [ true, null ] }, "d": 2 },
+    "c": [ { "z": 1, "y": 2 }, { "y": 3 } ],
+    "b": "last"
+  }
+''
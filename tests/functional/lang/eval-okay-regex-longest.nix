@@ -0,0 +1,13 @@
+# `builtins.split` takes the longest match at the leftmost position
+# where a match starts (POSIX "leftmost-longest"), not the first match
+# that a backtracking matcher would find there. The groups are those of
+# the first way to obtain that match, preferring the left side of
+# alternations and more iterations of loops.
+with builtins;
+
+[
+  (split "a*(a|ab)*" "ab")
+  (split "((a|b).{1,2}){1,2}" "cxaaac")
+  (split "(a|ab)(c|bcd)(d*)" "xabcdx")
+  (match "(a|ab)(c|bcd)(d*)" "abcd")
+]
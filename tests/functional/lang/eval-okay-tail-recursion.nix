@@ -0,0 +1,19 @@
+# Function calls in tail position (also under `let`, `with`, `if` and
+# `assert`) don't use up the C++ stack or count towards `max-call-depth`,
+# so deep tail recursion works with the default settings.
+let
+  sum = acc: n:
+    let acc' = acc + n; in
+    if n == 0 then acc
+    else if acc' < 0 then throw "overflow"
+    else sum acc' (n - 1);
+
+  count = { n, acc ? 0 }:
+    assert acc >= 0;
+    with { step = 1; };
+    if n == 0 then acc else count { n = n - 1; acc = acc + step; };
+
+  isEven = n: if n == 0 then true else isOdd (n - 1);
+  isOdd = n: if n == 0 then false else isEven (n - 1);
+in
+  [ (sum 0 200000) (count { n = 200000; }) (isEven 200001) ]
@@ -0,0 +1,12 @@
+let
+  big = builtins.listToAttrs (builtins.genList (n: { name = "a${toString (n + 10)}"; value = n; }) 90);
+  small = { a10 = "first"; a50 = "middle"; a99 = "last"; a5 = "before"; b = "after"; };
+  updated = big // small;
+  updatedLiteral = big // { a50 = "middle"; c = "new"; };
+in
+[
+  (builtins.length (builtins.attrNames updated))
+  (map (n: updated.${n}) [ "a5" "a10" "a11" "a49" "a50" "a51" "a98" "a99" "b" ])
+  (builtins.length (builtins.attrNames updatedLiteral))
+  (map (n: updatedLiteral.${n}) [ "a10" "a50" "a99" "c" ])
+]
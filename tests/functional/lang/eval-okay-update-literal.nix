@@ -0,0 +1,14 @@
+let
+  base = { a = 1; b = 2; d = 4; };
+  src = { e = 5; };
+  x = 10;
+in
+[
+  (base // { })
+  (base // { b = 20; c = 30; })
+  (base // { inherit x; inherit (src) e; })
+  ({ } // { a = 1; })
+  (base // { a = base.b; z = builtins.attrNames base; })
+  # The attributes of the right-hand side are still lazy.
+  (builtins.attrNames (base // { c = throw "not evaluated"; }))
+]
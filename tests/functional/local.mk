@@ -69,6 +69,7 @@ nix_tests = \
   add.sh \
   chroot-store.sh \
   filter-source.sh \
+  fetch-to-store-cache.sh \
   misc.sh \
   dump-db.sh \
   linux-sandbox.sh \
@@ -83,6 +84,7 @@ nix_tests = \
   nix-copy-ssh-ng.sh \
   post-hook.sh \
   function-trace.sh \
+  eval-profiler.sh \
   fmt.sh \
   eval-store.sh \
   why-depends.sh \
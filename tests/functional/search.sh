@@ -49,3 +49,44 @@ e=$'\x1b' # grep doesn't support \e, \033 or even \x1b
 (( $(nix search -f search.nix foo ^ --exclude 'foo|bar' | grep -Ec 'foo|bar') == 0 ))
 (( $(nix search -f search.nix foo ^ -e foo --exclude bar | grep -Ec 'foo|bar') == 0 ))
 [[ $(nix search -f search.nix '' ^ -e bar --json | jq -c 'keys') == '["foo","hello"]' ]]
+
+## Parallel search of flakes
+
+flakeDir=$TEST_ROOT/search-flake
+mkdir -p $flakeDir
+cp config.nix $flakeDir/
+
+writeSearchFlake() {
+    cat > $flakeDir/flake.nix <<EOF
+{
+  outputs = { self }: with import ./config.nix; {
+    packages.$system = $1 builtins.listToAttrs (builtins.genList (n: {
+      name = "pkg\${toString n}";
+      value = mkDerivation { name = "pkg-\${toString n}"; buildCommand = "touch \$out"; };
+    }) 50);
+  };
+}
+EOF
+}
+
+writeSearchFlake ""
+
+# Results are printed in the same order as by a sequential search.
+nix search --eval-jobs 1 $flakeDir ^ > $TEST_ROOT/search-sequential
+(( $(grep -c '^\* ' $TEST_ROOT/search-sequential) == 50 ))
+for jobs in 0 4; do
+    nix search --eval-jobs $jobs $flakeDir ^ > $TEST_ROOT/search-parallel
+    diff $TEST_ROOT/search-sequential $TEST_ROOT/search-parallel
+done
+
+# The evaluators of all threads contribute to the profile. Only the
+# workers call mkDerivation, so its frames would be missing if the
+# main thread's profile replaced theirs.
+rm -f $TEST_ROOT/search-profile
+nix search --eval-jobs 4 --eval-profile-file $TEST_ROOT/search-profile --eval-profiler-frequency 10000 $flakeDir ^ > /dev/null
+grepQuiet "'mkDerivation' at " $TEST_ROOT/search-profile
+
+# The error of a failed worker is reported, even if the main thread is
+# still handing out work when it fails.
+writeSearchFlake '{ a-broken = throw "this package is broken"; } //'
+expectStderr 1 nix search --eval-jobs 4 $flakeDir ^ | grepQuiet "this package is broken"
@@ -0,0 +1,152 @@
+#include <benchmark/benchmark.h>
+
+#include "eval.hh"
+#include "eval-gc.hh"
+#include "eval-settings.hh"
+#include "fetch-settings.hh"
+#include "store-api.hh"
+
+#if HAVE_BOEHMGC
+#  include <gc/gc.h>
+#endif
+
+using namespace nix;
+
+/**
+ * Evaluate `expr` (deeply) once per iteration. The expression is
+ * parsed once, outside of the timed loop. Besides the time, this
+ * reports the bytes allocated and the number of garbage collections
+ * per iteration.
+ */
+static void BM_Eval(benchmark::State & bstate, std::string_view expr)
+{
+    bool readOnlyMode = true;
+    fetchers::Settings fetchSettings{};
+    EvalSettings evalSettings{readOnlyMode};
+    evalSettings.nixPath = {};
+
+    auto store = openStore("dummy://");
+    EvalState state({}, store, fetchSettings, evalSettings, nullptr);
+
+    auto e = state.parseExprFromString(std::string(expr), state.rootPath(CanonPath::root));
+
+#if HAVE_BOEHMGC
+    auto bytesBefore = GC_get_total_bytes();
+    auto cyclesBefore = getGCCycles();
+#endif
+
+    for (auto _ : bstate) {
+        Value v;
+        state.eval(e, v);
+        state.forceValueDeep(v);
+        benchmark::DoNotOptimize(v);
+    }
+
+#if HAVE_BOEHMGC
+    bstate.counters["gcBytes"] = benchmark::Counter(
+        GC_get_total_bytes() - bytesBefore, benchmark::Counter::kAvgIterations);
+    bstate.counters["gcCycles"] = benchmark::Counter(
+        getGCCycles() - cyclesBefore, benchmark::Counter::kAvgIterations);
+#endif
+}
+
+/* Micro benchmarks. */
+
+BENCHMARK_CAPTURE(BM_Eval, attrSelect, R"(
+    let
+      attrs = builtins.listToAttrs (builtins.genList (n: { name = "a${toString n}"; value = n; }) 1000);
+    in builtins.foldl' (acc: _: acc + attrs.a0 + attrs.a500 + attrs.a999) 0 (builtins.genList (n: n) 100000)
+)");
+
+BENCHMARK_CAPTURE(BM_Eval, attrSelectDefault, R"(
+    let
+      attrs = builtins.listToAttrs (builtins.genList (n: { name = "a${toString n}"; value = n; }) 1000);
+    in builtins.foldl' (acc: _: acc + (attrs.missing or 1)) 0 (builtins.genList (n: n) 100000)
+)");
+
+BENCHMARK_CAPTURE(BM_Eval, updateSmall, R"(
+    builtins.foldl' (acc: n: acc // { a = n; b = n; }) { c = 0; } (builtins.genList (n: n) 100000)
+)");
+
+BENCHMARK_CAPTURE(BM_Eval, updateLargeLeft, R"(
+    let
+      big = builtins.listToAttrs (builtins.genList (n: { name = "a${toString n}"; value = n; }) 10000);
+    in builtins.foldl' (acc: n: acc + (big // { a5000 = n; }).a5000) 0 (builtins.genList (n: n) 1000)
+)");
+
+BENCHMARK_CAPTURE(BM_Eval, callLambda, R"(
+    let f = a: b: a + b;
+    in builtins.foldl' f 0 (builtins.genList (n: n) 100000)
+)");
+
+BENCHMARK_CAPTURE(BM_Eval, callFormals, R"(
+    let f = { a, b ? 1, ... }: a + b;
+    in builtins.foldl' (acc: n: acc + f { a = n; c = n; }) 0 (builtins.genList (n: n) 100000)
+)");
+
+BENCHMARK_CAPTURE(BM_Eval, callPrimOp, R"(
+    builtins.foldl' (acc: n: builtins.add acc (builtins.mul n 2)) 0 (builtins.genList (n: n) 100000)
+)");
+
+BENCHMARK_CAPTURE(BM_Eval, genericClosure, R"(
+    builtins.length (builtins.genericClosure {
+      startSet = [ { key = 0; } ];
+      operator = x: if x.key < 20000 then [ { key = x.key + 1; } { key = x.key / 2; } ] else [ ];
+    })
+)");
+
+BENCHMARK_CAPTURE(BM_Eval, toJSON, R"(
+    builtins.toJSON (builtins.genList (n: { inherit n; s = "item-${toString n}"; l = [ n true null 1.5 ]; }) 10000)
+)");
+
+BENCHMARK_CAPTURE(BM_Eval, fromJSON, R"(
+    builtins.fromJSON (builtins.toJSON (builtins.genList (n: { inherit n; s = "item-${toString n}"; l = [ n true null 1.5 ]; }) 10000))
+)");
+
+BENCHMARK_CAPTURE(BM_Eval, concatStringsSep, R"(
+    builtins.concatStringsSep "," (builtins.genList toString 100000)
+)");
+
+BENCHMARK_CAPTURE(BM_Eval, stringInterpolation, R"(
+    builtins.foldl' (acc: n: acc + builtins.stringLength "${toString n}-${toString n}/bin") 0 (builtins.genList (n: n) 100000)
+)");
+
+/* Macro benchmarks. */
+
+BENCHMARK_CAPTURE(BM_Eval, largeAttrs, R"(
+    let
+      attrs = builtins.listToAttrs (builtins.genList (n: {
+        name = "attr${toString n}";
+        value = { inherit n; deps = builtins.genList (m: n - m) (if n < 5 then n else 5); };
+      }) 50000);
+    in builtins.mapAttrs (name: v: v // { total = builtins.foldl' (a: b: a + b) 0 v.deps; }) attrs
+)");
+
+BENCHMARK_CAPTURE(BM_Eval, overlayFixpoint, R"(
+    let
+      fix = f: let x = f x; in x;
+      extends = overlay: f: final: let prev = f final; in prev // overlay final prev;
+      base = final: builtins.listToAttrs (builtins.genList (n: {
+        name = "pkg${toString n}";
+        value = {
+          name = "pkg${toString n}";
+          deps = if n == 0 then [ ] else [ final."pkg${toString (n / 2)}".name ];
+        };
+      }) 5000);
+      overlays = builtins.genList (i: final: prev: {
+        "pkg${toString i}" = prev."pkg${toString i}" // { overlaid = i; };
+      }) 200;
+    in fix (builtins.foldl' (f: overlay: extends overlay f) base overlays)
+)");
+
+BENCHMARK_CAPTURE(BM_Eval, moduleFixpoint, R"(
+    let
+      modules = builtins.genList (i: { config, ... }: {
+        "opt${toString i}" = {
+          value = (config."opt${toString (i / 2)}".value or 0) + 1;
+          enable = i / 3 * 3 == i;
+        };
+      }) 2000;
+      config = builtins.foldl' (acc: m: acc // m { inherit config; }) { } modules;
+    in builtins.filter (name: config.${name}.enable) (builtins.attrNames config)
+)");
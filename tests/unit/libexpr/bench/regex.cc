@@ -0,0 +1,135 @@
+#include <benchmark/benchmark.h>
+
+#include <regex>
+
+#include "regex.hh"
+#include "fmt.hh"
+
+using namespace nix;
+
+/**
+ * `std::regex`, which `builtins.match` and `builtins.split` used
+ * before, for comparison.
+ */
+struct StdRegex
+{
+    std::regex regex;
+
+    StdRegex(std::string_view re)
+        : regex(std::string(re), std::regex::extended)
+    { }
+
+    bool match(std::string_view s) const
+    {
+        std::cmatch match;
+        return std::regex_match(s.begin(), s.end(), match, regex);
+    }
+
+    size_t split(std::string_view s) const
+    {
+        return std::distance(std::cregex_iterator(s.begin(), s.end(), regex), std::cregex_iterator());
+    }
+};
+
+struct NixRegex
+{
+    Regex regex;
+
+    NixRegex(std::string_view re)
+        : regex(re)
+    { }
+
+    bool match(std::string_view s) const
+    {
+        return regex.match(s).has_value();
+    }
+
+    size_t split(std::string_view s) const
+    {
+        return regex.searchAll(s).size();
+    }
+};
+
+/**
+ * Package names and versions in the style of Nixpkgs.
+ */
+static const std::vector<std::string> & packageNames()
+{
+    static const std::vector<std::string> names = []() {
+        std::vector<std::string> names;
+        for (size_t n = 0; n < 1000; ++n)
+            names.push_back(fmt("python3.%d-package%d-%d.%d.%d%s", n % 13, n, n % 7, n % 31, n % 5, n % 4 ? "" : "-rc1"));
+        return names;
+    }();
+    return names;
+}
+
+/**
+ * File names in a source tree, as seen by source filters.
+ */
+static const std::vector<std::string> & filePaths()
+{
+    static const std::vector<std::string> paths = []() {
+        std::vector<std::string> paths;
+        const char * dirs[] = {"src", "src/libexpr", "tests/functional", ".git/objects/ab", "doc/manual/source", "result-man"};
+        const char * files[] = {"default.nix", "README.md", "eval.cc", "eval.hh", "pack-1234.idx", ".eval.cc.swp", "meson.build"};
+        for (size_t n = 0; n < 1000; ++n)
+            paths.push_back(fmt("/home/user/src/project/%s/%s", dirs[n % std::size(dirs)], files[n % std::size(files)]));
+        return paths;
+    }();
+    return paths;
+}
+
+template<typename Engine>
+static void matchAll(benchmark::State & bstate, std::string_view re, const std::vector<std::string> & (*inputs)())
+{
+    Engine engine(re);
+    auto & strings = inputs();
+
+    for (auto _ : bstate)
+        for (auto & s : strings)
+            benchmark::DoNotOptimize(engine.match(s));
+
+    bstate.SetItemsProcessed(bstate.iterations() * strings.size());
+}
+
+/**
+ * Split a large file into lines, as e.g. `lib.splitString "\n"` does.
+ */
+template<typename Engine>
+static void BM_RegexSplitLines(benchmark::State & bstate)
+{
+    Engine engine("(\n)");
+
+    std::string text;
+    for (size_t n = 0; n < 5000; ++n)
+        text += fmt("  pkg%d = callPackage ../pkgs/pkg%d { };\n", n, n);
+
+    for (auto _ : bstate)
+        benchmark::DoNotOptimize(engine.split(text));
+
+    bstate.SetBytesProcessed(bstate.iterations() * text.size());
+}
+
+static void BM_StdRegexMatch(benchmark::State & bstate, std::string_view re, const std::vector<std::string> & (*inputs)())
+{
+    matchAll<StdRegex>(bstate, re, inputs);
+}
+
+static void BM_NixRegexMatch(benchmark::State & bstate, std::string_view re, const std::vector<std::string> & (*inputs)())
+{
+    matchAll<NixRegex>(bstate, re, inputs);
+}
+
+#define REGEX_BENCHMARKS(name, re, inputs) \
+    BENCHMARK_CAPTURE(BM_StdRegexMatch, name, re, inputs); \
+    BENCHMARK_CAPTURE(BM_NixRegexMatch, name, re, inputs)
+
+REGEX_BENCHMARKS(parseDrvName, "(.*)-([0-9].*)", packageNames);
+REGEX_BENCHMARKS(versionComponents, ".*-([0-9]+)\\.([0-9]+)(\\.([0-9]+))?(-rc[0-9]+)?", packageNames);
+REGEX_BENCHMARKS(vcsDirectory, "^(.*/)?\\.(git|svn|hg)(/.*)?$", filePaths);
+REGEX_BENCHMARKS(resultLink, ".*/result(-.*)?", filePaths);
+REGEX_BENCHMARKS(fileExtension, ".*\\.(nix|md|cc|hh)", filePaths);
+
+BENCHMARK(BM_RegexSplitLines<StdRegex>);
+BENCHMARK(BM_RegexSplitLines<NixRegex>);
@@ -0,0 +1,102 @@
+#include <benchmark/benchmark.h>
+
+#include <regex>
+#include <unordered_map>
+
+#include "chunked-vector.hh"
+#include "symbol-table.hh"
+
+using namespace nix;
+
+/**
+ * The symbol table as it was before it became safe for concurrent
+ * use, for comparison.
+ */
+class UnorderedMapSymbolTable
+{
+    std::unordered_map<std::string_view, std::pair<const std::string *, uint32_t>> symbols;
+    ChunkedVector<std::string, 8192> store{16};
+
+public:
+
+    uint32_t create(std::string_view s)
+    {
+        auto it = symbols.find(s);
+        if (it != symbols.end()) return it->second.second + 1;
+
+        const auto & [rawSym, idx] = store.add(std::string(s));
+        symbols.emplace(rawSym, std::make_pair(&rawSym, idx));
+        return idx + 1;
+    }
+};
+
+/**
+ * The identifiers of a large, Nixpkgs-like package set, in the order
+ * in which the parser interns them.
+ */
+static const std::vector<std::string> & symbolStream()
+{
+    static const std::vector<std::string> stream = []() {
+        std::string expr = "{ lib, stdenv, fetchurl, callPackage, python3 }:\n{\n";
+
+        for (size_t n = 0; n < 20000; ++n)
+            expr += fmt(
+                "  pkg%1% = stdenv.mkDerivation {\n"
+                "    pname = \"pkg%1%\";\n"
+                "    version = \"1.%2%\";\n"
+                "    src = fetchurl { url = \"mirror://pkg%1%.tar.gz\"; hash = lib.fakeHash; };\n"
+                "    buildInputs = [ pkg%3% pkg%4% python3.pkgs.setuptools ];\n"
+                "    doCheck = stdenv.buildPlatform.canExecute stdenv.hostPlatform;\n"
+                "    passthru.tests = callPackage ./tests.nix { inherit pkg%1%; };\n"
+                "    meta = with lib; { description = \"Package %1%\"; license = licenses.mit; platforms = platforms.unix; };\n"
+                "  };\n",
+                n, n % 10, n / 2, n / 3);
+
+        expr += "}\n";
+
+        std::vector<std::string> stream;
+        std::regex token(R"("[^"]*"|([A-Za-z_][A-Za-z0-9_'-]*))");
+        for (auto i = std::sregex_iterator(expr.begin(), expr.end(), token); i != std::sregex_iterator(); ++i)
+            if ((*i)[1].matched)
+                stream.push_back((*i)[1].str());
+
+        return stream;
+    }();
+
+    return stream;
+}
+
+template<typename Table>
+static void BM_SymbolTableCreate(benchmark::State & bstate)
+{
+    auto & stream = symbolStream();
+
+    for (auto _ : bstate) {
+        Table table;
+        for (auto & s : stream)
+            benchmark::DoNotOptimize(table.create(s));
+    }
+
+    bstate.SetItemsProcessed(bstate.iterations() * stream.size());
+}
+
+BENCHMARK(BM_SymbolTableCreate<SymbolTable>);
+BENCHMARK(BM_SymbolTableCreate<UnorderedMapSymbolTable>);
+
+/**
+ * Look up the symbols in a table shared by all benchmark threads.
+ */
+static void BM_SymbolTableCreateShared(benchmark::State & bstate)
+{
+    static SymbolTable table;
+
+    auto & stream = symbolStream();
+
+    for (auto _ : bstate)
+        for (auto & s : stream)
+            benchmark::DoNotOptimize(table.create(s));
+
+    bstate.SetItemsProcessed(bstate.iterations() * stream.size());
+}
+
+BENCHMARK(BM_SymbolTableCreateShared)->ThreadRange(1, 8)->UseRealTime();
@@ -1,6 +1,8 @@
 #include "tests/libexpr.hh"
 #include "value-to-json.hh"
 
+#include <nlohmann/json.hpp>
+
 namespace nix {
 // Testing the conversion to JSON
 
@@ -57,6 +59,48 @@ namespace nix {
         ASSERT_EQ(getJSONValue(v), "\"test\\\"\"");
     }
 
+    TEST_F(JSONValueTest, StringEscapes) {
+        Value v;
+        v.mkString("tab\there \u00e9");
+        ASSERT_EQ(getJSONValue(v), "\"tab\\there \u00e9\"");
+    }
+
+    TEST_F(JSONValueTest, Nested) {
+        auto v = eval(R"({ b = [ 1 2.5 null ]; a = { y = "y"; x = [ ]; }; c = { }; })");
+        ASSERT_EQ(getJSONValue(v), R"({"a":{"x":[],"y":"y"},"b":[1,2.5,null],"c":{}})");
+    }
+
+    TEST_F(JSONValueTest, Sink) {
+        auto v = eval(R"({ f = 1 / 4.0; s = "a\"b"; xs = builtins.genList (n: { n = n; s = "x${toString n}"; }) 3; })");
+        StringSink sink;
+        NixStringContext context;
+        printValueAsJSON(state, true, v, noPos, sink, context);
+        ASSERT_EQ(sink.s, R"({"f":0.25,"s":"a\"b","xs":[{"n":0,"s":"x0"},{"n":1,"s":"x1"},{"n":2,"s":"x2"}]})");
+    }
+
+    TEST_F(JSONValueTest, SinkLarge) {
+        // Larger than the writer's buffer, so the output reaches the
+        // sink in several pieces.
+        auto v = eval(R"(builtins.genList (n: "item${toString n}") 20000)");
+        std::string expected = "[";
+        for (size_t n = 0; n < 20000; ++n) {
+            if (n) expected += ',';
+            expected += "\"item" + std::to_string(n) + "\"";
+        }
+        expected += "]";
+        StringSink sink;
+        NixStringContext context;
+        printValueAsJSON(state, true, v, noPos, sink, context);
+        ASSERT_EQ(sink.s, expected);
+    }
+
+    TEST_F(JSONValueTest, Tree) {
+        auto v = eval(R"({ b = [ 1 2.5 null ]; a = "x"; })");
+        NixStringContext context;
+        ASSERT_EQ(printValueAsJSON(state, true, v, noPos, context),
+            nlohmann::json::parse(R"({"a":"x","b":[1,2.5,null]})"));
+    }
+
     // The dummy store doesn't support writing files. Fails with this exception message:
     // C++ exception with description "error: operation 'addToStoreFromDump' is
     // not supported by store 'dummy'" thrown in the test body.
@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "pos-table.hh"
+
+namespace nix {
+
+static Pos::Origin stringOrigin(std::string s)
+{
+    return Pos::String{.source = make_ref<std::string>(std::move(s))};
+}
+
+TEST(PosTable, linesAndColumns)
+{
+    PosTable positions;
+
+    auto origin = positions.addOrigin(stringOrigin("foo\nbar\n\nbaz"), 12);
+
+    auto start = positions[positions.add(origin, 0)];
+    ASSERT_EQ(start.line, 1);
+    ASSERT_EQ(start.column, 1);
+
+    auto second = positions[positions.add(origin, 5)];
+    ASSERT_EQ(second.line, 2);
+    ASSERT_EQ(second.column, 2);
+
+    auto last = positions[positions.add(origin, 10)];
+    ASSERT_EQ(last.line, 4);
+    ASSERT_EQ(last.column, 2);
+
+    ASSERT_FALSE(positions.add(origin, 13));
+    ASSERT_FALSE(positions[noPos]);
+}
+
+TEST(PosTable, manyOrigins)
+{
+    PosTable positions;
+
+    /* Enough to need several index resizes. */
+    std::vector<PosIdx> idxs;
+    for (size_t n = 0; n < 1000; ++n) {
+        auto source = fmt("\n%d", n);
+        /* Like the parser, leave room for a terminator, so that no
+           position is the same as the start of the next origin. */
+        auto origin = positions.addOrigin(stringOrigin(source), source.size() + 1);
+        idxs.push_back(positions.add(origin, 1 + n % 2));
+    }
+
+    for (auto [n, idx] : enumerate(idxs)) {
+        auto pos = positions[idx];
+        ASSERT_EQ(pos.line, 2);
+        ASSERT_EQ(pos.column, 1 + n % 2);
+        ASSERT_EQ(*std::get<Pos::String>(pos.origin).source, fmt("\n%d", n));
+    }
+}
+
+TEST(PosTable, resolveMany)
+{
+    PosTable positions;
+
+    auto a = positions.addOrigin(stringOrigin("a\nb\nc"), 5);
+    auto b = positions.addOrigin(stringOrigin("ab\ncd"), 5);
+
+    std::vector<PosIdx> idxs{
+        positions.add(a, 0),
+        positions.add(a, 4),
+        positions.add(b, 0),
+        noPos,
+        positions.add(b, 4),
+        positions.add(a, 2),
+        positions.add(a, 5),
+    };
+
+    auto resolved = positions.resolve(idxs);
+
+    ASSERT_EQ(resolved.size(), idxs.size());
+    for (auto [n, idx] : enumerate(idxs)) {
+        auto pos = positions[idx];
+        ASSERT_EQ(resolved[n].line, pos.line);
+        ASSERT_EQ(resolved[n].column, pos.column);
+        ASSERT_EQ(resolved[n].origin, pos.origin);
+    }
+}
+
+TEST(PosTable, concurrentAddAndResolve)
+{
+    PosTable positions;
+
+    auto first = positions.addOrigin(stringOrigin("x\ny"), 3);
+    auto idx = positions.add(first, 2);
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 4; ++t)
+        threads.emplace_back([&]() {
+            for (size_t n = 0; n < 500; ++n) {
+                auto origin = positions.addOrigin(stringOrigin("a\nb"), 3);
+                auto pos = positions[positions.add(origin, 2)];
+                ASSERT_EQ(pos.line, 2);
+                ASSERT_EQ(positions[idx].line, 2);
+            }
+        });
+
+    for (auto & thread : threads)
+        thread.join();
+}
+
+}
@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+
+#include <set>
+#include <thread>
+
+#include "symbol-table.hh"
+
+namespace nix {
+
+TEST(SymbolTable, createIsIdempotent)
+{
+    SymbolTable symbols;
+
+    auto foo = symbols.create("foo");
+    auto bar = symbols.create("bar");
+
+    ASSERT_TRUE(foo);
+    ASSERT_NE(foo, bar);
+    ASSERT_EQ(foo, symbols.create("foo"));
+    ASSERT_EQ(symbols[foo], "foo");
+    ASSERT_EQ(symbols[bar], "bar");
+    ASSERT_EQ(symbols.size(), 2);
+}
+
+TEST(SymbolTable, emptyString)
+{
+    SymbolTable symbols;
+
+    auto empty = symbols.create("");
+
+    ASSERT_TRUE(empty);
+    ASSERT_TRUE(symbols[empty].empty());
+    ASSERT_EQ(empty, symbols.create(""));
+}
+
+TEST(SymbolTable, grows)
+{
+    SymbolTable symbols;
+
+    /* Enough to need several chunks and to grow every shard's table. */
+    std::vector<Symbol> created;
+    for (size_t n = 0; n < 10000; ++n)
+        created.push_back(symbols.create("sym" + std::to_string(n)));
+
+    ASSERT_EQ(symbols.size(), 10000);
+
+    for (size_t n = 0; n < 10000; ++n) {
+        ASSERT_EQ(symbols[created[n]], "sym" + std::to_string(n));
+        ASSERT_EQ(symbols.create("sym" + std::to_string(n)), created[n]);
+    }
+
+    size_t total = 0;
+    symbols.dump([&](const std::string & s) { total += s.size(); });
+    ASSERT_EQ(total, symbols.totalSize());
+}
+
+TEST(SymbolTable, widenHash)
+{
+    /* 64-bit hashes are used as they are. */
+    ASSERT_EQ(SymbolTable::widenHash(uint64_t(0x123456789abcdef0)), 0x123456789abcdef0);
+
+    /* Widened 32-bit hashes differ in their upper halves, which are
+       used as tags, while their lower bits still depend only on the
+       lower bits of the hash. */
+    std::set<uint64_t> tags;
+    for (uint32_t hash = 0; hash < 1024; ++hash) {
+        auto wide = SymbolTable::widenHash(hash);
+        ASSERT_EQ(wide % 32, SymbolTable::widenHash(hash % 32) % 32);
+        tags.insert(wide >> 32);
+    }
+    ASSERT_EQ(tags.size(), 1024);
+}
+
+TEST(SymbolTable, concurrentCreate)
+{
+    SymbolTable symbols;
+
+    constexpr size_t nrThreads = 8, nrSymbols = 5000;
+
+    std::vector<std::vector<Symbol>> created(nrThreads);
+    std::vector<std::thread> threads;
+
+    for (size_t t = 0; t < nrThreads; ++t)
+        threads.emplace_back([&, t]() {
+            /* Every thread creates the same symbols, in a different
+               order. */
+            for (size_t n = 0; n < nrSymbols; ++n) {
+                auto i = (n + t * nrSymbols / nrThreads) % nrSymbols;
+                created[t].push_back(symbols.create("sym" + std::to_string(i)));
+            }
+        });
+
+    for (auto & thread : threads)
+        thread.join();
+
+    ASSERT_EQ(symbols.size(), nrSymbols);
+
+    for (size_t n = 0; n < nrSymbols; ++n) {
+        auto sym = symbols.create("sym" + std::to_string(n));
+        ASSERT_EQ(symbols[sym], "sym" + std::to_string(n));
+        for (size_t t = 0; t < nrThreads; ++t)
+            ASSERT_EQ(created[t][(n + nrSymbols - t * nrSymbols / nrThreads) % nrSymbols], sym);
+    }
+}
+
+} // namespace nix
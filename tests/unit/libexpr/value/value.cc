@@ -1,3 +1,5 @@
+#include <limits>
+
 #include "value.hh"
 
 #include "tests/libstore.hh"
@@ -22,4 +24,38 @@ TEST_F(ValueTest, vInt)
     ASSERT_EQ(true, vInt.isValid());
 }
 
+TEST_F(ValueTest, compactStorage)
+{
+    if constexpr (sizeof(void *) == 8)
+        ASSERT_EQ(sizeof(Value), 16);
+
+    Value v;
+    v.mkInt(std::numeric_limits<NixInt::Inner>::min());
+    ASSERT_EQ(nInt, v.type());
+    ASSERT_EQ(std::numeric_limits<NixInt::Inner>::min(), v.integer().value);
+
+    v.mkFloat(-0.5);
+    ASSERT_EQ(nFloat, v.type());
+    ASSERT_EQ(-0.5, v.fpoint());
+
+    v.mkBool(true);
+    ASSERT_EQ(nBool, v.type());
+    ASSERT_TRUE(v.boolean());
+
+    Value v1, v2;
+    v.mkApp(&v1, &v2);
+    ASSERT_TRUE(v.isApp());
+    ASSERT_EQ(&v1, v.app().left);
+    ASSERT_EQ(&v2, v.app().right);
+
+    v.mkPrimOpApp(&v1, &v2);
+    ASSERT_TRUE(v.isPrimOpApp());
+    ASSERT_EQ(&v1, v.primOpApp().left);
+    ASSERT_EQ(&v2, v.primOpApp().right);
+
+    v.mkBlackhole();
+    ASSERT_TRUE(v.isBlackhole());
+    ASSERT_EQ(nullptr, v.thunk().env);
+}
+
 } // namespace nix
@@ -0,0 +1,71 @@
+#include <benchmark/benchmark.h>
+
+#include "derivations.hh"
+#include "file-system.hh"
+#include "store-api.hh"
+#include "tests/characterization.hh"
+
+using namespace nix;
+
+/**
+ * Parse `contents` as a derivation once per iteration.
+ */
+static void parseDerivationLoop(benchmark::State & bstate, const std::string & contents)
+{
+    auto store = openStore("dummy://");
+
+    for (auto _ : bstate) {
+        auto drv = parseDerivation(*store, std::string(contents), "bench");
+        benchmark::DoNotOptimize(drv);
+    }
+
+    bstate.SetBytesProcessed(bstate.iterations() * contents.size());
+}
+
+/* The derivations in the characterisation test data. */
+
+static void BM_ParseDerivationFile(benchmark::State & bstate, std::string_view fileName)
+{
+    parseDerivationLoop(bstate, readFile(getUnitTestData() / "derivation" / fileName));
+}
+
+BENCHMARK_CAPTURE(BM_ParseDerivationFile, simple, "simple.drv");
+BENCHMARK_CAPTURE(BM_ParseDerivationFile, advancedAttributes, "advanced-attributes.drv");
+BENCHMARK_CAPTURE(BM_ParseDerivationFile, structuredAttrs, "advanced-attributes-structured-attrs.drv");
+
+/**
+ * A derivation shaped like a typical Nixpkgs package: many input
+ * derivations and environment variables, and a build script that
+ * contains escaped characters.
+ */
+static void BM_ParseDerivationLarge(benchmark::State & bstate)
+{
+    auto nrInputs = bstate.range(0);
+    auto store = openStore("dummy://");
+
+    Derivation drv;
+    drv.name = "bench";
+    drv.platform = "x86_64-linux";
+    drv.builder = "/nix/store/w7hy3qg1w7hy3qg1w7hy3qg1w7hy3qg1-bash-5.2/bin/bash";
+    drv.args = {"-e", "/nix/store/hy3qg1w7hy3qg1w7hy3qg1w7hy3qg1w7-default-builder.sh"};
+    drv.outputs.insert_or_assign("out", DerivationOutput::InputAddressed {
+        .path = StorePath::random("bench"),
+    });
+
+    std::string buildInputs;
+    for (int64_t i = 0; i < nrInputs; ++i) {
+        auto name = fmt("dep-%d", i);
+        drv.inputDrvs.map.insert_or_assign(StorePath::random(name + ".drv"), DerivedPathMap<StringSet>::ChildNode {
+            .value = {"out"},
+        });
+        drv.inputSrcs.insert(StorePath::random(name + "-source"));
+        buildInputs += store->printStorePath(StorePath::random(name)) + " ";
+        drv.env.insert_or_assign(fmt("var%d", i), fmt("value %d", i));
+    }
+    drv.env.insert_or_assign("buildInputs", buildInputs);
+    drv.env.insert_or_assign("buildPhase", "runHook preBuild\n\tmake -j$NIX_BUILD_CORES \"$@\"\n\trunHook postBuild\n");
+
+    parseDerivationLoop(bstate, drv.unparse(*store, false));
+}
+
+BENCHMARK(BM_ParseDerivationLarge)->Arg(10)->Arg(100)->Arg(1000);
@@ -0,0 +1,39 @@
+#include "drv-hash-cache.hh"
+
+#include <gtest/gtest.h>
+
+namespace nix {
+
+TEST(DrvHashCache, create_and_read) {
+    Path tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+    Path dbPath(tmpDir + "/test-drv-hash-cache.sqlite");
+
+    auto h1 = hashString(HashAlgorithm::SHA256, "foo");
+    auto h2 = hashString(HashAlgorithm::SHA256, "bar");
+
+    {
+        auto cache = getTestDrvHashCache(dbPath);
+
+        ASSERT_EQ(cache->lookup("/nix/store/g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo.drv"), std::nullopt);
+
+        cache->upsert("/nix/store/g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo.drv", DrvHash {
+            .hashes = {{"out", h1}, {"dev", h2}},
+            .kind = DrvHash::Kind::Deferred,
+        });
+    }
+
+    // Reopen the database to check that the entry was persisted.
+    auto cache = getTestDrvHashCache(dbPath);
+
+    auto res = cache->lookup("/nix/store/g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo.drv");
+    ASSERT_TRUE(res);
+    ASSERT_EQ(res->kind, DrvHash::Kind::Deferred);
+    ASSERT_EQ(res->hashes.size(), 2);
+    ASSERT_EQ(res->hashes.at("out"), h1);
+    ASSERT_EQ(res->hashes.at("dev"), h2);
+
+    ASSERT_EQ(cache->lookup("/nix/store/g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-bar.drv"), std::nullopt);
+}
+
+}
@@ -0,0 +1,145 @@
+#include "regex.hh"
+#include <gtest/gtest.h>
+
+namespace nix {
+
+    static std::vector<std::optional<std::string_view>> groups(const Regex::Match & m)
+    {
+        std::vector<std::optional<std::string_view>> res;
+        for (size_t i = 1; i < m.size(); ++i)
+            res.push_back(m[i]);
+        return res;
+    }
+
+    /* ----------------------------------------------------------------------------
+     * syntax
+     * --------------------------------------------------------------------------*/
+
+    TEST(Regex, acceptsExtendedSyntax) {
+        for (auto re : {
+            "", "a|", "|a", "()", "a**", "a{2}", "a{2,}", "a{1,2}{3}", "}", "]", "a}",
+            "[]a]", "[^]a]", "[a-]", "[-a]", "[--/]", "[[:alpha:]-]", "[[:ALPHA:]]",
+            "[[.a.]]", "[[=a=]]", "[\\]", "\\.", "\\{", "\\|", "\\\\", "^$", "a^b",
+        })
+            ASSERT_NO_THROW(Regex{re}) << re;
+    }
+
+    TEST(Regex, rejectsInvalidSyntax) {
+        for (auto re : {
+            "*a", "(*a)", "a|*b", "^*", "$*", "{", "a{", "a{x}", "a{,2}", "a{3,2}",
+            "(a", "a)", "[a", "[]", "[^]", "[z-a]", "[a-c-e]", "[[:alpha:]-z]",
+            "[[:foo:]]", "[[.ab.]]", "\\", "\\d", "\\n", "\\}", "\\]",
+        })
+            ASSERT_THROW(Regex{re}, RegexError) << re;
+    }
+
+    TEST(Regex, rejectsHugePrograms) {
+        ASSERT_THROW(Regex{"a{99999}"}, RegexTooLargeError);
+        ASSERT_THROW(Regex{"(a{1000}){1000}"}, RegexTooLargeError);
+        ASSERT_NO_THROW(Regex{"a{1000}"});
+    }
+
+    TEST(Regex, countsGroups) {
+        ASSERT_EQ(Regex{"abc"}.groups(), 0);
+        ASSERT_EQ(Regex{"(a)(b(c))"}.groups(), 3);
+        ASSERT_EQ(Regex{"\\(a\\)"}.groups(), 0);
+    }
+
+    /* ----------------------------------------------------------------------------
+     * match
+     * --------------------------------------------------------------------------*/
+
+    TEST(Regex, matchesEntireString) {
+        ASSERT_FALSE(Regex{"ab"}.match("abc"));
+        ASSERT_TRUE(Regex{"abc"}.match("abc"));
+        ASSERT_TRUE(Regex{""}.match(""));
+        ASSERT_FALSE(Regex{""}.match("a"));
+    }
+
+    TEST(Regex, matchGroups) {
+        auto m = Regex{"a(b)(c)"}.match("abc");
+        ASSERT_TRUE(m);
+        ASSERT_EQ(groups(*m), (std::vector<std::optional<std::string_view>>{"b", "c"}));
+
+        m = Regex{"[[:space:]]+([[:upper:]]+)[[:space:]]+"}.match("  FOO   ");
+        ASSERT_TRUE(m);
+        ASSERT_EQ(groups(*m), (std::vector<std::optional<std::string_view>>{"FOO"}));
+
+        m = Regex{"(a)|(b)"}.match("b");
+        ASSERT_TRUE(m);
+        ASSERT_EQ(groups(*m), (std::vector<std::optional<std::string_view>>{std::nullopt, "b"}));
+    }
+
+    TEST(Regex, matchPrefersEarlierGroups) {
+        auto m = Regex{"(.*)-([0-9].*)"}.match("hello-world-1.2-3");
+        ASSERT_TRUE(m);
+        ASSERT_EQ(groups(*m), (std::vector<std::optional<std::string_view>>{"hello-world-1.2", "3"}));
+
+        m = Regex{"(a|ab)(c|bcd)(d*)"}.match("abcd");
+        ASSERT_TRUE(m);
+        ASSERT_EQ(groups(*m), (std::vector<std::optional<std::string_view>>{"a", "bcd", ""}));
+    }
+
+    TEST(Regex, matchBracketExpressions) {
+        Regex re{"[]a-c[:digit:]-]+"};
+        ASSERT_TRUE(re.match("]ab9-c"));
+        ASSERT_FALSE(re.match("d"));
+
+        Regex neg{"[^a]"};
+        ASSERT_TRUE(neg.match("\n"));
+        ASSERT_FALSE(neg.match("a"));
+    }
+
+    TEST(Regex, matchIsLinear) {
+        /* These take exponential time or overflow the stack with a
+           backtracking matcher. */
+        std::string s(100000, 'a');
+        ASSERT_FALSE(Regex{"(a*)*b"}.match(s));
+        ASSERT_TRUE(Regex{"(a|aa)*"}.match(s));
+        ASSERT_TRUE(Regex{"(.|\n)*"}.match(s));
+    }
+
+    /* ----------------------------------------------------------------------------
+     * search
+     * --------------------------------------------------------------------------*/
+
+    TEST(Regex, searchIsLeftmostLongest) {
+        auto m = Regex{"o+|fo"}.search("xfoo");
+        ASSERT_TRUE(m);
+        ASSERT_EQ(m->start(), 1);
+        ASSERT_EQ(m->end(), 3);
+
+        m = Regex{"a|ab"}.search("xab");
+        ASSERT_TRUE(m);
+        ASSERT_EQ(*(*m)[0], "ab");
+    }
+
+    TEST(Regex, searchAnchors) {
+        ASSERT_TRUE(Regex{"^a"}.search("ab"));
+        ASSERT_FALSE(Regex{"^b"}.search("ab", 1));
+        auto m = Regex{"$"}.search("ab");
+        ASSERT_TRUE(m);
+        ASSERT_EQ(m->start(), 2);
+    }
+
+    TEST(Regex, searchAll) {
+        auto ms = Regex{"(o+)"}.searchAll("oooofoooo");
+        ASSERT_EQ(ms.size(), 2);
+        ASSERT_EQ(*ms[0][1], "oooo");
+        ASSERT_EQ(ms[1].start(), 5);
+
+        /* Empty matches, like std::regex_iterator. */
+        ms = Regex{"x*"}.searchAll("axb");
+        ASSERT_EQ(ms.size(), 4);
+        ASSERT_EQ(ms[0].start(), 0);
+        ASSERT_EQ(ms[0].end(), 0);
+        ASSERT_EQ(ms[1].start(), 1);
+        ASSERT_EQ(ms[1].end(), 2);
+        ASSERT_EQ(ms[2].start(), 2);
+        ASSERT_EQ(ms[2].end(), 2);
+        ASSERT_EQ(ms[3].start(), 3);
+
+        ASSERT_TRUE(Regex{"b"}.searchAll("aaa").empty());
+    }
+
+}